@@ -1,76 +1,883 @@
 #include "Benchmarks.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <random>
+#include <thread>
+#include <unordered_map>
 
 #include "Db.hpp"
 #include "Index.hpp"
+#include "LatencyHistogram.hpp"
+#include "PerfCounters.hpp"
 #include "Utils.hpp"
 
-static void selectCampaigns()
+// Run aOp aRepeats times and return throughput in GB/s, given that every call
+// of aOp streams aBytes bytes.
+template <class OP>
+static double measureThroughput(size_t aRepeats, size_t aBytes, OP aOp)
+{
+    CTimer sTimer(true);
+    for (size_t i = 0; i < aRepeats; i++)
+        aOp();
+    sTimer.Stop();
+    unsigned long long sMicrosec = std::max<unsigned long long>(1, sTimer.ElapsedMicroSec());
+    return double(aRepeats) * double(aBytes) / double(sMicrosec) / 1000.;
+}
+
+// Throughput of bitset bulk operations for every supported SIMD level.
+// Bitsets have the same size as campaign bitsets of the index.
+static void benchBitsetKernels()
+{
+    using namespace target::kernels;
+
+    const size_t sBits = IndexedCampaigns.size();
+    const size_t sBytes = (sBits + 63) / 64 * 8;
+    // Campaign bitsets are small, repeat operations to get measurable time.
+    const size_t sRepeats = std::max<size_t>(1, (size_t(256) << 20) / sBytes);
+    std::cout << "// Bitset kernels, " << sBits << " bits, detected level: "
+              << level_name(detected_level()) << std::endl;
+
+    target::dynamic_bitset sSrc(sBits), sDst(sBits), sZero(sBits);
+    for (size_t i = 0; i < sBits; i += 3)
+        sSrc.set(i);
+    size_t sSink = 0;
+    std::ios_base::fmtflags sFlags = std::cout.flags();
+    std::streamsize sPrecision = std::cout.precision();
+
+    for (size_t sLevelNo = 0; sLevelNo < SIMD_LEVEL_COUNT; sLevelNo++)
+    {
+        simd_level sLevel = simd_level(sLevelNo);
+        if (!select_level(sLevel))
+            continue;
+        sDst = sSrc;
+        double sAnd = measureThroughput(sRepeats, 2 * sBytes, [&]() { sDst &= sSrc; });
+        double sOr = measureThroughput(sRepeats, 2 * sBytes, [&]() { sDst |= sSrc; });
+        double sSub = measureThroughput(sRepeats, 2 * sBytes, [&]() { sDst -= sSrc; });
+        double sFlip = measureThroughput(sRepeats, sBytes, [&]() { sDst.flip(); });
+        double sCount = measureThroughput(sRepeats, sBytes, [&]() { sSink += sSrc.count(); });
+        double sAny = measureThroughput(sRepeats, sBytes, [&]() { sSink += sZero.any(); });
+        sDst = sSrc;
+        double sEqual = measureThroughput(sRepeats, 2 * sBytes, [&]() { sSink += sDst == sSrc; });
+
+        std::cout << std::fixed << std::setprecision(2)
+                  << std::setw(7) << level_name(sLevel) << " (GB/s):"
+                  << " &= " << sAnd << ", |= " << sOr << ", -= " << sSub
+                  << ", flip " << sFlip << ", count " << sCount
+                  << ", any " << sAny << ", == " << sEqual << std::endl;
+    }
+    std::cout.flags(sFlags);
+    std::cout.precision(sPrecision);
+    select_level(detected_level());
+    std::cout << "(checksum " << sSink << ")" << std::endl;
+}
+
+// Collect up to aCount leaf pads. Pads are taken from DB if it's loaded,
+// from the dense index otherwise (e.g. if the index is loaded from snapshot).
+static std::vector<uint32_t> leafPads(size_t aCount)
+{
+    std::vector<uint32_t> sRes;
+    if (!Pads.empty())
+    {
+        for (auto& sPair : Pads)
+        {
+            if (sRes.size() >= aCount)
+                break;
+            if (sPair.second.m_DirectChildren.empty())
+                sRes.push_back(sPair.first);
+        }
+        return sRes;
+    }
+    CEpochReadScope sScope;
+    const IndexVersion* sIndex = currentIndex();
+    if (nullptr == sIndex)
+        return sRes;
+    const DenseIndex& sDense = sIndex->m_Dense;
+    for (size_t i = 0; i < sDense.m_PadIds.size() && sRes.size() < aCount; i++)
+        if (sDense.m_PadIsLeaf[i])
+            sRes.push_back(sDense.m_PadIds[i]);
+    return sRes;
+}
+
+// Sample of aCount leaf pads by options, with repetitions; the count is clamped
+// to the count of leaf pads, so small data sets are sampled too. Leaf pads are
+// sorted by ID first, so a seed gives the same sample regardless of hash map order.
+static std::vector<uint32_t> sampleLeafPads(const BenchOptions& aOptions, size_t aCount)
+{
+    std::vector<uint32_t> sLeafPads = leafPads(SIZE_MAX);
+    std::sort(sLeafPads.begin(), sLeafPads.end());
+    std::vector<uint32_t> sSample;
+    if (sLeafPads.empty())
+        return sSample;
+    aCount = std::min(aCount, sLeafPads.size());
+    std::mt19937 sRandom(aOptions.m_Seed);
+    if (!aOptions.m_Zipf)
+    {
+        std::uniform_int_distribution<size_t> sPad(0, sLeafPads.size() - 1);
+        for (size_t i = 0; i < aCount; i++)
+            sSample.push_back(sLeafPads[sPad(sRandom)]);
+        return sSample;
+    }
+    // Ranks are assigned in random order, so hot pads are spread over the index.
+    std::shuffle(sLeafPads.begin(), sLeafPads.end(), sRandom);
+    std::vector<double> sCumulativeWeights(sLeafPads.size());
+    double sTotal = 0;
+    for (size_t i = 0; i < sLeafPads.size(); i++)
+    {
+        sTotal += 1. / std::pow(double(i + 1), aOptions.m_ZipfExponent);
+        sCumulativeWeights[i] = sTotal;
+    }
+    std::uniform_real_distribution<double> sWeight(0., sTotal);
+    for (size_t i = 0; i < aCount; i++)
+    {
+        size_t sRank = std::upper_bound(sCumulativeWeights.begin(), sCumulativeWeights.end(), sWeight(sRandom)) -
+                       sCumulativeWeights.begin();
+        sSample.push_back(sLeafPads[std::min(sRank, sLeafPads.size() - 1)]);
+    }
+    return sSample;
+}
+
+// Sample of up to aCount leaf pads for a benchmark (see sampleLeafPads()).
+// If there are no leaf pads, the benchmark aName is reported as skipped.
+static std::vector<uint32_t> benchLeafPads(const BenchOptions& aOptions, size_t aCount, const char* aName)
+{
+    std::vector<uint32_t> sPadIds = sampleLeafPads(aOptions, aCount);
+    if (sPadIds.empty())
+        std::cout << "// " << aName << ": skipped, there are no leaf pads" << std::endl;
+    return sPadIds;
+}
+
+static void selectCampaigns(const BenchOptions& aOptions)
 {
 	size_t sWantPads = 10000;
-	size_t sGotPads = 0;
-	std::cout << "// Test for " << sWantPads << " leaf pads:" << std::endl;
+	std::vector<uint32_t> sPadIds = benchLeafPads(aOptions, sWantPads, "Select campaigns");
+	if (sPadIds.empty())
+	    return;
+	std::cout << "// Test for " << sPadIds.size() << " leaf pads:" << std::endl;
 	target::dynamic_bitset sAll(IndexedCampaigns.size());
+	target::dynamic_bitset sCampBitset;
 	{
         CTitle title("Benchmark: select all campaigns for pads");
+        title.SetQueries(sPadIds.size());
 
-        for (auto& sPair : Pads)
+        for (uint32_t sPadId : sPadIds)
         {
-            uint32_t sPadId = sPair.first;
-			const Pad& sPad = sPair.second;
-			if (!sPad.m_DirectChildren.empty())
-				continue; // Skip non leaf pads.
-			sGotPads++;
-			sAll |= campaignsByPad(sPadId);
-			if (sGotPads >= sWantPads)
-				break;
+			campaignsByPad(sPadId, sCampBitset);
+			sAll |= sCampBitset;
         }
     }
-	check(sGotPads == sWantPads, "Not enough leaf pads");
     std::cout << "Total " << sAll.count() << " from " << IndexedCampaigns.size() << std::endl;
 }
 
-static void selectCampaignsAndBanners()
+static void selectCampaignsInBatches(const BenchOptions& aOptions)
+{
+	size_t sWantPads = 10000;
+	size_t sBatchSize = 256;
+	std::vector<uint32_t> sPadIds = benchLeafPads(aOptions, sWantPads, "Batched queries");
+	if (sPadIds.empty())
+	    return;
+	std::cout << "// Test for " << sPadIds.size() << " leaf pads, batches of " << sBatchSize
+	          << ", cache is disabled:" << std::endl;
+	size_t sCacheBudget = campaignsCacheBudget();
+	setCampaignsCacheBudget(0);
+
+	target::dynamic_bitset sAll(IndexedCampaigns.size());
+	target::dynamic_bitset sCampBitset;
+	{
+        CTitle title("Benchmark: select campaigns for pads one by one");
+        title.SetQueries(sPadIds.size());
+
+        for (uint32_t sPadId : sPadIds)
+        {
+			campaignsByPad(sPadId, sCampBitset);
+			sAll |= sCampBitset;
+        }
+    }
+    std::cout << "Total " << sAll.count() << " from " << IndexedCampaigns.size() << std::endl;
+
+	target::dynamic_bitset sAllBatched(IndexedCampaigns.size());
+	CampaignsBatch sBatch;
+	size_t sGroups = 0, sReused = 0, sEvaluated = 0;
+	{
+        CTitle title("Benchmark: select campaigns for pads in batches");
+        title.SetQueries(sPadIds.size());
+
+        for (size_t i = 0; i < sPadIds.size(); i += sBatchSize)
+        {
+			size_t sCount = std::min(sBatchSize, sPadIds.size() - i);
+			campaignsByPads(sPadIds.data() + i, sCount, sBatch);
+			for (size_t j = 0; j < sBatch.m_Bitsets.size(); j++)
+				sAllBatched |= sBatch.m_Bitsets[j];
+			sGroups += sBatch.m_Bitsets.size();
+			sReused += sBatch.m_ReusedOperands;
+			sEvaluated += sBatch.m_EvaluatedOperands;
+        }
+    }
+    std::cout << "Total " << sAllBatched.count() << " from " << IndexedCampaigns.size()
+              << ", groups " << sGroups << ", operands reused / evaluated "
+              << sReused << " / " << sEvaluated << std::endl;
+	check(sAll == sAllBatched, "Batched results differ");
+
+	setCampaignsCacheBudget(sCacheBudget);
+}
+
+static void selectCampaignsAndBanners(const BenchOptions& aOptions)
 {
 	size_t sWantPads = 1000;
-	size_t sGotPads = 0;
-	std::cout << "// Test for " << sWantPads << " leaf pads:" << std::endl;
+	std::vector<uint32_t> sPadIds = benchLeafPads(aOptions, sWantPads, "Select campaigns and banners");
+	if (sPadIds.empty())
+	    return;
+	std::cout << "// Test for " << sPadIds.size() << " leaf pads:" << std::endl;
 	size_t sTotal = 0;
+	size_t sAllowed = 0;
+	std::vector<uint32_t> sBannerIds;
+	target::dynamic_bitset sCampBitset;
     {
         CTitle title("Benchmark: select all campaigns and banners for pads");
+        title.SetQueries(sPadIds.size());
 
-        for (auto& sPair : Pads)
+        for (uint32_t sPadId : sPadIds)
         {
-            uint32_t sPadId = sPair.first;
-			const Pad& sPad = sPair.second;
-			if (!sPad.m_DirectChildren.empty())
-				continue; // Skip non leaf pads.
-			sGotPads++;
-			target::dynamic_bitset sCampBitset = campaignsByPad(sPadId);
-            const std::unordered_set<uint32_t>& sFilteredBanners = filteredBannersByPad(sPadId);
+            // Filtered banners and banner IDs refer to the index version.
+            CEpochReadScope sScope;
+			campaignsByPad(sPadId, sCampBitset);
+            CFilteredBanners sFilteredBanners = filteredBannersByPad(sScope, sPadId);
+            const CFlatArray<uint32_t>& sAllBannerIds = currentIndex()->m_BannerIds;
+            sBannerIds.clear();
             for (size_t sBit = sCampBitset.find_first();
                  sBit != sCampBitset.npos;
                  sBit = sCampBitset.find_next(sBit))
             {
                 const IndexedCampaign& sIndCamp = IndexedCampaigns[sBit];
-                Campaign& sCamp = Campaigns[sIndCamp.m_CampaignId];
-                for (uint32_t sBannId : sCamp.m_BannerIds)
+                CFilteredBanners sFiltered = sFilteredBanners.range(sIndCamp.m_FirstBannerPosition, sIndCamp.m_BannerCount);
+                sTotal += sFiltered.size();
+                // Allowed banners are the slice of the campaign in the banner ID column
+                // without filtered positions.
+                const uint32_t* sFilteredItr = sFiltered.begin();
+                uint32_t sLast = sIndCamp.m_FirstBannerPosition + sIndCamp.m_BannerCount;
+                for (uint32_t k = sIndCamp.m_FirstBannerPosition; k < sLast; k++)
                 {
-                    if (sFilteredBanners.find(sBannId) != sFilteredBanners.end())
-                        sTotal++;
+                    if (sFilteredItr != sFiltered.end() && *sFilteredItr == k)
+                        ++sFilteredItr;
+                    else
+                        sBannerIds.push_back(sAllBannerIds[k]);
                 }
             }
-			if (sGotPads >= sWantPads)
-				break;
+            sAllowed += sBannerIds.size();
+		}
+    }
+    std::cout << "Total " << sTotal << ", allowed banners " << sAllowed << std::endl;
+}
+
+static void selectBanners(const BenchOptions& aOptions)
+{
+	size_t sWantPads = 1000;
+	std::vector<uint32_t> sPadIds = benchLeafPads(aOptions, sWantPads, "Select banners");
+	if (sPadIds.empty())
+	    return;
+	std::cout << "// Test for " << sPadIds.size() << " leaf pads:" << std::endl;
+	size_t sTotal = 0;
+	target::dynamic_bitset sBannerBitset;
+    {
+        CTitle title("Benchmark: select allowed banners for pads");
+        title.SetQueries(sPadIds.size());
+
+        for (uint32_t sPadId : sPadIds)
+        {
+			bannersByPad(sPadId, sBannerBitset);
+			sTotal += sBannerBitset.count();
 		}
     }
-	check(sGotPads == sWantPads, "Not enough leaf pads");
-    std::cout << "Total " << sTotal << std::endl;
+    std::cout << "Total " << sTotal << " banners" << std::endl;
+}
+
+// Run aWorker(aThreadNo) on aThreads threads at once and return elapsed time in microseconds.
+// aWorker returns a checksum, which is summed to aChecksum.
+template <class WORKER>
+static unsigned long long runThreads(size_t aThreads, WORKER aWorker, size_t& aChecksum)
+{
+    std::vector<std::thread> sThreads;
+    std::vector<size_t> sChecksums(aThreads, 0);
+    std::atomic<size_t> sReady(0);
+    std::atomic<bool> sStart(false);
+    for (size_t t = 0; t < aThreads; t++)
+    {
+        sThreads.emplace_back([&, t]()
+        {
+            CPerfCountersThread sCounters;
+            sReady++;
+            while (!sStart)
+                std::this_thread::yield();
+            sChecksums[t] = aWorker(t);
+        });
+    }
+    // Start all threads at once, so thread creation is not measured.
+    while (sReady != aThreads)
+        std::this_thread::yield();
+    CTimer sTimer(true);
+    sStart = true;
+    for (std::thread& sThread : sThreads)
+        sThread.join();
+    sTimer.Stop();
+    for (size_t sChecksum : sChecksums)
+        aChecksum += sChecksum;
+    return std::max<unsigned long long>(1, sTimer.ElapsedMicroSec());
+}
+
+// Throughput of selectCampaigns() and selectCampaignsAndBanners() queries on
+// 1, 2, 4 .. hardware_concurrency threads. Every thread does the same number of
+// queries over the same leaf pads (starting from different pads), so ideal
+// scaling is linear. Efficiency is throughput per thread relative to one thread.
+static void benchThreadScaling(const BenchOptions& aOptions)
+{
+	size_t sWantPads = 10000;
+	std::vector<uint32_t> sPadIds = benchLeafPads(aOptions, sWantPads, "Thread scaling");
+	if (sPadIds.empty())
+	    return;
+    size_t sMaxThreads = std::max<unsigned>(1, std::thread::hardware_concurrency());
+    std::vector<size_t> sThreadCounts;
+    for (size_t n = 1; n < sMaxThreads; n *= 2)
+        sThreadCounts.push_back(n);
+    sThreadCounts.push_back(sMaxThreads);
+    std::cout << "// Thread scaling for " << sPadIds.size() << " leaf pads, up to "
+              << sMaxThreads << " threads:" << std::endl;
+
+    // Pads that thread aThreadNo queries: aQueries pads starting from its own offset.
+    auto sPadOfQuery = [&](size_t aThreadNo, size_t aThreads, size_t aQuery) -> uint32_t
+    {
+        return sPadIds[(aThreadNo * sPadIds.size() / aThreads + aQuery) % sPadIds.size()];
+    };
+    const size_t sCampaignQueries = 20000;
+    const size_t sBannerQueries = 5000;
+
+    std::ios_base::fmtflags sFlags = std::cout.flags();
+    std::streamsize sPrecision = std::cout.precision();
+    std::cout << std::fixed << std::setprecision(0);
+    double sCampaignsBase = 0, sBannersBase = 0;
+    size_t sChecksum = 0;
+    for (size_t sThreads : sThreadCounts)
+    {
+        unsigned long long sCampaignsTime = runThreads(sThreads, [&](size_t aThreadNo) -> size_t
+        {
+            target::dynamic_bitset sCampBitset;
+            size_t sTotal = 0;
+            for (size_t i = 0; i < sCampaignQueries; i++)
+            {
+                campaignsByPad(sPadOfQuery(aThreadNo, sThreads, i), sCampBitset);
+                sTotal += sCampBitset.any();
+            }
+            return sTotal;
+        }, sChecksum);
+        unsigned long long sBannersTime = runThreads(sThreads, [&](size_t aThreadNo) -> size_t
+        {
+            target::dynamic_bitset sCampBitset;
+            size_t sTotal = 0;
+            for (size_t i = 0; i < sBannerQueries; i++)
+            {
+                uint32_t sPadId = sPadOfQuery(aThreadNo, sThreads, i);
+                CEpochReadScope sScope;
+                campaignsByPad(sPadId, sCampBitset);
+                CFilteredBanners sFilteredBanners = filteredBannersByPad(sScope, sPadId);
+                for (size_t sBit = sCampBitset.find_first();
+                     sBit != sCampBitset.npos;
+                     sBit = sCampBitset.find_next(sBit))
+                {
+                    const IndexedCampaign& sIndCamp = IndexedCampaigns[sBit];
+                    sTotal += sFilteredBanners.range(sIndCamp.m_FirstBannerPosition, sIndCamp.m_BannerCount).size();
+                }
+            }
+            return sTotal;
+        }, sChecksum);
+
+        // Queries per second.
+        double sCampaigns = double(sThreads * sCampaignQueries) * 1e6 / double(sCampaignsTime);
+        double sBanners = double(sThreads * sBannerQueries) * 1e6 / double(sBannersTime);
+        if (1 == sThreads)
+        {
+            sCampaignsBase = sCampaigns;
+            sBannersBase = sBanners;
+        }
+        std::cout << std::setw(3) << sThreads << " threads:"
+                  << " campaigns " << sCampaigns << " q/s (efficiency "
+                  << 100. * sCampaigns / sCampaignsBase / double(sThreads) << "%),"
+                  << " campaigns and banners " << sBanners << " q/s (efficiency "
+                  << 100. * sBanners / sBannersBase / double(sThreads) << "%)" << std::endl;
+    }
+    std::cout.flags(sFlags);
+    std::cout.precision(sPrecision);
+    std::cout << "(checksum " << sChecksum << ")" << std::endl;
+}
+
+// campaignsByPad() queries with evaluated and with materialized results of groups
+// of the queried pads. The result cache is disabled to see the difference.
+static void benchMaterializedGroups(const BenchOptions& aOptions)
+{
+    if (Pads.empty())
+    {
+        std::cout << "// Materialized groups: skipped, the index is loaded from snapshot" << std::endl;
+        return;
+    }
+    size_t sWantPads = 10000;
+    const size_t sRepeats = 10;
+    std::vector<uint32_t> sPadIds = benchLeafPads(aOptions, sWantPads, "Materialized groups");
+    if (sPadIds.empty())
+        return;
+    std::cout << "// Test for " << sPadIds.size() << " leaf pads, " << sRepeats
+              << " times, cache is disabled:" << std::endl;
+    size_t sCacheBudget = campaignsCacheBudget();
+    setCampaignsCacheBudget(0);
+
+    std::vector<target::dynamic_bitset> sExpected(sPadIds.size());
+    target::dynamic_bitset sCampBitset;
+    {
+        CTitle title("Benchmark: select campaigns for pads, results are evaluated");
+        title.SetQueries(sRepeats * sPadIds.size());
+        for (size_t sRepeat = 0; sRepeat < sRepeats; sRepeat++)
+        {
+            for (size_t i = 0; i < sPadIds.size(); i++)
+            {
+                campaignsByPad(sPadIds[i], sCampBitset);
+                if (0 == sRepeat)
+                    sExpected[i] = sCampBitset;
+            }
+        }
+    }
+
+    // Every queried pad is counted once, so all their groups are materialized.
+    std::unordered_map<uint32_t, uint64_t> sQueryCounts;
+    for (uint32_t sPadId : sPadIds)
+        sQueryCounts[sPadId]++;
+    MaterializeSettings sSettings;
+    sSettings.m_MinQueries = 1;
+    setPadQueryCounts(sQueryCounts);
+    setMaterializeSettings(sSettings);
+    publishIndexUpdates();
+
+    size_t sMismatches = 0;
+    {
+        CTitle title("Benchmark: select campaigns for pads, results are materialized");
+        title.SetQueries(sRepeats * sPadIds.size());
+        for (size_t sRepeat = 0; sRepeat < sRepeats; sRepeat++)
+        {
+            for (size_t i = 0; i < sPadIds.size(); i++)
+            {
+                campaignsByPad(sPadIds[i], sCampBitset);
+                sMismatches += !(sCampBitset == sExpected[i]);
+            }
+        }
+    }
+    std::cout << "Mismatched results: " << sMismatches << std::endl;
+    check(0 == sMismatches, "Materialized results differ");
+
+    setMaterializeSettings(MaterializeSettings());
+    setPadQueryCounts(std::unordered_map<uint32_t, uint64_t>());
+    publishIndexUpdates();
+    setCampaignsCacheBudget(sCacheBudget);
+}
+
+// Latency of campaignsByPad() queries while the index is rebuilt on a background
+// thread and new versions are published, compared to latency without rebuilds.
+// Results must not change, as the index is rebuilt from the same data.
+static void benchQueriesDuringRebuild(const BenchOptions& aOptions)
+{
+    if (Pads.empty())
+    {
+        std::cout << "// Queries during rebuild: skipped, the index is loaded from snapshot" << std::endl;
+        return;
+    }
+    size_t sWantPads = 10000;
+    std::vector<uint32_t> sPadIds = benchLeafPads(aOptions, sWantPads, "Queries during rebuild");
+    if (sPadIds.empty())
+        return;
+    const size_t sRebuilds = 2;
+    std::cout << "// Latency of queries for " << sPadIds.size() << " leaf pads during "
+              << sRebuilds << " rebuilds of the index:" << std::endl;
+
+    // Campaigns of every pad, to check results during rebuilds.
+    std::vector<target::dynamic_bitset> sExpected(sPadIds.size());
+    target::dynamic_bitset sCampBitset;
+    for (size_t i = 0; i < sPadIds.size(); i++)
+        campaignsByPad(sPadIds[i], sExpected[i]);
+
+    // Latencies in nanoseconds of queries that are run until aDone() returns true.
+    size_t sMismatches = 0;
+    auto sMeasure = [&](CLatencyHistogram& aLatencies, const std::function<bool()>& aDone)
+    {
+        CTimer sTimer;
+        for (size_t i = 0; !aDone(); i++)
+        {
+            size_t sPad = i % sPadIds.size();
+            sTimer.Start();
+            campaignsByPad(sPadIds[sPad], sCampBitset);
+            aLatencies.Record(sTimer.ElapsedNanoSec());
+            sMismatches += !(sCampBitset == sExpected[sPad]);
+        }
+    };
+
+    CLatencyHistogram sIdle, sRebuilding;
+    const size_t sIdleQueries = 100000;
+    sMeasure(sIdle, [&]() { return sIdle.Count() >= sIdleQueries; });
+
+    std::atomic<bool> sRebuilt(false);
+    // Counters of build phases include the queries of this thread (see readPerfCounters()).
+    std::thread sRebuilder([&]()
+    {
+        CPerfCountersThread sCounters;
+        for (size_t i = 0; i < sRebuilds; i++)
+            buildIndexes();
+        sRebuilt = true;
+    });
+    sMeasure(sRebuilding, [&]() { return sRebuilt.load(); });
+    sRebuilder.join();
+
+    auto sReport = [](const char* aName, const CLatencyHistogram& aLatencies)
+    {
+        std::cout << aName << ": queries " << aLatencies.Count()
+                  << ", latency p50 / p99 / p99.9 / max (ns) " << aLatencies.Percentile(0.5)
+                  << " / " << aLatencies.Percentile(0.99) << " / " << aLatencies.Percentile(0.999)
+                  << " / " << aLatencies.Max() << std::endl;
+    };
+    sReport("Without rebuilds", sIdle);
+    sReport("During rebuilds", sRebuilding);
+    std::cout << "Mismatched results: " << sMismatches << std::endl;
+    check(0 == sMismatches, "Results differ during rebuilds");
+}
+
+// Collecting and grouping of effective pads on a synthetic DAG of millions of pads:
+// levels of pads, every level is sFanOut times wider than the previous one, every pad
+// has a random parent on the previous level and may have a second one, and some
+// pads have targetings or filters. It doesn't touch the index.
+static void benchSyntheticEffectivePads()
+{
+    const size_t sPadCount = 2000000;
+    const size_t sRoots = 1000;
+    const size_t sFanOut = 4;
+    const double sSecondParentShare = 0.25;
+    const double sTargetedShare = 0.2;
+    std::mt19937 sRandom(12345);
+    std::uniform_real_distribution<double> sShare(0., 1.);
+
+    // Pads are not moved after parents and children are linked.
+    std::vector<Pad> sPads;
+    sPads.reserve(sPadCount);
+    size_t sPrevLevelBegin = 0;
+    size_t sLevelBegin = 0;
+    size_t sLevelEnd = sRoots;
+    size_t sDepth = 1;
+    size_t sRelations = 0;
+    for (size_t i = 0; i < sPadCount; i++)
+    {
+        if (i == sLevelEnd)
+        {
+            sPrevLevelBegin = sLevelBegin;
+            sLevelBegin = sLevelEnd;
+            sLevelEnd += (sLevelEnd - sPrevLevelBegin) * sFanOut;
+            sDepth++;
+        }
+        sPads.emplace_back((uint32_t)i);
+        Pad& sPad = sPads.back();
+        sPad.m_HasTargetingsOrFilters = sShare(sRandom) < sTargetedShare;
+        if (0 == sLevelBegin)
+            continue;
+        std::uniform_int_distribution<size_t> sParent(sPrevLevelBegin, sLevelBegin - 1);
+        size_t sParents = sShare(sRandom) < sSecondParentShare ? 2 : 1;
+        for (size_t j = 0; j < sParents; j++)
+        {
+            Pad& sParentPad = sPads[sParent(sRandom)];
+            if (!sPad.m_DirectParents.empty() && sPad.m_DirectParents[0] == &sParentPad)
+                continue;
+            sPad.m_DirectParents.push_back(&sParentPad);
+            sParentPad.m_DirectChildren.push_back(&sPad);
+            sRelations++;
+        }
+    }
+    std::cout << "// Effective pads of a synthetic DAG: pads / relations / depth "
+              << sPadCount << " / " << sRelations << " / " << sDepth << std::endl;
+
+    std::vector<Pad*> sPadPtrs;
+    sPadPtrs.reserve(sPads.size());
+    for (Pad& sPad : sPads)
+        sPadPtrs.push_back(&sPad);
+    {
+        CTitle title("Benchmark: collect effective pads");
+        collectEffectivePads(sPadPtrs);
+    }
+    size_t sEffectivePads = 0;
+    for (const Pad& sPad : sPads)
+        sEffectivePads += sPad.m_EffectivePads.size();
+
+    // Pad of every hash, pads with equal hashes and different effective pads are collisions.
+    size_t sCollisions = 0;
+    std::unordered_map<uint64_t, const Pad*> sGroups;
+    {
+        CTitle title("Benchmark: group effective pads");
+        sGroups.reserve(sPads.size());
+        for (const Pad& sPad : sPads)
+        {
+            auto sInserted = sGroups.emplace(effectivePadsHash(sPad.m_EffectivePads), &sPad);
+            if (!sInserted.second && sInserted.first->second->m_EffectivePads != sPad.m_EffectivePads)
+                sCollisions++;
+        }
+    }
+    std::cout << "Effective pads / groups / hash collisions: " << sEffectivePads << " / "
+              << sGroups.size() << " / " << sCollisions << std::endl;
+}
+
+static void printUsage(const char* aProgram)
+{
+    std::cout << "Usage: " << aProgram << " [options]\n"
+              << "  --pads N           count of sampled leaf pads (default 10000)\n"
+              << "  --seed N           seed of sampling (default 1)\n"
+              << "  --reps N           measured repetitions over the sample (default 5)\n"
+              << "  --warmup N         repetitions before measured ones (default 1)\n"
+              << "  --sampling KIND    uniform (default) or zipf\n"
+              << "  --zipf-exponent X  exponent of Zipf sampling (default 1.0)\n"
+              << "  --json FILE        write latency results in JSON to FILE, - for stdout\n"
+              << "  --banner-owners    keep campaign and user of every banner in the index\n"
+              << "  --cache MB         memory budget of campaignsByPad() result cache (default 0, disabled)\n"
+              << "  --perf-counters    print hardware performance counters of phases and benchmarks\n"
+              << "  --metrics FILE     record metrics of phases and queries, write them to FILE, - for stdout\n"
+              << "  --metrics-format F json (default) or prometheus\n"
+              << "  --snapshot FILE    load the index from FILE if it's made from the current data files,\n"
+              << "                     otherwise build it and save to FILE"
+              << std::endl;
+}
+
+bool parseBenchOptions(int argc, char** argv, BenchOptions& aOptions)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char* sName = argv[i];
+        if (0 == strcmp(sName, "--help") || 0 == strcmp(sName, "-h"))
+        {
+            printUsage(argv[0]);
+            return false;
+        }
+        if (0 == strcmp(sName, "--perf-counters"))
+        {
+            aOptions.m_PerfCounters = true;
+            continue;
+        }
+        if (0 == strcmp(sName, "--banner-owners"))
+        {
+            aOptions.m_BannerOwners = true;
+            continue;
+        }
+        if (i + 1 == argc)
+        {
+            std::cout << "Option " << sName << " requires a value" << std::endl;
+            printUsage(argv[0]);
+            return false;
+        }
+        const char* sValue = argv[++i];
+        char* sEnd = nullptr;
+        bool sValid = true;
+        if (0 == strcmp(sName, "--pads") || 0 == strcmp(sName, "--seed") ||
+            0 == strcmp(sName, "--reps") || 0 == strcmp(sName, "--warmup") ||
+            0 == strcmp(sName, "--cache"))
+        {
+            unsigned long long sNumber = strtoull(sValue, &sEnd, 10);
+            sValid = sEnd != sValue && '\0' == *sEnd && '-' != *sValue;
+            if (0 == strcmp(sName, "--pads"))
+                aOptions.m_Pads = (size_t)sNumber;
+            else if (0 == strcmp(sName, "--seed"))
+                aOptions.m_Seed = (uint32_t)sNumber;
+            else if (0 == strcmp(sName, "--reps"))
+                aOptions.m_Repetitions = (size_t)sNumber;
+            else if (0 == strcmp(sName, "--cache"))
+                aOptions.m_CampaignsCacheMB = (size_t)sNumber;
+            else
+                aOptions.m_Warmup = (size_t)sNumber;
+        }
+        else if (0 == strcmp(sName, "--sampling"))
+        {
+            sValid = 0 == strcmp(sValue, "uniform") || 0 == strcmp(sValue, "zipf");
+            aOptions.m_Zipf = 0 == strcmp(sValue, "zipf");
+        }
+        else if (0 == strcmp(sName, "--zipf-exponent"))
+        {
+            aOptions.m_ZipfExponent = strtod(sValue, &sEnd);
+            sValid = sEnd != sValue && '\0' == *sEnd && aOptions.m_ZipfExponent >= 0;
+        }
+        else if (0 == strcmp(sName, "--json"))
+            aOptions.m_JsonFile = sValue;
+        else if (0 == strcmp(sName, "--metrics"))
+            aOptions.m_MetricsFile = sValue;
+        else if (0 == strcmp(sName, "--snapshot"))
+            aOptions.m_SnapshotFile = sValue;
+        else if (0 == strcmp(sName, "--metrics-format"))
+        {
+            sValid = 0 == strcmp(sValue, "json") || 0 == strcmp(sValue, "prometheus");
+            aOptions.m_MetricsPrometheus = 0 == strcmp(sValue, "prometheus");
+        }
+        else
+        {
+            std::cout << "Unknown option " << sName << std::endl;
+            printUsage(argv[0]);
+            return false;
+        }
+        if (!sValid)
+        {
+            std::cout << "Wrong value of " << sName << ": " << sValue << std::endl;
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Latency histogram of a query type.
+struct QueryLatency
+{
+    const char* m_Name;
+    CLatencyHistogram m_Histogram;
+    size_t m_Checksum = 0;
+};
+
+static void writeLatencyJson(std::ostream& aOut, const BenchOptions& aOptions, size_t aDistinctPads,
+                             uint64_t aTimerOverhead, const std::vector<QueryLatency>& aLatencies)
+{
+    aOut << "{\n"
+         << "  \"options\": {\"pads\": " << aOptions.m_Pads << ", \"seed\": " << aOptions.m_Seed
+         << ", \"repetitions\": " << aOptions.m_Repetitions << ", \"warmup\": " << aOptions.m_Warmup
+         << ", \"sampling\": \"" << (aOptions.m_Zipf ? "zipf" : "uniform") << "\""
+         << ", \"zipf_exponent\": " << aOptions.m_ZipfExponent << "},\n"
+         << "  \"index\": {\"campaigns\": " << IndexedCampaigns.size() << ", \"banners\": " << IndexedBanners.size()
+         << ", \"distinct_sampled_pads\": " << aDistinctPads << "},\n"
+         << "  \"timer_overhead_ns\": " << aTimerOverhead << ",\n"
+         << "  \"queries\": {";
+    for (size_t i = 0; i < aLatencies.size(); i++)
+    {
+        const CLatencyHistogram& sHistogram = aLatencies[i].m_Histogram;
+        aOut << (0 == i ? "\n" : ",\n")
+             << "    \"" << aLatencies[i].m_Name << "\": {\"count\": " << sHistogram.Count()
+             << ", \"mean_ns\": " << uint64_t(sHistogram.Mean())
+             << ", \"min_ns\": " << sHistogram.Min()
+             << ", \"p50_ns\": " << sHistogram.Percentile(0.5)
+             << ", \"p90_ns\": " << sHistogram.Percentile(0.9)
+             << ", \"p99_ns\": " << sHistogram.Percentile(0.99)
+             << ", \"p999_ns\": " << sHistogram.Percentile(0.999)
+             << ", \"max_ns\": " << sHistogram.Max()
+             << ", \"checksum\": " << aLatencies[i].m_Checksum << "}";
+    }
+    aOut << "\n  }\n}" << std::endl;
+}
+
+// Median time of starting and reading the timer with nothing between, the part
+// of every measured latency that is not of the query.
+static uint64_t timerOverhead()
+{
+    CLatencyHistogram sHistogram;
+    CTimer sTimer;
+    for (size_t i = 0; i < 100000; i++)
+    {
+        sTimer.Start();
+        sHistogram.Record(sTimer.ElapsedNanoSec());
+    }
+    return sHistogram.Percentile(0.5);
+}
+
+// Latency of aQuery for every pad: warmup repetitions, then measured ones. A template
+// rather than std::function, so the query is inlined into the measured loop.
+template <class QUERY>
+static void measureQueryLatency(const BenchOptions& aOptions, const std::vector<uint32_t>& aPadIds,
+                                QueryLatency& aLatency, QUERY aQuery)
+{
+    for (size_t sRepeat = 0; sRepeat < aOptions.m_Warmup; sRepeat++)
+        for (uint32_t sPadId : aPadIds)
+            aLatency.m_Checksum += aQuery(sPadId);
+    aLatency.m_Checksum = 0;
+    PerfSample sCounters;
+    if (perfCountersEnabled())
+        sCounters = readPerfCounters();
+    CTimer sTimer;
+    for (size_t sRepeat = 0; sRepeat < aOptions.m_Repetitions; sRepeat++)
+    {
+        for (uint32_t sPadId : aPadIds)
+        {
+            sTimer.Start();
+            aLatency.m_Checksum += aQuery(sPadId);
+            aLatency.m_Histogram.Record(sTimer.ElapsedNanoSec());
+        }
+    }
+    const CLatencyHistogram& sHistogram = aLatency.m_Histogram;
+    std::cout << "  " << std::left << std::setw(21) << aLatency.m_Name << std::right
+              << " queries " << sHistogram.Count() << ", latency mean / p50 / p99 / p99.9 / max (ns) "
+              << uint64_t(sHistogram.Mean()) << " / " << sHistogram.Percentile(0.5)
+              << " / " << sHistogram.Percentile(0.99) << " / " << sHistogram.Percentile(0.999)
+              << " / " << sHistogram.Max() << " (checksum " << aLatency.m_Checksum << ")" << std::endl;
+    // Counters include reading of the clock around every query.
+    if (perfCountersEnabled())
+        printPerfCounters(sCounters, readPerfCounters(), sHistogram.Count());
+}
+
+// Latency of every query of campaignsByPad(), bannersByPad() and filteredBannersByPad()
+// over sampled leaf pads: warmup repetitions, then measured ones.
+static void benchQueryLatency(const BenchOptions& aOptions)
+{
+    std::vector<uint32_t> sPadIds = sampleLeafPads(aOptions, aOptions.m_Pads);
+    if (sPadIds.empty())
+    {
+        std::cout << "// Query latency: skipped, there are no leaf pads" << std::endl;
+        return;
+    }
+    std::vector<uint32_t> sDistinct(sPadIds);
+    std::sort(sDistinct.begin(), sDistinct.end());
+    sDistinct.erase(std::unique(sDistinct.begin(), sDistinct.end()), sDistinct.end());
+    std::cout << "// Query latency for " << sPadIds.size() << " leaf pads (" << sDistinct.size()
+              << " distinct, " << (aOptions.m_Zipf ? "zipf" : "uniform") << " sampling, seed "
+              << aOptions.m_Seed << "), " << aOptions.m_Warmup << " warmup and "
+              << aOptions.m_Repetitions << " measured repetitions:" << std::endl;
+
+    // Latencies include the overhead of the timer, it is printed to compare with.
+    uint64_t sTimerOverhead = timerOverhead();
+    std::cout << "  timer overhead (ns) " << sTimerOverhead << ", included in latencies" << std::endl;
+
+    target::dynamic_bitset sBitset;
+    std::vector<QueryLatency> sLatencies(3);
+    sLatencies[0].m_Name = "campaignsByPad";
+    sLatencies[1].m_Name = "bannersByPad";
+    sLatencies[2].m_Name = "filteredBannersByPad";
+    measureQueryLatency(aOptions, sPadIds, sLatencies[0],
+                        [&](uint32_t aPadId) { campaignsByPad(aPadId, sBitset); return sBitset.count(); });
+    measureQueryLatency(aOptions, sPadIds, sLatencies[1],
+                        [&](uint32_t aPadId) { bannersByPad(aPadId, sBitset); return sBitset.count(); });
+    measureQueryLatency(aOptions, sPadIds, sLatencies[2], [&](uint32_t aPadId) {
+        CEpochReadScope sScope;
+        return filteredBannersByPad(sScope, aPadId).size();
+    });
+
+    if (aOptions.m_JsonFile.empty())
+        return;
+    if ("-" == aOptions.m_JsonFile)
+    {
+        writeLatencyJson(std::cout, aOptions, sDistinct.size(), sTimerOverhead, sLatencies);
+        return;
+    }
+    std::ofstream sFile(aOptions.m_JsonFile, std::ios::trunc);
+    check(sFile.is_open(), "Can't create JSON file!");
+    writeLatencyJson(sFile, aOptions, sDistinct.size(), sTimerOverhead, sLatencies);
+    check(sFile.good(), "Failed to write JSON file!");
+    std::cout << "Latency results are written to " << aOptions.m_JsonFile << std::endl;
 }
 
-void runBench()
+void runBench(const BenchOptions& aOptions)
 {
-    selectCampaigns();
-    selectCampaignsAndBanners();
+    benchBitsetKernels();
+    selectCampaigns(aOptions);
+    selectCampaignsAndBanners(aOptions);
+    selectBanners(aOptions);
+    selectCampaignsInBatches(aOptions);
+    benchQueryLatency(aOptions);
+    benchMaterializedGroups(aOptions);
+    benchThreadScaling(aOptions);
+    benchQueriesDuringRebuild(aOptions);
+    benchSyntheticEffectivePads();
 }
\ No newline at end of file
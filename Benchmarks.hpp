@@ -1,3 +1,40 @@
 #pragma once
 
-void runBench();
\ No newline at end of file
+#include <string>
+
+#include "Win.hpp"
+
+// Options of the latency benchmark of queries, see usage in parseBenchOptions().
+struct BenchOptions
+{
+    // Count of sampled leaf pads; they are queried in every repetition.
+    size_t m_Pads = 10000;
+    uint32_t m_Seed = 1;
+    size_t m_Repetitions = 5;
+    // Repetitions before measured ones, to warm up caches.
+    size_t m_Warmup = 1;
+    // Pads are sampled uniformly, or Zipf-weighted: the pad of rank r (in random
+    // order) is sampled with weight 1 / r^m_ZipfExponent.
+    bool m_Zipf = false;
+    double m_ZipfExponent = 1.0;
+    // File for results in JSON, "-" for stdout, empty for none.
+    std::string m_JsonFile;
+    // Fill campaign and user columns of banners (see setBannerOwnerColumns()).
+    bool m_BannerOwners = false;
+    // Memory budget of campaignsByPad() result cache in megabytes, 0 disables it.
+    size_t m_CampaignsCacheMB = 0;
+    // Print hardware performance counters of build phases and benchmarks (Linux only).
+    bool m_PerfCounters = false;
+    // File for metrics of phases and queries, "-" for stdout, empty to not record them.
+    std::string m_MetricsFile;
+    // Metrics are written in Prometheus text format rather than JSON.
+    bool m_MetricsPrometheus = false;
+    // Snapshot of the index to load instead of building, or to save after the build
+    // if it's absent or stale (see Snapshot.hpp); empty to always build.
+    std::string m_SnapshotFile;
+};
+
+// Parse command line options into aOptions. Prints usage and returns false on errors.
+bool parseBenchOptions(int argc, char** argv, BenchOptions& aOptions);
+
+void runBench(const BenchOptions& aOptions);
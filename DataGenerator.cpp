@@ -0,0 +1,549 @@
+// Generator of synthetic data files in formats read by loadDb() and
+// loadPrecalculatedFilters(), for benchmarks at scales beyond the real data.
+//
+// Pads form a DAG of levels, every level is fan-out times wider than the previous
+// one, every pad has a random parent on the previous level and may have a second
+// one. Users may have a parent user. Campaigns of a user follow each other, as the
+// index requires. A campaign has either own positive targetings or a package with
+// positive targetings, users have negative targetings only. Targetings and filters
+// are put on a share of pads of every level, so upper pads are targeted as often
+// as leaves. Filters pass a campaign with the given probability, a few campaigns
+// are passed partially, banner by banner; campaign bitsets of filters are derived
+// from the banner ones.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "Utils.hpp"
+
+struct GeneratorOptions
+{
+    // Directory of the files, it must exist.
+    std::string m_Out = "Data";
+    uint32_t m_Seed = 1;
+    // Multiplies m_Pads, m_Users and m_Filters.
+    double m_Scale = 1.;
+    size_t m_Pads = 40000;
+    size_t m_Depth = 5;
+    size_t m_FanOut = 4;
+    size_t m_Users = 300;
+    double m_CampaignsPerUser = 10.;
+    double m_BannersPerCampaign = 3.;
+    // Share of pads of every level that have targetings or filters.
+    double m_TargetingDensity = 0.2;
+    // Mean count of targetings of a campaign or a package, positive and negative.
+    double m_TargetingsPerCampaign = 2.5;
+    size_t m_Filters = 600;
+    // Count of distinct banner bitsets of filters, filters share them.
+    size_t m_FilterBitsets = 400;
+    // Probability that a filter passes a campaign or a banner.
+    double m_FilterSelectivity = 0.8;
+};
+
+// Share of pads that have a second parent.
+static const double SecondParentShare = 0.25;
+// Share of users that have a parent user.
+static const double ChildUserShare = 0.3;
+// Share of campaigns that get positive targetings from their package.
+static const double PackageTargetedShare = 0.2;
+// Campaigns per package.
+static const size_t CampaignsPerPackage = 5;
+// Share of negative targetings among targetings of campaigns and packages.
+static const double NegativeShare = 0.35;
+// Mean count of negative targetings of a user.
+static const double TargetingsPerUser = 0.3;
+// Share of campaigns that filters pass banner by banner rather than all or none.
+static const double PartiallyFilteredShare = 0.02;
+// Share of campaigns of index.txt and of filters that are missing in other files,
+// like after lags of dumping the real data.
+static const double StaleShare = 0.01;
+
+static void printUsage(const char* aProgram)
+{
+    std::cout << "Usage: " << aProgram << " [options]\n"
+              << "  --out DIR                   directory of generated files, must exist (default Data)\n"
+              << "  --seed N                    seed of generation (default 1)\n"
+              << "  --scale X                   multiplier of pads, users and filters (default 1)\n"
+              << "  --pads N                    count of pads (default 40000); PadIndex benchmarks\n"
+              << "                              query up to 10000 leaf pads, fewer on smaller data\n"
+              << "  --depth N                   levels of the pad DAG (default 5)\n"
+              << "  --fan-out N                 children per pad of the previous level (default 4)\n"
+              << "  --users N                   count of users (default 300)\n"
+              << "  --campaigns-per-user X      mean count of campaigns of a user (default 10)\n"
+              << "  --banners-per-campaign X    mean count of banners of a campaign (default 3)\n"
+              << "  --targeting-density X       share of pads with targetings or filters (default 0.2)\n"
+              << "  --targetings-per-campaign X mean count of targetings of a campaign (default 2.5)\n"
+              << "  --filters N                 count of pads with filters (default 600)\n"
+              << "  --filter-bitsets N          distinct banner bitsets of filters (default 400)\n"
+              << "  --filter-selectivity X      probability that a filter passes a campaign (default 0.8)"
+              << std::endl;
+}
+
+static bool parseGeneratorOptions(int argc, char** argv, GeneratorOptions& aOptions)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char* sName = argv[i];
+        if (0 == strcmp(sName, "--help") || 0 == strcmp(sName, "-h"))
+        {
+            printUsage(argv[0]);
+            return false;
+        }
+        if (i + 1 == argc)
+        {
+            std::cout << "Option " << sName << " requires a value" << std::endl;
+            printUsage(argv[0]);
+            return false;
+        }
+        const char* sValue = argv[++i];
+        char* sEnd = nullptr;
+        bool sValid = true;
+        size_t* sCount = nullptr;
+        double* sShare = nullptr;
+        double sMax = 1e9;
+        if (0 == strcmp(sName, "--out"))
+            aOptions.m_Out = sValue;
+        else if (0 == strcmp(sName, "--seed"))
+        {
+            unsigned long long sNumber = strtoull(sValue, &sEnd, 10);
+            sValid = sEnd != sValue && '\0' == *sEnd && '-' != *sValue;
+            aOptions.m_Seed = (uint32_t)sNumber;
+        }
+        else if (0 == strcmp(sName, "--pads"))
+            sCount = &aOptions.m_Pads;
+        else if (0 == strcmp(sName, "--depth"))
+            sCount = &aOptions.m_Depth;
+        else if (0 == strcmp(sName, "--fan-out"))
+            sCount = &aOptions.m_FanOut;
+        else if (0 == strcmp(sName, "--users"))
+            sCount = &aOptions.m_Users;
+        else if (0 == strcmp(sName, "--filters"))
+            sCount = &aOptions.m_Filters;
+        else if (0 == strcmp(sName, "--filter-bitsets"))
+            sCount = &aOptions.m_FilterBitsets;
+        else if (0 == strcmp(sName, "--scale"))
+            sShare = &aOptions.m_Scale;
+        else if (0 == strcmp(sName, "--campaigns-per-user"))
+            sShare = &aOptions.m_CampaignsPerUser;
+        else if (0 == strcmp(sName, "--banners-per-campaign"))
+            sShare = &aOptions.m_BannersPerCampaign;
+        else if (0 == strcmp(sName, "--targetings-per-campaign"))
+            sShare = &aOptions.m_TargetingsPerCampaign;
+        else if (0 == strcmp(sName, "--targeting-density"))
+        {
+            sShare = &aOptions.m_TargetingDensity;
+            sMax = 1.;
+        }
+        else if (0 == strcmp(sName, "--filter-selectivity"))
+        {
+            sShare = &aOptions.m_FilterSelectivity;
+            sMax = 1.;
+        }
+        else
+        {
+            std::cout << "Unknown option " << sName << std::endl;
+            printUsage(argv[0]);
+            return false;
+        }
+        if (sCount != nullptr)
+        {
+            unsigned long long sNumber = strtoull(sValue, &sEnd, 10);
+            sValid = sEnd != sValue && '\0' == *sEnd && '-' != *sValue && sNumber != 0;
+            *sCount = (size_t)sNumber;
+        }
+        else if (sShare != nullptr)
+        {
+            *sShare = strtod(sValue, &sEnd);
+            sValid = sEnd != sValue && '\0' == *sEnd && *sShare > 0 && *sShare <= sMax;
+        }
+        if (!sValid)
+        {
+            std::cout << "Wrong value of " << sName << ": " << sValue << std::endl;
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+    aOptions.m_Pads = std::max<size_t>(1, size_t(double(aOptions.m_Pads) * aOptions.m_Scale));
+    aOptions.m_Users = std::max<size_t>(1, size_t(double(aOptions.m_Users) * aOptions.m_Scale));
+    aOptions.m_Filters = size_t(double(aOptions.m_Filters) * aOptions.m_Scale);
+    return true;
+}
+
+// Generated data, ids of pads, users and so on as written to the files.
+struct GeneratedData
+{
+    std::vector<uint32_t> m_PadIds;
+    // Pairs of pad_id, parent_pad_id.
+    std::vector<std::pair<uint32_t, uint32_t>> m_Relations;
+    // Pads of every level that get targetings and filters.
+    std::vector<std::vector<uint32_t>> m_TargetedPads;
+
+    // Pairs of id, parent_user_id.
+    std::vector<std::pair<uint32_t, uint32_t>> m_Users;
+
+    struct Campaign
+    {
+        uint32_t m_Id;
+        uint32_t m_UserId;
+        uint32_t m_PackageId;
+        // Present in index.txt only.
+        bool m_Stale;
+        uint32_t m_FirstBannerId;
+        uint32_t m_BannerCount;
+    };
+    // In order of users.
+    std::vector<Campaign> m_Campaigns;
+    uint32_t m_BannerCount = 0;
+
+    struct Targeting
+    {
+        uint32_t m_OwnerId;
+        uint32_t m_PadId;
+        bool m_Positive;
+    };
+    std::vector<Targeting> m_UserTargetings;
+    std::vector<Targeting> m_PackageTargetings;
+    std::vector<Targeting> m_CampaignTargetings;
+
+    // Banner bitsets of filters, bit i is banner i of index.txt.
+    std::vector<std::vector<bool>> m_FilterBanners;
+    // Pairs of pad_id, number of banner bitset.
+    std::vector<std::pair<uint32_t, uint32_t>> m_Filters;
+};
+
+static void generatePads(const GeneratorOptions& aOptions, std::mt19937& aRandom, GeneratedData& aData)
+{
+    // Level sizes are roots * fan-out^level, the last level takes the rest.
+    std::vector<size_t> sLevelSizes;
+    double sWidth = 1., sTotalWidth = 0.;
+    for (size_t i = 0; i < aOptions.m_Depth; i++, sWidth *= double(aOptions.m_FanOut))
+        sTotalWidth += sWidth;
+    size_t sRoots = std::max<size_t>(1, size_t(double(aOptions.m_Pads) / sTotalWidth));
+    size_t sPlaced = 0;
+    for (size_t i = 0; i < aOptions.m_Depth && sPlaced < aOptions.m_Pads; i++)
+    {
+        size_t sSize = i + 1 == aOptions.m_Depth ? aOptions.m_Pads - sPlaced :
+                       std::min(aOptions.m_Pads - sPlaced, size_t(double(sRoots) * std::pow(double(aOptions.m_FanOut), double(i))));
+        sLevelSizes.push_back(sSize);
+        sPlaced += sSize;
+    }
+
+    // Ids are random and sparse, like in the real data.
+    std::vector<uint32_t> sIds(aOptions.m_Pads * 2);
+    for (size_t i = 0; i < sIds.size(); i++)
+        sIds[i] = uint32_t(i + 1);
+    std::shuffle(sIds.begin(), sIds.end(), aRandom);
+    sIds.resize(aOptions.m_Pads);
+    aData.m_PadIds = sIds;
+
+    std::uniform_real_distribution<double> sShare(0., 1.);
+    size_t sLevelBegin = 0;
+    for (size_t sLevel = 0; sLevel < sLevelSizes.size(); sLevel++)
+    {
+        size_t sLevelEnd = sLevelBegin + sLevelSizes[sLevel];
+        if (sLevel != 0)
+        {
+            std::uniform_int_distribution<size_t> sParent(sLevelBegin - sLevelSizes[sLevel - 1], sLevelBegin - 1);
+            for (size_t i = sLevelBegin; i < sLevelEnd; i++)
+            {
+                size_t sFirst = sParent(aRandom);
+                aData.m_Relations.emplace_back(sIds[i], sIds[sFirst]);
+                if (sShare(aRandom) < SecondParentShare)
+                {
+                    size_t sSecond = sParent(aRandom);
+                    if (sSecond != sFirst)
+                        aData.m_Relations.emplace_back(sIds[i], sIds[sSecond]);
+                }
+            }
+        }
+        std::vector<uint32_t> sTargeted(sIds.begin() + sLevelBegin, sIds.begin() + sLevelEnd);
+        std::shuffle(sTargeted.begin(), sTargeted.end(), aRandom);
+        sTargeted.resize(std::max<size_t>(1, size_t(double(sTargeted.size()) * aOptions.m_TargetingDensity)));
+        aData.m_TargetedPads.push_back(sTargeted);
+        sLevelBegin = sLevelEnd;
+    }
+}
+
+// Pad for a targeting or a filter: a random level, then a random targeted pad of it.
+static uint32_t randomTargetedPad(std::mt19937& aRandom, const GeneratedData& aData)
+{
+    std::uniform_int_distribution<size_t> sLevel(0, aData.m_TargetedPads.size() - 1);
+    const std::vector<uint32_t>& sPads = aData.m_TargetedPads[sLevel(aRandom)];
+    std::uniform_int_distribution<size_t> sPad(0, sPads.size() - 1);
+    return sPads[sPad(aRandom)];
+}
+
+// Targetings of an owner on distinct pads.
+static void addTargetings(std::mt19937& aRandom, const GeneratedData& aData, uint32_t aOwnerId,
+                          size_t aPositive, size_t aNegative, std::vector<GeneratedData::Targeting>& aTargetings)
+{
+    size_t sFirst = aTargetings.size();
+    for (size_t i = 0; i < aPositive + aNegative; i++)
+    {
+        uint32_t sPadId = randomTargetedPad(aRandom, aData);
+        bool sRepeated = false;
+        for (size_t j = sFirst; j < aTargetings.size(); j++)
+            sRepeated |= aTargetings[j].m_PadId == sPadId;
+        if (!sRepeated)
+            aTargetings.push_back(GeneratedData::Targeting{aOwnerId, sPadId, i < aPositive});
+    }
+}
+
+static void generateCampaigns(const GeneratorOptions& aOptions, std::mt19937& aRandom, GeneratedData& aData)
+{
+    std::uniform_real_distribution<double> sShare(0., 1.);
+    for (size_t i = 0; i < aOptions.m_Users; i++)
+    {
+        uint32_t sId = uint32_t(i + 1);
+        uint32_t sParentId = 0;
+        if (i != 0 && sShare(aRandom) < ChildUserShare)
+            sParentId = std::uniform_int_distribution<uint32_t>(1, sId - 1)(aRandom);
+        aData.m_Users.emplace_back(sId, sParentId);
+    }
+
+    // Campaign ids grow with gaps, banner ids are consecutive.
+    std::poisson_distribution<size_t> sCampaignCount(aOptions.m_CampaignsPerUser);
+    // Every campaign has a banner, extra ones follow Poisson distribution.
+    double sExtraBanners = aOptions.m_BannersPerCampaign - 1.;
+    std::poisson_distribution<size_t> sBannerCount(sExtraBanners > 0 ? sExtraBanners : 1.);
+    std::uniform_int_distribution<uint32_t> sIdGap(1, 4);
+    uint32_t sCampaignId = 1000;
+    for (const auto& sUser : aData.m_Users)
+    {
+        size_t sCount = sCampaignCount(aRandom);
+        for (size_t i = 0; i < sCount; i++)
+        {
+            GeneratedData::Campaign sCamp;
+            sCampaignId += sIdGap(aRandom);
+            sCamp.m_Id = sCampaignId;
+            sCamp.m_UserId = sUser.first;
+            sCamp.m_PackageId = 0;
+            sCamp.m_Stale = sShare(aRandom) < StaleShare;
+            sCamp.m_FirstBannerId = aData.m_BannerCount + 1;
+            sCamp.m_BannerCount = uint32_t(1 + (sExtraBanners > 0 ? sBannerCount(aRandom) : 0));
+            aData.m_BannerCount += sCamp.m_BannerCount;
+            aData.m_Campaigns.push_back(sCamp);
+        }
+    }
+    check(!aData.m_Campaigns.empty(), "No campaigns are generated");
+
+    // Packages 1..sTargetedPackages have positive targetings, their campaigns have
+    // none; other packages have negative targetings only.
+    size_t sPackages = std::max<size_t>(2, aData.m_Campaigns.size() / CampaignsPerPackage);
+    size_t sTargetedPackages = std::max<size_t>(1, size_t(double(sPackages) * PackageTargetedShare));
+    std::uniform_int_distribution<uint32_t> sTargetedPackage(1, uint32_t(sTargetedPackages));
+    std::uniform_int_distribution<uint32_t> sPlainPackage(uint32_t(sTargetedPackages + 1), uint32_t(sPackages));
+    std::poisson_distribution<size_t> sPositiveCount(aOptions.m_TargetingsPerCampaign * (1. - NegativeShare));
+    std::poisson_distribution<size_t> sNegativeCount(aOptions.m_TargetingsPerCampaign * NegativeShare);
+    // Stale campaigns have no targetings, as they are missing in campaign.txt.
+    std::vector<GeneratedData::Targeting> sStaleTargetings;
+    for (GeneratedData::Campaign& sCamp : aData.m_Campaigns)
+    {
+        std::vector<GeneratedData::Targeting>& sTargetings = sCamp.m_Stale ? sStaleTargetings : aData.m_CampaignTargetings;
+        if (sShare(aRandom) < PackageTargetedShare)
+        {
+            sCamp.m_PackageId = sTargetedPackage(aRandom);
+            addTargetings(aRandom, aData, sCamp.m_Id, 0, sNegativeCount(aRandom), sTargetings);
+        }
+        else
+        {
+            sCamp.m_PackageId = sPlainPackage(aRandom);
+            addTargetings(aRandom, aData, sCamp.m_Id, std::max<size_t>(1, sPositiveCount(aRandom)),
+                          sNegativeCount(aRandom), sTargetings);
+        }
+    }
+    for (size_t i = 1; i <= sPackages; i++)
+    {
+        size_t sPositive = i <= sTargetedPackages ? std::max<size_t>(1, sPositiveCount(aRandom)) : 0;
+        addTargetings(aRandom, aData, uint32_t(i), sPositive, sNegativeCount(aRandom), aData.m_PackageTargetings);
+    }
+    std::poisson_distribution<size_t> sUserTargetingCount(TargetingsPerUser);
+    for (const auto& sUser : aData.m_Users)
+        addTargetings(aRandom, aData, sUser.first, 0, sUserTargetingCount(aRandom), aData.m_UserTargetings);
+}
+
+static void generateFilters(const GeneratorOptions& aOptions, std::mt19937& aRandom, GeneratedData& aData)
+{
+    std::bernoulli_distribution sPasses(aOptions.m_FilterSelectivity);
+    std::uniform_real_distribution<double> sShare(0., 1.);
+    aData.m_FilterBanners.resize(aOptions.m_FilterBitsets);
+    for (std::vector<bool>& sBanners : aData.m_FilterBanners)
+    {
+        sBanners.resize(aData.m_BannerCount);
+        for (const GeneratedData::Campaign& sCamp : aData.m_Campaigns)
+        {
+            bool sPartially = sShare(aRandom) < PartiallyFilteredShare;
+            bool sPassed = sPasses(aRandom);
+            for (uint32_t i = 0; i < sCamp.m_BannerCount; i++)
+                sBanners[sCamp.m_FirstBannerId - 1 + i] = sPartially ? sPasses(aRandom) : sPassed;
+        }
+    }
+
+    // Stale filters are of pads that are missing in pad.txt.
+    std::uniform_int_distribution<uint32_t> sBitset(0, uint32_t(aOptions.m_FilterBitsets - 1));
+    std::unordered_set<uint32_t> sFilteredPads;
+    size_t sTargetedCount = 0;
+    for (const std::vector<uint32_t>& sPads : aData.m_TargetedPads)
+        sTargetedCount += sPads.size();
+    uint32_t sMissingPadId = uint32_t(aData.m_PadIds.size() * 2);
+    for (size_t i = 0; i < aOptions.m_Filters && sFilteredPads.size() < sTargetedCount; i++)
+    {
+        uint32_t sPadId = 0;
+        if (sShare(aRandom) < StaleShare)
+            sPadId = ++sMissingPadId;
+        else
+        {
+            do
+                sPadId = randomTargetedPad(aRandom, aData);
+            while (!sFilteredPads.insert(sPadId).second);
+        }
+        aData.m_Filters.emplace_back(sPadId, sBitset(aRandom));
+    }
+}
+
+static void openOutput(const GeneratorOptions& aOptions, const char* aName, std::ofstream& aFile)
+{
+    std::string sFilename = aOptions.m_Out + "/" + aName;
+    aFile.open(sFilename, std::ofstream::out | std::ofstream::trunc);
+    check(aFile.is_open(), "Can't create output file");
+}
+
+static void writeTargetings(const GeneratorOptions& aOptions, const char* aName, const char* aOwnerField,
+                            const std::vector<GeneratedData::Targeting>& aTargetings)
+{
+    std::ofstream sFile;
+    openOutput(aOptions, aName, sFile);
+    sFile << aOwnerField << " pad_id type\n";
+    for (const GeneratedData::Targeting& sTargeting : aTargetings)
+        sFile << sTargeting.m_OwnerId << ' ' << sTargeting.m_PadId << ' '
+              << (sTargeting.m_Positive ? "positive" : "negative") << '\n';
+}
+
+// Bitset as read by loadBitsetFromString(): a hex digit per 4 bits, lowest bit first.
+static void writeBitset(std::ofstream& aFile, const std::vector<bool>& aBits)
+{
+    static const char HexDigits[] = "0123456789abcdef";
+    std::string sDigits;
+    sDigits.reserve((aBits.size() + 3) / 4);
+    for (size_t i = 0; i < aBits.size(); i += 4)
+    {
+        unsigned sValue = 0;
+        for (size_t j = i; j < std::min(i + 4, aBits.size()); j++)
+            sValue |= unsigned(aBits[j]) << (j - i);
+        sDigits.push_back(HexDigits[sValue]);
+    }
+    aFile << sDigits;
+}
+
+static void writeData(const GeneratorOptions& aOptions, const GeneratedData& aData)
+{
+    CTitle title("Writing data files to " + aOptions.m_Out);
+    {
+        std::ofstream sFile;
+        openOutput(aOptions, "pad.txt", sFile);
+        sFile << "pad_id\n";
+        for (uint32_t sId : aData.m_PadIds)
+            sFile << sId << '\n';
+    }
+    {
+        std::ofstream sFile;
+        openOutput(aOptions, "pad_relation.txt", sFile);
+        sFile << "pad_id parent_pad_id\n";
+        for (const auto& sRelation : aData.m_Relations)
+            sFile << sRelation.first << ' ' << sRelation.second << '\n';
+    }
+    {
+        std::ofstream sFile;
+        openOutput(aOptions, "user.txt", sFile);
+        sFile << "id parent_user_id\n";
+        for (const auto& sUser : aData.m_Users)
+            sFile << sUser.first << ' ' << sUser.second << '\n';
+    }
+    {
+        std::ofstream sFile;
+        openOutput(aOptions, "campaign.txt", sFile);
+        sFile << "id user_id package_id\n";
+        for (const GeneratedData::Campaign& sCamp : aData.m_Campaigns)
+            if (!sCamp.m_Stale)
+                sFile << sCamp.m_Id << ' ' << sCamp.m_UserId << ' ' << sCamp.m_PackageId << '\n';
+    }
+    writeTargetings(aOptions, "targeting_user.txt", "user_id", aData.m_UserTargetings);
+    writeTargetings(aOptions, "targeting_package.txt", "package_id", aData.m_PackageTargetings);
+    writeTargetings(aOptions, "targeting_campaign.txt", "campaign_id", aData.m_CampaignTargetings);
+
+    // Campaign bitsets 2 * k and 2 * k + 1 are the full and any ones of banner bitset k.
+    std::ofstream sFile;
+    openOutput(aOptions, "index.txt", sFile);
+    sFile << "Campaigns (id)\n" << aData.m_Campaigns.size() << '\n';
+    for (const GeneratedData::Campaign& sCamp : aData.m_Campaigns)
+        sFile << sCamp.m_Id << ' ';
+    sFile << "\nBanners (id, campaign_id)\n" << aData.m_BannerCount << '\n';
+    for (const GeneratedData::Campaign& sCamp : aData.m_Campaigns)
+        for (uint32_t i = 0; i < sCamp.m_BannerCount; i++)
+            sFile << sCamp.m_FirstBannerId + i << ' ' << sCamp.m_Id << ' ';
+    sFile << "\nCampaign bitsets: " << aData.m_FilterBanners.size() * 2 << '\n';
+    std::vector<bool> sFull(aData.m_Campaigns.size()), sAny(aData.m_Campaigns.size());
+    for (size_t k = 0; k < aData.m_FilterBanners.size(); k++)
+    {
+        const std::vector<bool>& sBanners = aData.m_FilterBanners[k];
+        for (size_t i = 0; i < aData.m_Campaigns.size(); i++)
+        {
+            const GeneratedData::Campaign& sCamp = aData.m_Campaigns[i];
+            size_t sPassed = 0;
+            for (uint32_t j = 0; j < sCamp.m_BannerCount; j++)
+                sPassed += sBanners[sCamp.m_FirstBannerId - 1 + j];
+            sFull[i] = sPassed == sCamp.m_BannerCount;
+            sAny[i] = sPassed != 0;
+        }
+        sFile << 2 * k << ' ';
+        writeBitset(sFile, sFull);
+        sFile << '\n' << 2 * k + 1 << ' ';
+        writeBitset(sFile, sAny);
+        sFile << '\n';
+    }
+    sFile << "Banner bitsets: " << aData.m_FilterBanners.size() << '\n';
+    for (size_t k = 0; k < aData.m_FilterBanners.size(); k++)
+    {
+        sFile << k << ' ';
+        writeBitset(sFile, aData.m_FilterBanners[k]);
+        sFile << '\n';
+    }
+    sFile << "pad_id/full/any/banner: " << aData.m_Filters.size() << '\n';
+    for (const auto& sFilter : aData.m_Filters)
+        sFile << sFilter.first << ' ' << 2 * sFilter.second << ' ' << 2 * sFilter.second + 1 << ' '
+              << sFilter.second << '\n';
+    sFile << "Done\n";
+    check(sFile.good(), "Failed to write output file");
+}
+
+int main(int argc, char** argv)
+{
+    GeneratorOptions sOptions;
+    if (!parseGeneratorOptions(argc, argv, sOptions))
+        return 1;
+    std::mt19937 sRandom(sOptions.m_Seed);
+    GeneratedData sData;
+    {
+        CTitle title("Generating pads, campaigns and filters");
+        generatePads(sOptions, sRandom, sData);
+        generateCampaigns(sOptions, sRandom, sData);
+        generateFilters(sOptions, sRandom, sData);
+    }
+    std::cout << "Pads / relations / depth: " << sData.m_PadIds.size() << " / " << sData.m_Relations.size()
+              << " / " << sData.m_TargetedPads.size() << std::endl;
+    std::cout << "Users / campaigns / banners: " << sData.m_Users.size() << " / " << sData.m_Campaigns.size()
+              << " / " << sData.m_BannerCount << std::endl;
+    std::cout << "Targetings of users / packages / campaigns: " << sData.m_UserTargetings.size() << " / "
+              << sData.m_PackageTargetings.size() << " / " << sData.m_CampaignTargetings.size() << std::endl;
+    std::cout << "Filters / distinct banner bitsets: " << sData.m_Filters.size() << " / "
+              << sData.m_FilterBanners.size() << std::endl;
+    writeData(sOptions, sData);
+}
@@ -5,28 +5,47 @@
 #include "DbFileReader.hpp"
 #include "Utils.hpp"
 
-std::unordered_map<uint32_t, Pad> Pads;
-std::unordered_map<uint32_t, Package> Packages;
-std::unordered_map<uint32_t, User> Users;
-std::unordered_map<uint32_t, Campaign> Campaigns;
+CountedHashMap<uint32_t, Pad, MemoryCategory::Pads> Pads;
+CountedHashMap<uint32_t, Package, MemoryCategory::Packages> Packages;
+CountedHashMap<uint32_t, User, MemoryCategory::Users> Users;
+CountedHashMap<uint32_t, Campaign, MemoryCategory::Campaigns> Campaigns;
+
+// Data files of loadDb().
+static const char* const PadFile = "Data/pad.txt";
+static const char* const PadRelationFile = "Data/pad_relation.txt";
+static const char* const UserFile = "Data/user.txt";
+static const char* const CampaignFile = "Data/campaign.txt";
+static const char* const TargetingUserFile = "Data/targeting_user.txt";
+static const char* const TargetingPackageFile = "Data/targeting_package.txt";
+static const char* const TargetingCampaignFile = "Data/targeting_campaign.txt";
+
+// Values of "type" field of targeting files; the reader replaces them with their index.
+static const std::initializer_list<const char*> TargetingTypes = {"positive", "negative"};
+static const uint32_t TARGETING_POSITIVE = 0;
+
+std::vector<std::string> dbFiles()
+{
+    return {PadFile, PadRelationFile, UserFile, CampaignFile, TargetingUserFile, TargetingPackageFile, TargetingCampaignFile};
+}
 
 void loadDb()
 {
-    CDbFileReader sReader("Data/pad.txt", {"pad_id"});
-    while (sReader.ReadLine())
+    CDbFileReader sReader(PadFile, {"pad_id"});
+    Pads.reserve(sReader.Rows());
+    for (size_t i = 0; i < sReader.Rows(); i++)
     {
-        uint32_t id = std::stoi(sReader.Fields()[0]);
+        uint32_t id = sReader.Field(i, 0);
         Pads.emplace(id, Pad(id));
         Pads[id] = Pad(id);
     }
     std::cout << "Num pads: " << Pads.size() << std::endl;
 
-    sReader.Open("Data/pad_relation.txt", {"pad_id", "parent_pad_id"});
+    sReader.Open(PadRelationFile, {"pad_id", "parent_pad_id"});
     size_t sNumRelations = 0, sNumBadRelations = 0;
-    while (sReader.ReadLine())
+    for (size_t i = 0; i < sReader.Rows(); i++)
     {
-        uint32_t pad_id = std::stoi(sReader.Fields()[0]);
-        uint32_t parent_pad_id = std::stoi(sReader.Fields()[1]);
+        uint32_t pad_id = sReader.Field(i, 0);
+        uint32_t parent_pad_id = sReader.Field(i, 1);
         if (Pads.count(pad_id) == 0 || Pads.count(parent_pad_id) == 0)
         {
             sNumBadRelations++;
@@ -39,11 +58,11 @@ void loadDb()
     std::cout << "Num relations: " << sNumRelations
               << " (bad: " << sNumBadRelations << ")" << std::endl;
 
-    sReader.Open("Data/user.txt", {"id", "parent_user_id"});
-    while (sReader.ReadLine())
+    sReader.Open(UserFile, {"id", "parent_user_id"});
+    for (size_t i = 0; i < sReader.Rows(); i++)
     {
-        uint32_t id = std::stoi(sReader.Fields()[0]);
-        uint32_t parent_id = std::stoi(sReader.Fields()[1]);
+        uint32_t id = sReader.Field(i, 0);
+        uint32_t parent_id = sReader.Field(i, 1);
         Users[id] = User(id, parent_id);
     }
     size_t sNumBadUsers = 0;
@@ -61,13 +80,13 @@ void loadDb()
     std::cout << "Num users: " << Users.size()
               << " (bad: " << sNumBadUsers << ")" << std::endl;
 
-    sReader.Open("Data/campaign.txt", {"id", "user_id", "package_id"});
+    sReader.Open(CampaignFile, {"id", "user_id", "package_id"});
     size_t sNumBadCampaigns = 0;
-    while (sReader.ReadLine())
+    for (size_t i = 0; i < sReader.Rows(); i++)
     {
-        uint32_t id = std::stoi(sReader.Fields()[0]);
-        uint32_t user_id = std::stoi(sReader.Fields()[1]);
-        uint32_t package_id = std::stoi(sReader.Fields()[2]);
+        uint32_t id = sReader.Field(i, 0);
+        uint32_t user_id = sReader.Field(i, 1);
+        uint32_t package_id = sReader.Field(i, 2);
         Packages[package_id] = Package(package_id);
         Campaign c(id, user_id, package_id);
         c.m_Package = &Packages[package_id];
@@ -80,16 +99,14 @@ void loadDb()
     std::cout << "Num campaigns: " << Campaigns.size()
               << " (bad: " << sNumBadCampaigns << ")" << std::endl;
 
-    sReader.Open("Data/targeting_user.txt", {"user_id", "pad_id", "type"});
+    sReader.Open(TargetingUserFile, {"user_id", "pad_id", "type"}, "type", TargetingTypes);
     size_t sNumTargetingUser = 0;
     size_t sNumBadTargetingUser = 0;
-    while (sReader.ReadLine())
+    for (size_t i = 0; i < sReader.Rows(); i++)
     {
-        uint32_t id = std::stoi(sReader.Fields()[0]);
-        uint32_t pad_id = std::stoi(sReader.Fields()[1]);
-        const std::string type = sReader.Fields()[2];
-        check(type == "positive" || type == "negative", "Wrong targeting type!");
-        bool positive = type == "positive";
+        uint32_t id = sReader.Field(i, 0);
+        uint32_t pad_id = sReader.Field(i, 1);
+        bool positive = sReader.Field(i, 2) == TARGETING_POSITIVE;
         if (Users.count(id) == 0 || Pads.count(pad_id) == 0)
         {
             sNumBadTargetingUser++;
@@ -107,16 +124,14 @@ void loadDb()
     std::cout << "Num targetings: " << sNumTargetingUser
               << " (bad: " << sNumBadTargetingUser << ")" << std::endl;
 
-    sReader.Open("Data/targeting_package.txt", {"package_id", "pad_id", "type"});
+    sReader.Open(TargetingPackageFile, {"package_id", "pad_id", "type"}, "type", TargetingTypes);
     size_t sNumTargetingPackage = 0;
     size_t sNumBadTargetingPackage = 0;
-    while (sReader.ReadLine())
+    for (size_t i = 0; i < sReader.Rows(); i++)
     {
-        uint32_t id = std::stoi(sReader.Fields()[0]);
-        uint32_t pad_id = std::stoi(sReader.Fields()[1]);
-        const std::string type = sReader.Fields()[2];
-        check(type == "positive" || type == "negative", "Wrong targeting type!");
-        bool positive = type == "positive";
+        uint32_t id = sReader.Field(i, 0);
+        uint32_t pad_id = sReader.Field(i, 1);
+        bool positive = sReader.Field(i, 2) == TARGETING_POSITIVE;
         if (Pads.count(pad_id) == 0)
         {
             sNumBadTargetingPackage++;
@@ -134,16 +149,14 @@ void loadDb()
     std::cout << "Num targetings: " << sNumTargetingPackage
               << " (bad: " << sNumBadTargetingPackage << ")" << std::endl;
 
-    sReader.Open("Data/targeting_campaign.txt", {"campaign_id", "pad_id", "type"});
+    sReader.Open(TargetingCampaignFile, {"campaign_id", "pad_id", "type"}, "type", TargetingTypes);
     size_t sNumTargetingCampaign = 0;
     size_t sNumBadTargetingCampaign = 0;
-    while (sReader.ReadLine())
+    for (size_t i = 0; i < sReader.Rows(); i++)
     {
-        uint32_t id = std::stoi(sReader.Fields()[0]);
-        uint32_t pad_id = std::stoi(sReader.Fields()[1]);
-        const std::string type = sReader.Fields()[2];
-        check(type == "positive" || type == "negative", "Wrong targeting type!");
-        bool positive = type == "positive";
+        uint32_t id = sReader.Field(i, 0);
+        uint32_t pad_id = sReader.Field(i, 1);
+        bool positive = sReader.Field(i, 2) == TARGETING_POSITIVE;
         if (Campaigns.count(id) == 0 || Pads.count(pad_id) == 0)
         {
             sNumBadTargetingCampaign++;
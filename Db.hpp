@@ -1,17 +1,26 @@
 #pragma once
 
+#include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "MemoryUsage.hpp"
 #include "Win.hpp"
 
+struct Pad;
+
+// Containers of Db structures, their memory is counted (see MemoryUsage.hpp).
+using PadRelationList = CountedVector<Pad*, MemoryCategory::PadRelations>;
+using EffectivePadList = CountedVector<uint32_t, MemoryCategory::EffectivePads>;
+using TargetingPadList = CountedVector<Pad*, MemoryCategory::Targetings>;
+
 struct Pad
 {
     explicit Pad(uint32_t id = 0) : m_Id(id) {}
 
     uint32_t m_Id;
-    std::vector<Pad*> m_DirectParents;
-    std::vector<Pad*> m_DirectChildren;
+    PadRelationList m_DirectParents;
+    PadRelationList m_DirectChildren;
 
     // Do this pad have filters or targetings directly?
     bool m_HasTargetingsOrFilters = false;
@@ -20,9 +29,11 @@ struct Pad
     // targeting and/or filters) and all its ancestors, that have targetings
     // and/or fiters.
     // Here is the sorted array of such pad IDs. It will be filled during reindexing.
-    std::vector<uint32_t> m_EffectivePads;
+    EffectivePadList m_EffectivePads;
     // Flag that shows whether m_EffectivePads was build or not.
     bool m_EffectivePadsAreBuilt = false;
+    // Whether the pad is on the path that collectEffectivePads() walks, to detect cycles.
+    bool m_EffectivePadsAreBeingBuilt = false;
     // Some pad can have identical m_EffectivePads vectors. Let's mark them with
     // the same group ID. If two pads will have equal group ID then they'll have
     // equal m_EffectivePads and vice-versa it they'll have different group ID
@@ -39,8 +50,8 @@ struct User
     uint32_t m_ParentId;
     User* m_Parent;
 
-    std::vector<Pad*> m_PositiveTargetingPad;
-    std::vector<Pad*> m_NegatineTargetingPad;
+    TargetingPadList m_PositiveTargetingPad;
+    TargetingPadList m_NegatineTargetingPad;
 };
 
 struct Package
@@ -49,8 +60,8 @@ struct Package
 
     uint32_t m_Id;
 
-    std::vector<Pad*> m_PositiveTargetingPad;
-    std::vector<Pad*> m_NegatineTargetingPad;
+    TargetingPadList m_PositiveTargetingPad;
+    TargetingPadList m_NegatineTargetingPad;
 };
 
 struct Campaign
@@ -64,17 +75,16 @@ struct Campaign
     uint32_t m_PackageId;
     Package* m_Package;
 
-    // Apart of all other stuff in this module, I didn't dumped banners of a campaigns.
-    // That's why this vector will be loaded later with all filters (in LoadPrecalculatedFilters()).
-    std::vector<uint32_t> m_BannerIds;
-
-    std::vector<Pad*> m_PositiveTargetingPad;
-    std::vector<Pad*> m_NegatineTargetingPad;
+    TargetingPadList m_PositiveTargetingPad;
+    TargetingPadList m_NegatineTargetingPad;
 };
 
-extern std::unordered_map<uint32_t, Pad> Pads;
-extern std::unordered_map<uint32_t, Package> Packages;
-extern std::unordered_map<uint32_t, User> Users;
-extern std::unordered_map<uint32_t, Campaign> Campaigns;
+extern CountedHashMap<uint32_t, Pad, MemoryCategory::Pads> Pads;
+extern CountedHashMap<uint32_t, Package, MemoryCategory::Packages> Packages;
+extern CountedHashMap<uint32_t, User, MemoryCategory::Users> Users;
+extern CountedHashMap<uint32_t, Campaign, MemoryCategory::Campaigns> Campaigns;
+
+// Data files loadDb() reads.
+std::vector<std::string> dbFiles();
 
 void loadDb();
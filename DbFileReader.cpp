@@ -0,0 +1,205 @@
+#include "DbFileReader.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include "MappedFile.hpp"
+#include "Metrics.hpp"
+#include "PerfCounters.hpp"
+#include "Timer.hpp"
+#include "Utils.hpp"
+
+namespace {
+
+// Files smaller than that are parsed by one thread.
+const size_t MIN_CHUNK_SIZE = 1024 * 1024;
+
+bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Token of a line, pointer + length.
+struct Token
+{
+    const char* m_Begin;
+    size_t m_Size;
+};
+
+// Split next line into tokens. Returns pointer to the beginning of the next line.
+// Tokens that don't fit to aTokens are counted but not stored.
+const char* splitLine(const char* aPos, const char* aEnd, Token* aTokens, size_t aMaxTokens, size_t& aCount)
+{
+    aCount = 0;
+    while (aPos != aEnd && *aPos != '\n')
+    {
+        if (isSpace(*aPos))
+        {
+            ++aPos;
+            continue;
+        }
+        const char* sBegin = aPos;
+        while (aPos != aEnd && *aPos != '\n' && !isSpace(*aPos))
+            ++aPos;
+        if (aCount < aMaxTokens)
+            aTokens[aCount] = Token{sBegin, size_t(aPos - sBegin)};
+        aCount++;
+    }
+    return aPos == aEnd ? aEnd : aPos + 1;
+}
+
+bool parseUnsigned(const Token& aToken, uint32_t& aValue)
+{
+    if (aToken.m_Size == 0 || aToken.m_Size > 10)
+        return false;
+    uint64_t sValue = 0;
+    for (size_t i = 0; i < aToken.m_Size; i++)
+    {
+        unsigned sDigit = (unsigned)(aToken.m_Begin[i] - '0');
+        if (sDigit > 9)
+            return false;
+        sValue = sValue * 10 + sDigit;
+    }
+    if (sValue > UINT32_MAX)
+        return false;
+    aValue = (uint32_t)sValue;
+    return true;
+}
+
+bool parseWord(const Token& aToken, const std::vector<std::string>& aWords, uint32_t& aValue)
+{
+    for (size_t i = 0; i < aWords.size(); i++)
+    {
+        if (aWords[i].size() == aToken.m_Size && 0 == memcmp(aWords[i].data(), aToken.m_Begin, aToken.m_Size))
+        {
+            aValue = (uint32_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Parse lines in [aBegin, aEnd). Field aWordField is a word, others are numbers.
+// Returns error description or nullptr.
+const char* parseChunk(const char* aBegin, const char* aEnd, size_t aFieldCount, size_t aWordField,
+                       const std::vector<std::string>& aWords, std::vector<uint32_t>& aValues)
+{
+    std::vector<Token> sTokens(aFieldCount);
+    const char* sPos = aBegin;
+    while (sPos != aEnd)
+    {
+        size_t sCount = 0;
+        sPos = splitLine(sPos, aEnd, sTokens.data(), aFieldCount, sCount);
+        if (sCount == 0)
+            continue; // Empty line.
+        if (sCount != aFieldCount)
+            return "wrong number of fields!";
+        for (size_t i = 0; i < aFieldCount; i++)
+        {
+            uint32_t sValue = 0;
+            bool sParsed = i == aWordField ? parseWord(sTokens[i], aWords, sValue) : parseUnsigned(sTokens[i], sValue);
+            if (!sParsed)
+                return "wrong field value!";
+            aValues.push_back(sValue);
+        }
+    }
+    return nullptr;
+}
+
+} // namespace {
+
+void CDbFileReader::Open(const std::string& filename, const std::initializer_list<const char*>& fields,
+                         const char* wordField, const std::initializer_list<const char*>& words)
+{
+    CTimer sTimer(true);
+    std::cout << "Loading file " << filename << "... ";
+
+    CMappedFile sFile;
+    if (!sFile.Open(filename))
+        sFile.Open("../" + filename);
+    check(sFile.Data() != nullptr, "file not found!");
+    const char* sBegin = sFile.Data();
+    const char* sEnd = sBegin + sFile.Size();
+
+    // Header.
+    m_FieldCount = fields.size();
+    size_t sWordField = m_FieldCount;
+    for (size_t i = 0; wordField != nullptr && i < m_FieldCount; i++)
+    {
+        if (0 == strcmp(wordField, fields.begin()[i]))
+            sWordField = i;
+    }
+    check(wordField == nullptr || sWordField != m_FieldCount, "no such word field!");
+    m_Values.clear();
+    std::vector<Token> sTokens(m_FieldCount);
+    size_t sCount = 0;
+    const char* sBody = splitLine(sBegin, sEnd, sTokens.data(), m_FieldCount, sCount);
+    check(sCount == m_FieldCount, "wrong file header!");
+    for (size_t i = 0; i < m_FieldCount; i++)
+    {
+        const char* sName = fields.begin()[i];
+        check(strlen(sName) == sTokens[i].m_Size && 0 == memcmp(sName, sTokens[i].m_Begin, sTokens[i].m_Size),
+              "wrong file header!");
+    }
+
+    // Split the body into chunks by line boundaries.
+    size_t sBodySize = size_t(sEnd - sBody);
+    size_t sThreads = std::max<size_t>(1, std::thread::hardware_concurrency());
+    size_t sChunkCount = std::max<size_t>(1, std::min(sThreads, sBodySize / MIN_CHUNK_SIZE));
+    std::vector<const char*> sBounds(1, sBody);
+    for (size_t i = 1; i < sChunkCount; i++)
+    {
+        const char* sBound = std::max(sBody + sBodySize * i / sChunkCount, sBounds.back());
+        sBound = std::find(sBound, sEnd, '\n');
+        sBounds.push_back(sBound == sEnd ? sEnd : sBound + 1);
+    }
+    sBounds.push_back(sEnd);
+
+    std::vector<std::string> sWords(words.begin(), words.end());
+    std::vector<std::vector<uint32_t>> sChunkValues(sChunkCount);
+    std::vector<const char*> sErrors(sChunkCount, nullptr);
+    auto sParse = [&](size_t i)
+    {
+        // Rough estimation of values count: a field with a separator takes ~8 bytes.
+        sChunkValues[i].reserve(size_t(sBounds[i + 1] - sBounds[i]) / 8);
+        sErrors[i] = parseChunk(sBounds[i], sBounds[i + 1], m_FieldCount, sWordField, sWords, sChunkValues[i]);
+    };
+    std::vector<std::thread> sWorkers;
+    for (size_t i = 1; i < sChunkCount; i++)
+    {
+        sWorkers.emplace_back([&sParse](size_t aChunk)
+        {
+            CPerfCountersThread sCounters;
+            sParse(aChunk);
+        }, i);
+    }
+    sParse(0);
+    for (std::thread& sWorker : sWorkers)
+        sWorker.join();
+    for (const char* sError : sErrors)
+        check(nullptr == sError, sError);
+
+    if (sChunkCount == 1)
+    {
+        m_Values.swap(sChunkValues[0]);
+    }
+    else
+    {
+        size_t sTotal = 0;
+        for (const std::vector<uint32_t>& sValues : sChunkValues)
+            sTotal += sValues.size();
+        m_Values.reserve(sTotal);
+        for (const std::vector<uint32_t>& sValues : sChunkValues)
+            m_Values.insert(m_Values.end(), sValues.begin(), sValues.end());
+    }
+
+    sTimer.Stop();
+    unsigned long long sMicrosec = std::max<unsigned long long>(1, sTimer.ElapsedMicroSec());
+    std::cout << "done in " << sTimer.ElapsedMilliSec() << " milliseconds ("
+              << Rows() << " rows, " << sChunkCount << " threads, "
+              << double(sFile.Size()) / double(sMicrosec) << " MB/s)." << std::endl;
+    if (metricsEnabled())
+        metric(MetricKind::Phase, "Loading file " + filename).Record(sTimer.ElapsedNanoSec());
+}
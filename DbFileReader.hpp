@@ -1,68 +1,49 @@
 #pragma once
 
-#include <iostream>
-#include <fstream>
+#include <initializer_list>
 #include <string>
 #include <vector>
-#include <unordered_map>
-
-#include "Timer.hpp"
-#include "Utils.hpp"
 
 #include "Win.hpp"
 
+// Reader of DB dump files.
+//
+// A file is a header line with field names followed by lines of whitespace
+// separated fields, one row per line. Every field is an unsigned integer, except
+// the word field (if any), which is one of given words and is stored as its index
+// in the list of words. Words in other fields and numbers in the word field are
+// errors.
+//
+// The file is memory mapped and integers are parsed in place. Big files are
+// split into chunks by line boundaries, and the chunks are parsed in parallel.
+// The whole file is parsed by Open(), then rows are accessed by Field().
 struct CDbFileReader
 {
-    CDbFileReader(const std::string& filename, const std::initializer_list<const char*>& fields)
-    {
-        Open(filename, fields);
-    }
+    CDbFileReader() = default;
 
-    void Open(const std::string& filename, const std::initializer_list<const char*>& fields)
+    CDbFileReader(const std::string& filename, const std::initializer_list<const char*>& fields,
+                  const char* wordField = nullptr, const std::initializer_list<const char*>& words = {})
     {
-        m_Timer.Start();
-
-        if (m_File.is_open())
-            m_File.close();
-        std::cout << "Loading file " << filename << "... ";
-        m_File.open(filename, std::fstream::in);
-        if (!m_File.is_open())
-            m_File.open("../" + filename, std::fstream::in);
-        check(m_File.is_open(), "file not found!");
-
-        m_Fields.resize(fields.size());
-        check(readLineInteral(), "wrong file format!");
-        check(std::equal(m_Fields.begin(), m_Fields.end(), fields.begin()),
-              "wrong file header!");
+        Open(filename, fields, wordField, words);
     }
 
-    bool ReadLine()
-    {
-        bool res = readLineInteral();
-        if (!res)
-        {
-            m_Timer.Stop();
-            std::cout << "done in " << m_Timer.ElapsedMilliSec() << " milliseconds." << std::endl;
-        }
-        return res;
-    }
+    // Load the file. wordField is the name of the field of words, one of fields.
+    // Terminates the program if the file is absent or malformed.
+    void Open(const std::string& filename, const std::initializer_list<const char*>& fields,
+              const char* wordField = nullptr, const std::initializer_list<const char*>& words = {});
 
-    const std::vector<std::string> Fields() const
+    size_t Rows() const
     {
-        return m_Fields;
+        return m_FieldCount == 0 ? 0 : m_Values.size() / m_FieldCount;
     }
 
-private:
-    bool readLineInteral()
+    uint32_t Field(size_t aRow, size_t aField) const
     {
-        if (m_File.eof())
-            return false;
-        for (size_t i = 0; i < m_Fields.size(); i++)
-            m_File >> m_Fields[i];
-        return true;
+        return m_Values[aRow * m_FieldCount + aField];
     }
 
-    std::vector<std::string> m_Fields;
-    std::fstream m_File;
-    CTimer m_Timer;
+private:
+    size_t m_FieldCount = 0;
+    // Rows one after another, m_FieldCount values per row.
+    std::vector<uint32_t> m_Values;
 };
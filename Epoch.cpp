@@ -0,0 +1,92 @@
+#include "Epoch.hpp"
+
+#include <atomic>
+#include <thread>
+
+#include "Utils.hpp"
+
+namespace {
+
+// Max count of threads that may be inside read sections at the same time.
+const size_t MAX_EPOCH_READERS = 1024;
+
+// Slot of a reader thread: epoch at which the thread entered its read section,
+// zero if it's outside. Slots are aligned to cache lines, so readers don't
+// share them.
+struct alignas(64) ReaderSlot
+{
+    std::atomic<uint64_t> m_Epoch{0};
+    std::atomic<bool> m_Used{false};
+};
+
+ReaderSlot ReaderSlots[MAX_EPOCH_READERS];
+
+// Current epoch, every synchronizeEpochReaders() starts a new one.
+std::atomic<uint64_t> GlobalEpoch{1};
+
+// Slot of the current thread and depth of nested read sections.
+// The slot is taken on the first read section and is freed when the thread exits.
+struct ThreadReader
+{
+    ReaderSlot* m_Slot = nullptr;
+    size_t m_Depth = 0;
+
+    ~ThreadReader()
+    {
+        if (nullptr != m_Slot)
+            m_Slot->m_Used.store(false, std::memory_order_release);
+    }
+
+    ReaderSlot& slot()
+    {
+        if (nullptr != m_Slot)
+            return *m_Slot;
+        for (ReaderSlot& sSlot : ReaderSlots)
+        {
+            bool sUsed = false;
+            if (!sSlot.m_Used.load(std::memory_order_relaxed) && sSlot.m_Used.compare_exchange_strong(sUsed, true))
+            {
+                m_Slot = &sSlot;
+                return sSlot;
+            }
+        }
+        fatal("Too many epoch reader threads");
+        return ReaderSlots[0];
+    }
+};
+
+thread_local ThreadReader CurrentReader;
+
+} // namespace {
+
+// The reader publishes its epoch and only then loads the shared pointer, while
+// the writer swaps the pointer and only then starts a new epoch and scans the
+// slots (all operations are sequentially consistent). So a reader that is seen
+// outside a section or in the new epoch loads the pointer after the swap and
+// can't see the old object.
+CEpochReadScope::CEpochReadScope()
+{
+    if (0 == CurrentReader.m_Depth++)
+        CurrentReader.slot().m_Epoch.store(GlobalEpoch.load());
+}
+
+CEpochReadScope::~CEpochReadScope()
+{
+    if (0 == --CurrentReader.m_Depth)
+        CurrentReader.m_Slot->m_Epoch.store(0, std::memory_order_release);
+}
+
+void synchronizeEpochReaders()
+{
+    uint64_t sEpoch = GlobalEpoch.fetch_add(1) + 1;
+    for (ReaderSlot& sSlot : ReaderSlots)
+    {
+        for (;;)
+        {
+            uint64_t sReaderEpoch = sSlot.m_Epoch.load();
+            if (0 == sReaderEpoch || sReaderEpoch >= sEpoch)
+                break;
+            std::this_thread::yield();
+        }
+    }
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "Win.hpp"
+
+// Epoch based reclamation of shared objects (read-copy-update).
+//
+// Readers access a shared object only inside a read section (CEpochReadScope).
+// A writer replaces the object by an atomic pointer swap, then calls
+// synchronizeEpochReaders(), which waits until all read sections that might have
+// seen the old object are left, and then the old object may be freed.
+// Read sections never wait for writers: entering and leaving a section is
+// a store to a slot of the thread. Sections may be nested.
+class CEpochReadScope
+{
+public:
+    CEpochReadScope();
+    ~CEpochReadScope();
+
+    CEpochReadScope(const CEpochReadScope&) = delete;
+    CEpochReadScope& operator=(const CEpochReadScope&) = delete;
+};
+
+// Wait until all read sections that were entered before the call are left.
+// Read sections entered after the call are not waited for.
+void synchronizeEpochReaders();
@@ -1,47 +1,104 @@
 #include "Filters.hpp"
 
+#include <algorithm>
+#include <climits>
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <unordered_set>
 
 #include "Db.hpp"
 #include "Index.hpp"
 #include "Utils.hpp"
 
 // Map pad_id -> PadFilter of that pad.
-std::unordered_map<uint32_t, PadFilter> PadFilters;
+CountedHashMap<uint32_t, PadFilter, MemoryCategory::PadFilters> PadFilters;
+
+// Whether campaign and user columns of IndexedBanners are filled.
+static bool BannerOwnerColumns = false;
+
+const char* const PrecalculatedFiltersFile = "Data/index.txt";
 
 // PadFilter pointers to bitsets lead to one of bitsets in this bank.
 std::vector<target::dynamic_bitset> PadBannerBitsetBank;
 std::vector<target::dynamic_bitset> PadCampaignBitsetBank;
 
+using word_t = target::dynamic_bitset::word_t;
+static const size_t WORD_BITS = sizeof(word_t) * CHAR_BIT;
+static const size_t WORD_DIGITS = WORD_BITS / 4;
+
+// Hex digit -> its value, 0xFF for non-digits.
+struct HexTable
+{
+    uint8_t m_Values[256];
+
+    HexTable()
+    {
+        for (size_t i = 0; i < 256; i++)
+            m_Values[i] = 0xFF;
+        for (size_t i = 0; i < 10; i++)
+            m_Values['0' + i] = (uint8_t)i;
+        for (size_t i = 0; i < 6; i++)
+            m_Values['a' + i] = (uint8_t)(10 + i);
+    }
+};
+static const HexTable HexDigits;
+
+// Hex string is a sequence of digits, every digit holds 4 bits, lowest bit first.
+// The string is decoded by words of 16 digits. Skipped bits are removed from
+// the decoded word all at once (there are usually no or few of them in a word),
+// and then the rest of the word is appended to the result.
 static target::dynamic_bitset loadBitsetFromString(const std::string& aStr,
                                                    size_t aOriginalSize,
                                                    const std::vector<size_t>& aSkipBits)
 {
-    assert(aStr.size() == (aOriginalSize + 3)/ 4);
+    check(aStr.size() == (aOriginalSize + 3) / 4, "Wrong bitset format");
     target::dynamic_bitset sResult(aOriginalSize - aSkipBits.size());
-
-    size_t sPosInSkipBits = 0;
+    word_t* sResultWords = sResult.data();
     size_t sResultPos = 0;
+    size_t sPosInSkipBits = 0;
+    unsigned sInvalid = 0;
 
-    for (size_t i = 0; i < aStr.size(); i++)
+    const unsigned char* sDigits = reinterpret_cast<const unsigned char*>(aStr.data());
+    for (size_t sWordStart = 0; sWordStart < aOriginalSize; sWordStart += WORD_BITS)
     {
-        assert((aStr[i] >= '0' && aStr[i] <= '9') || (aStr[i] >= 'a' && aStr[i] <= 'f'));
-        int digit = (aStr[i] >= '0' && aStr[i] <= '9') ? aStr[i] - '0' : aStr[i] - 'a' + 10;
-        for (size_t j = 0; j < 4; j++)
+        // Decode up to 16 digits.
+        size_t sFirstDigit = sWordStart / 4;
+        size_t sDigitCount = std::min(WORD_DIGITS, aStr.size() - sFirstDigit);
+        word_t sWord = 0;
+        for (size_t i = 0; i < sDigitCount; i++)
         {
-            size_t sOriginalPos = i * 4 + j;
-            if (sPosInSkipBits < aSkipBits.size() && aSkipBits[sPosInSkipBits] == sOriginalPos)
-            {
-                sPosInSkipBits++;
-                continue;
-            }
-            if ((digit >> j) & 1)
-                sResult.set(sResultPos);
-            sResultPos++;
+            uint8_t sValue = HexDigits.m_Values[sDigits[sFirstDigit + i]];
+            sInvalid |= sValue;
+            sWord |= word_t(sValue & 0xF) << (4 * i);
+        }
+        size_t sBits = std::min(WORD_BITS, aOriginalSize - sWordStart);
+        if (sBits < WORD_BITS)
+            sWord &= (word_t(1) << sBits) - 1;
+
+        // Remove skipped bits, from highest to lowest, so positions of lower ones don't change.
+        size_t sSkipFirst = sPosInSkipBits;
+        while (sPosInSkipBits < aSkipBits.size() && aSkipBits[sPosInSkipBits] < sWordStart + sBits)
+            sPosInSkipBits++;
+        for (size_t k = sPosInSkipBits; k > sSkipFirst; k--)
+        {
+            word_t sLowMask = (word_t(1) << (aSkipBits[k - 1] - sWordStart)) - 1;
+            sWord = (sWord & sLowMask) | ((sWord >> 1) & ~sLowMask);
+            sBits--;
         }
+
+        // Append sBits of the word. Nothing is left if all bits are skipped, and then
+        // sResultPos can be the end of the result words, or there are no words at all.
+        if (sBits == 0)
+            continue;
+        size_t sOffset = sResultPos % WORD_BITS;
+        sResultWords[sResultPos / WORD_BITS] |= sWord << sOffset;
+        if (sOffset + sBits > WORD_BITS)
+            sResultWords[sResultPos / WORD_BITS + 1] |= sWord >> (WORD_BITS - sOffset);
+        sResultPos += sBits;
     }
+    check(0 == (sInvalid & 0xF0), "Wrong bitset format");
+    assert(sResultPos == sResult.size());
     return sResult;
 }
 
@@ -52,7 +109,7 @@ void loadPrecalculatedFilters()
     size_t sOriginalCampaignCount = 0, sOriginalBannerCount = 0;
     std::vector<size_t> sSkippedCampaigns, sSkippedBanners;
 
-    const std::string sFilename = "Data/index.txt";
+    const std::string sFilename = PrecalculatedFiltersFile;
     std::fstream sFile(sFilename, std::fstream::in);
     if (!sFile.is_open())
         sFile.open("../" + sFilename, std::fstream::in);
@@ -106,6 +163,13 @@ void loadPrecalculatedFilters()
         check(sLine == "Banners (id, campaign_id)", "Wrong file format");
         sFile >> sOriginalBannerCount;
         check(sOriginalBannerCount != 0, "Must have at least one banner");
+        IndexedBanners = IndexedBannerColumns();
+        IndexedBanners.m_BannerIds.reserve(sOriginalBannerCount);
+        if (BannerOwnerColumns)
+        {
+            IndexedBanners.m_CampaignIds.reserve(sOriginalBannerCount);
+            IndexedBanners.m_UserIds.reserve(sOriginalBannerCount);
+        }
         for (size_t i = 0; i < sOriginalBannerCount; i++)
         {
             uint32_t id = 0;
@@ -127,30 +191,27 @@ void loadPrecalculatedFilters()
                     IndexedCampaigns[sPosInIndexedCampaigns].m_FirstBannerPosition = (uint32_t)IndexedBanners.size();
                     IndexedCampaigns[sPosInIndexedCampaigns].m_BannerCount = 0;
                 }
-                check(IndexedCampaigns[sPosInIndexedCampaigns].m_CampaignId == campaign_id, "Campaign disorder");
-                IndexedCampaigns[sPosInIndexedCampaigns].m_BannerCount++;
-
-                Campaigns[campaign_id].m_BannerIds.push_back(id);
-                IndexedBanner bann;
-                bann.m_UserId = Campaigns[campaign_id].m_UserId;
-                bann.m_CampaignId = campaign_id;
-                bann.m_BannerId = id;
-                IndexedBanners.push_back(bann);
+                IndexedCampaign& sIndCamp = IndexedCampaigns[sPosInIndexedCampaigns];
+                check(sIndCamp.m_CampaignId == campaign_id, "Campaign disorder");
+                sIndCamp.m_BannerCount++;
+
+                IndexedBanners.m_BannerIds.push_back(id);
+                if (BannerOwnerColumns)
+                {
+                    IndexedBanners.m_CampaignIds.push_back(campaign_id);
+                    IndexedBanners.m_UserIds.push_back(sIndCamp.m_UserId);
+                }
             }
         }
 
-        // Paranoiac check.
+        check(sPosInIndexedCampaigns + 1 == IndexedCampaigns.size(), "Campaign without banners");
+
+        // Paranoiac check: banner ranges of campaigns follow each other.
         size_t sCheckBannersCount = 0;
         for (size_t i = 0; i < IndexedCampaigns.size(); i++)
         {
+            check(IndexedCampaigns[i].m_FirstBannerPosition == sCheckBannersCount, "Smth went wrong");
             sCheckBannersCount += IndexedCampaigns[i].m_BannerCount;
-            for (size_t j = 0; j < IndexedCampaigns[i].m_BannerCount; j++)
-            {
-                size_t k = IndexedCampaigns[i].m_FirstBannerPosition + j;
-                check(k < IndexedBanners.size(), "Smth went wrong");
-                check(IndexedBanners[k].m_UserId == IndexedCampaigns[i].m_UserId, "Smth went wrong");
-                check(IndexedBanners[k].m_CampaignId == IndexedCampaigns[i].m_CampaignId, "Smth went wrong");
-            }
         }
         check(IndexedBanners.size() == sCheckBannersCount, "Smth went wrong");
     }
@@ -247,3 +308,12 @@ void loadPrecalculatedFilters()
     check(sLine == "Done", "Wrong file format");
 }
 
+void setBannerOwnerColumns(bool aEnabled)
+{
+    BannerOwnerColumns = aEnabled;
+}
+
+bool bannerOwnerColumns()
+{
+    return BannerOwnerColumns;
+}
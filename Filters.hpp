@@ -4,6 +4,7 @@
 #include <vector>
 
 #include "dynamic_bitset.hpp"
+#include "MemoryUsage.hpp"
 #include "Win.hpp"
 
 // Structure that describes filters of a pad.
@@ -21,12 +22,20 @@ struct PadFilter
 };
 
 // Map pad_id -> PadFilter of that pad.
-extern std::unordered_map<uint32_t, PadFilter> PadFilters;
+extern CountedHashMap<uint32_t, PadFilter, MemoryCategory::PadFilters> PadFilters;
 
 // PadFilter pointers to bitsets lead to one of bitsets in this banks.
 extern std::vector<target::dynamic_bitset> PadBannerBitsetBank;
 extern std::vector<target::dynamic_bitset> PadCampaignBitsetBank;
 
+// Fill campaign and user columns of IndexedBanners by next loadPrecalculatedFilters(),
+// they are not filled by default.
+void setBannerOwnerColumns(bool aEnabled);
+bool bannerOwnerColumns();
+
+// Data file loadPrecalculatedFilters() reads.
+extern const char* const PrecalculatedFiltersFile;
+
 // Load PadFilters from special file.
 // Calculation of filter indexes is rather complex and is excluded from that benchmark.
 void loadPrecalculatedFilters();
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Read-only array that either owns its elements (moved in from a vector)
+// or refers to external memory, e.g. to a mapped snapshot file.
+// In the latter case the external memory must outlive the array.
+// Owned elements may be shared by several arrays (see Share()), e.g. by index
+// versions that have the same array; they are freed with the last of them.
+template <class T>
+class CFlatArray
+{
+public:
+    CFlatArray() = default;
+
+    CFlatArray(std::vector<T>&& aStorage)
+        : m_Storage(std::make_shared<const std::vector<T>>(std::move(aStorage))),
+          m_Data(m_Storage->data()), m_Size(m_Storage->size()) {}
+
+    CFlatArray(const T* aData, size_t aSize) : m_Data(aData), m_Size(aSize) {}
+
+    CFlatArray(CFlatArray&&) = default;
+    CFlatArray& operator=(CFlatArray&&) = default;
+    CFlatArray(const CFlatArray&) = delete;
+    CFlatArray& operator=(const CFlatArray&) = delete;
+
+    // Array of the same elements, without copying them. External memory still
+    // must outlive both arrays.
+    CFlatArray Share() const
+    {
+        CFlatArray sRes(m_Data, m_Size);
+        sRes.m_Storage = m_Storage;
+        return sRes;
+    }
+
+    const T& operator[](size_t aPos) const { return m_Data[aPos]; }
+    const T* data() const { return m_Data; }
+    const T* begin() const { return m_Data; }
+    const T* end() const { return m_Data + m_Size; }
+    size_t size() const { return m_Size; }
+    bool empty() const { return 0 == m_Size; }
+
+    // Size of owned dynamically allocated memory (shared memory is counted by
+    // every array that shares it).
+    size_t mem_size() const { return nullptr == m_Storage ? 0 : m_Storage->capacity() * sizeof(T); }
+
+private:
+    std::shared_ptr<const std::vector<T>> m_Storage;
+    const T* m_Data = nullptr;
+    size_t m_Size = 0;
+};
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+#include "dynamic_bitset.hpp"
+#include "Win.hpp"
+
+// LRU cache of bitsets keyed by effective pads group ID.
+// Pads of the same group always have the same campaignsByPad() result, so the
+// result can be calculated once per group and then reused while it's in cache.
+// Memory usage of the cache is limited by budget; least recently used entries
+// are evicted when the budget is exceeded. Zero budget disables the cache.
+// Every shard gets 1/SHARD_COUNT of the budget, so an entry larger than that
+// is never cached; such entries are counted as rejected, not as evictions.
+//
+// Find() and Insert() may be called from any number of threads. The cache is
+// split into shards by group ID, every shard is a separate LRU list with its
+// own lock and an equal part of the budget, so concurrent queries rarely wait
+// for each other. SetBudget() and Clear() may run concurrently with queries too:
+// budgets of shards are changed under their locks, and the total one is atomic.
+class CGroupCache
+{
+public:
+    static const size_t SHARD_COUNT = 16;
+
+    // Set the total budget; each shard may keep aBytes / SHARD_COUNT bytes, and
+    // results larger than that are rejected by Insert() (see Rejected()).
+    void SetBudget(size_t aBytes)
+    {
+        m_Budget.store(aBytes, std::memory_order_relaxed);
+        for (Shard& sShard : m_Shards)
+        {
+            std::lock_guard<std::mutex> sLock(sShard.m_Mutex);
+            sShard.m_Budget = aBytes / SHARD_COUNT;
+            // Entries dropped to fit a new budget are not evictions of the LRU policy.
+            sShard.shrink();
+        }
+    }
+
+    size_t Budget() const { return m_Budget.load(std::memory_order_relaxed); }
+    bool Enabled() const { return 0 != Budget(); }
+
+    // Copy cached bitset of a group to aResult, returns false if it's absent.
+    // Updates hit/miss counters and marks found entry as recently used.
+    bool Find(uint32_t aGroupId, target::dynamic_bitset& aResult)
+    {
+        Shard& sShard = shard(aGroupId);
+        std::lock_guard<std::mutex> sLock(sShard.m_Mutex);
+        auto sItr = sShard.m_Map.find(aGroupId);
+        if (sItr == sShard.m_Map.end())
+        {
+            sShard.m_Misses++;
+            return false;
+        }
+        sShard.m_Hits++;
+        sShard.m_List.splice(sShard.m_List.begin(), sShard.m_List, sItr->second);
+        aResult = sItr->second->second;
+        return true;
+    }
+
+    void Insert(uint32_t aGroupId, const target::dynamic_bitset& aBitset)
+    {
+        if (!Enabled())
+            return;
+        Shard& sShard = shard(aGroupId);
+        size_t sEntrySize = entrySize(aBitset);
+        std::lock_guard<std::mutex> sLock(sShard.m_Mutex);
+        if (sEntrySize > sShard.m_Budget)
+        {
+            sShard.m_Rejected++;
+            return;
+        }
+        if (sShard.m_Map.count(aGroupId) != 0)
+            return;
+        sShard.m_List.emplace_front(aGroupId, aBitset);
+        sShard.m_Map[aGroupId] = sShard.m_List.begin();
+        sShard.m_Size++;
+        sShard.m_MemSize += entrySize(sShard.m_List.front().second);
+        sShard.m_Evictions += sShard.shrink();
+    }
+
+    // Insert entries of another cache whose group aKeep(group) accepts, keeping
+    // their order of use. aOther may be in use by queries, this cache must not.
+    template <class KEEP>
+    void InsertFrom(const CGroupCache& aOther, KEEP aKeep)
+    {
+        for (const Shard& sShard : aOther.m_Shards)
+        {
+            std::lock_guard<std::mutex> sLock(sShard.m_Mutex);
+            // From least to most recently used, so the latter end up in front.
+            for (auto sItr = sShard.m_List.rbegin(); sItr != sShard.m_List.rend(); ++sItr)
+            {
+                if (aKeep(sItr->first))
+                    Insert(sItr->first, sItr->second);
+            }
+        }
+    }
+
+    void Clear()
+    {
+        for (Shard& sShard : m_Shards)
+        {
+            std::lock_guard<std::mutex> sLock(sShard.m_Mutex);
+            sShard.m_List.clear();
+            sShard.m_Map.clear();
+            sShard.m_Size = 0;
+            sShard.m_MemSize = 0;
+        }
+    }
+
+    void ResetStats()
+    {
+        for (Shard& sShard : m_Shards)
+        {
+            std::lock_guard<std::mutex> sLock(sShard.m_Mutex);
+            sShard.m_Hits = sShard.m_Misses = sShard.m_Evictions = sShard.m_Rejected = 0;
+        }
+    }
+
+    size_t Size() const { return sum(&Shard::m_Size); }
+    size_t MemSize() const { return sum(&Shard::m_MemSize); }
+    size_t Hits() const { return sum(&Shard::m_Hits); }
+    size_t Misses() const { return sum(&Shard::m_Misses); }
+    size_t Evictions() const { return sum(&Shard::m_Evictions); }
+    // Count of results that were not cached as they exceed the budget of a shard.
+    size_t Rejected() const { return sum(&Shard::m_Rejected); }
+
+private:
+    using Entry = std::pair<uint32_t, target::dynamic_bitset>;
+
+    // Approximate size of an entry: bitset words plus list node and hash table node.
+    static size_t entrySize(const target::dynamic_bitset& aBitset)
+    {
+        return aBitset.mem_size() + sizeof(Entry) + 2 * sizeof(void*) +
+               sizeof(std::pair<uint32_t, std::list<Entry>::iterator>) + 2 * sizeof(void*);
+    }
+
+    // Shards are separated by a cache line of padding, so locks and counters of
+    // different shards don't share cache lines. Padding is used instead of alignment,
+    // as caches are parts of index versions that are allocated by plain new.
+    struct Shard
+    {
+        mutable std::mutex m_Mutex;
+        std::list<Entry> m_List;
+        std::unordered_map<uint32_t, std::list<Entry>::iterator> m_Map;
+        size_t m_Budget = 0;
+        size_t m_Size = 0;
+        size_t m_MemSize = 0;
+        size_t m_Hits = 0;
+        size_t m_Misses = 0;
+        size_t m_Evictions = 0;
+        size_t m_Rejected = 0;
+        char m_Padding[64];
+
+        // Drop least recently used entries until the shard fits its budget.
+        // Returns count of dropped entries.
+        size_t shrink()
+        {
+            size_t sDropped = 0;
+            while (m_MemSize > m_Budget && !m_List.empty())
+            {
+                m_MemSize -= entrySize(m_List.back().second);
+                m_Map.erase(m_List.back().first);
+                m_List.pop_back();
+                m_Size--;
+                sDropped++;
+            }
+            return sDropped;
+        }
+    };
+
+    Shard& shard(uint32_t aGroupId)
+    {
+        // Mix group IDs (or numbers), so shards are loaded evenly.
+        // The top 4 bits of the product select one of 16 shards.
+        static_assert(SHARD_COUNT == 16, "Shard selection expects 16 shards");
+        return m_Shards[uint32_t(aGroupId * 2654435761u) >> 28];
+    }
+
+    size_t sum(size_t Shard::*aField) const
+    {
+        size_t sRes = 0;
+        for (const Shard& sShard : m_Shards)
+        {
+            std::lock_guard<std::mutex> sLock(sShard.m_Mutex);
+            sRes += sShard.*aField;
+        }
+        return sRes;
+    }
+
+    Shard m_Shards[SHARD_COUNT];
+    std::atomic<size_t> m_Budget{0};
+};
@@ -1,39 +1,129 @@
 #include "Index.hpp"
 
 #include <algorithm>
+#include <atomic>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <mutex>
 #include <unordered_map>
+#include <utility>
 
 #include "Db.hpp"
 #include "Filters.hpp"
+#include "MemoryUsage.hpp"
+#include "Metrics.hpp"
+#include "PadGraph.hpp"
+#include "ThreadPool.hpp"
 #include "Utils.hpp"
 
+// Lists of pads or positions that are values of hash maps of the index, their memory is
+// counted in the category of the map (see MemoryUsage.hpp).
+using TargetingBitsetNumbers = CountedVector<uint32_t, MemoryCategory::TargetingBitsetsByHash>;
+using FilteredBannerList = CountedVector<uint32_t, MemoryCategory::FilteredBanners>;
+using GroupFilteredBannerList = CountedVector<uint32_t, MemoryCategory::GroupFilteredBanners>;
+using GroupPadList = CountedVector<uint32_t, MemoryCategory::EffectivePadsGroups>;
+using CampaignPositionList = CountedVector<uint32_t, MemoryCategory::UpdateMaps>;
+
 // Array of campaigns in the index.
 // This vector will be initialized during loading of filters.
 std::vector<IndexedCampaign> IndexedCampaigns;
 
-// Array of banners in the index.
-// This vector will be initialized during loading of filters.
-std::vector<IndexedBanner> IndexedBanners;
+// Banners in the index.
+// They will be initialized during loading of filters.
+IndexedBannerColumns IndexedBanners;
 
-// pad_id -> bitset of campaigns that passes positive/negative targetings and filters
-// directly for this pad.
+// Bank of distinct positive/negative targeting bitsets.
+// Pads with identical bitsets share one bitset in the bank.
+std::vector<target::dynamic_bitset> TargetingBitsetBank;
+// Number of pads that refer every bitset of the bank. Bitsets that are not
+// referred anymore (after targeting updates) are emptied and reused.
+static std::vector<uint32_t> TargetingBitsetRefs;
+static std::vector<uint32_t> FreeTargetingBitsets;
+// hash -> numbers of bank bitsets with that hash.
+static CountedHashMap<size_t, TargetingBitsetNumbers, MemoryCategory::TargetingBitsetsByHash> TargetingBitsetsByHash;
+
+// pad_id -> number of bitset (in TargetingBitsetBank) of campaigns that passes
+// positive/negative targetings and filters directly for this pad.
 // Every bit of a bitset corresponds to the campaign in IndexedCampaigns in the same position.
-std::unordered_map<uint32_t, target::dynamic_bitset> PositiveCampaigns;
-std::unordered_map<uint32_t, target::dynamic_bitset> NegativeCampaigns;
+using PadBitsetNumbers = CountedHashMap<uint32_t, uint32_t, MemoryCategory::PadBitsets>;
+PadBitsetNumbers PositiveCampaigns;
+PadBitsetNumbers NegativeCampaigns;
+
+// Own bitsets of pads that are filled by buildTargetings() and buildFilters()
+// and then moved to TargetingBitsetBank by internTargetingBitsets().
+using PadBitsetMap = CountedHashMap<uint32_t, target::dynamic_bitset, MemoryCategory::PadBitsets>;
+static PadBitsetMap PadPositiveBitsets;
+static PadBitsetMap PadNegativeBitsets;
+// pad_id -> filter bitset for pads that have filters but no negative targetings.
+// Their negative bitset is exactly the filter one, there's no need to copy it.
+static CountedHashMap<uint32_t, const target::dynamic_bitset*, MemoryCategory::PadBitsets> PadFilterOnlyBitsets;
 
-//  pad_id -> set of banners IDs that:
+//  pad_id -> sorted positions in IndexedBanners of banners that:
 // 1) are filtered on this pad (directly) by pad's filters.
 // AND
 // 2) belongs to campaign that is not filtered on this pad (directly).
 // Note that if all banners of a campaign are filtered on a pad then the entire campaign
 // is crossed out by index and there's no need to store all its filtered banners.
-std::unordered_map<uint32_t, std::unordered_set<uint32_t>> FilteredBanners;
+CountedHashMap<uint32_t, FilteredBannerList, MemoryCategory::FilteredBanners> FilteredBanners;
 
-// pad effective group id -> array of banners that are filtered on this pad
-// (including ancestor's filters) and are not belong to fully filtered campaigns.
+// pad effective group id -> sorted positions in IndexedBanners of banners that
+// are filtered on this pad (including ancestor's filters) and are not belong to
+// fully filtered campaigns.
 // Actually it is joined FilteredBanners by all pad's ancestors and the pad itself.
-std::unordered_map<uint32_t, std::unordered_set<uint32_t>> GroupCumulativeFilteredBanners;
+// Groups without filtered banners are absent.
+CountedHashMap<uint32_t, GroupFilteredBannerList, MemoryCategory::GroupFilteredBanners> GroupCumulativeFilteredBanners;
+
+// Effective pads groups: hash of effective pads (see effectivePadsHash()) -> IDs of
+// groups with that hash, and group ID -> IDs of pads of the group.
+// The hash is strong, so there's one group per hash unless it collides.
+// They are kept after the build, so targeting updates can regroup pads.
+static CountedHashMap<uint64_t, GroupPadList, MemoryCategory::EffectivePadsGroups> GroupsByHash;
+static CountedHashMap<uint32_t, GroupPadList, MemoryCategory::EffectivePadsGroups> GroupMembers;
+
+// What a targeting update affects: campaign ID -> position in IndexedCampaigns,
+// package / user ID -> positions of its campaigns (campaigns of child users are
+// campaigns of the user too), pad_id -> count of targetings of the pad in Db.
+static CountedHashMap<uint32_t, uint32_t, MemoryCategory::UpdateMaps> CampaignPositions;
+static CountedHashMap<uint32_t, CampaignPositionList, MemoryCategory::UpdateMaps> PackageCampaigns;
+static CountedHashMap<uint32_t, CampaignPositionList, MemoryCategory::UpdateMaps> UserCampaigns;
+static CountedHashMap<uint32_t, uint32_t, MemoryCategory::UpdateMaps> PadTargetingCounts;
+
+// Memory budget of campaignsByPad() result cache of every index version.
+// The mutex orders budget changes with publishing, so a version that is being
+// published doesn't miss a change.
+static std::atomic<size_t> CampaignsCacheBudget{0};
+static std::mutex CampaignsCacheBudgetMutex;
+
+// The published index version, see IndexVersion.
+static std::atomic<const IndexVersion*> CurrentIndex{nullptr};
+const uint32_t DenseIndex::NO_POSITION;
+// Whether hash map parts of the index are built (they are absent if the index
+// is loaded from a snapshot), targeting updates need them.
+static bool HashIndexBuilt = false;
+// Whether targeting updates changed effective pads or groups since PadGraph was built.
+static bool PadGraphIsStale = false;
+// Whether the published version is built by this module from the current hash map
+// parts and materialize settings, so publishIndexUpdates() may patch it (see
+// patchIndexVersion()) while groups are not changed.
+static bool IndexVersionIsPatchable = false;
+// Number in TargetingBitsetBank -> number in the bitset bank of the published dense
+// index (NO_POSITION if it's absent there), count of bitsets in that bank and count
+// of them after the last full build.
+static std::vector<uint32_t> DenseBitsetNumbers;
+static uint32_t DenseBitsetCount = 0;
+static uint32_t DenseBitsetsOfBuild = 0;
+// IDs of pads whose targeting bitsets are changed since the version is published.
+static std::vector<uint32_t> ChangedBitsetPads;
+// Serializes builds, updates and publishing of index versions.
+static std::mutex IndexWriterMutex;
+// Count of threads that build the index (zero for hardware concurrency)
+// and the pool of them.
+static size_t IndexBuildThreads = 0;
+static std::unique_ptr<CThreadPool> IndexBuildPool;
+// Which groups are materialized in next index versions, and query counts of pads for that.
+static MaterializeSettings MaterializeThresholds;
+static std::unordered_map<uint32_t, uint64_t> PadQueryCounts;
 
 struct PadReoder
 {
@@ -48,186 +138,431 @@ struct PadReoder
     }
 };
 
-// fill PositiveCampaigns and NegativeCampaigns by all targetings.
+// Pool of threads that build the index.
+static CThreadPool& buildPool()
+{
+    size_t sThreads = IndexBuildThreads;
+    if (0 == sThreads)
+        sThreads = std::max<size_t>(1, std::thread::hardware_concurrency());
+    if (!IndexBuildPool || IndexBuildPool->Threads() != sThreads)
+        IndexBuildPool.reset(new CThreadPool(sThreads));
+    return *IndexBuildPool;
+}
+
+// Fill bitsets of pads by sorted pad/campaign pairs: bits of the campaigns are set
+// in bitsets of all zeros, or reset in bitsets of all ones if aNegative.
+// Map entries are created first, then pads are filled in parallel, every pad by one thread.
+static void fillPadBitsets(CThreadPool& aPool, const std::vector<PadReoder>& aPairs, bool aNegative,
+                           PadBitsetMap& aBitsets)
+{
+    // Bitset of every pad and position of its first pair.
+    std::vector<target::dynamic_bitset*> sPadBitsets;
+    std::vector<size_t> sPadStarts;
+    for (size_t i = 0; i < aPairs.size(); i++)
+    {
+        if (0 != i && aPairs[i].m_PadId == aPairs[i - 1].m_PadId)
+            continue;
+        sPadBitsets.push_back(&aBitsets[aPairs[i].m_PadId]);
+        sPadStarts.push_back(i);
+    }
+    sPadStarts.push_back(aPairs.size());
+
+    aPool.ParallelFor(0, sPadBitsets.size(), 64, [&](size_t aFirst, size_t aLast)
+    {
+        for (size_t sPad = aFirst; sPad < aLast; sPad++)
+        {
+            target::dynamic_bitset& sBitset = *sPadBitsets[sPad];
+            sBitset.resize(IndexedCampaigns.size(), aNegative);
+            for (size_t i = sPadStarts[sPad]; i < sPadStarts[sPad + 1]; i++)
+                sBitset.set(aPairs[i].m_CampaignPos, !aNegative);
+        }
+    });
+}
+
+// fill PadPositiveBitsets and PadNegativeBitsets by all targetings.
 static void buildTargetings()
 {
+    CThreadPool& sPool = buildPool();
     std::vector<PadReoder> sPositive;
     std::vector<PadReoder> sNegative;
     {
-        CTitle title("Indexing: Collecting targeted pad/campaign pairs");
+        CParallelTitle title(sPool, "Indexing: Collecting targeted pad/campaign pairs");
+        CampaignPositions.clear();
+        PackageCampaigns.clear();
+        UserCampaigns.clear();
+        PadTargetingCounts.clear();
 
+        std::vector<const Campaign*> sCampaigns(IndexedCampaigns.size());
         for (size_t i = 0; i < IndexedCampaigns.size(); i++)
         {
             Campaign& sCamp = Campaigns[IndexedCampaigns[i].m_CampaignId];
-            bool sHasPositiveTargetings = false;
-            bool sHasPositivePackageTargetings = false;
-            bool sHasPositiveUserTargetings = false;
+            sCampaigns[i] = &sCamp;
+            CampaignPositions[sCamp.m_Id] = (uint32_t)i;
+            if (sCamp.m_Package != nullptr)
+                PackageCampaigns[sCamp.m_PackageId].push_back((uint32_t)i);
+            for (User* sUser = sCamp.m_User; sUser != nullptr; sUser = sUser->m_Parent)
+                UserCampaigns[sUser->m_Id].push_back((uint32_t)i);
+        }
 
-            for (Pad* sPad : sCamp.m_PositiveTargetingPad)
+        // Every chunk of campaigns collects its own pairs, they are joined in order of chunks.
+        const size_t CAMPAIGNS_PER_CHUNK = 256;
+        size_t sChunks = (sCampaigns.size() + CAMPAIGNS_PER_CHUNK - 1) / CAMPAIGNS_PER_CHUNK;
+        std::vector<std::vector<PadReoder>> sChunkPositive(sChunks), sChunkNegative(sChunks);
+        sPool.ParallelFor(0, sCampaigns.size(), CAMPAIGNS_PER_CHUNK, [&](size_t aFirst, size_t aLast)
+        {
+            std::vector<PadReoder>& sChunkPos = sChunkPositive[aFirst / CAMPAIGNS_PER_CHUNK];
+            std::vector<PadReoder>& sChunkNeg = sChunkNegative[aFirst / CAMPAIGNS_PER_CHUNK];
+            for (size_t i = aFirst; i < aLast; i++)
             {
-                sPositive.emplace_back(sPad->m_Id, i);
-                sHasPositiveTargetings = true;
-            }
-            for (Pad* sPad : sCamp.m_NegatineTargetingPad)
-                sNegative.emplace_back(sPad->m_Id, i);
+                const Campaign& sCamp = *sCampaigns[i];
+                bool sHasPositiveTargetings = false;
+                bool sHasPositivePackageTargetings = false;
+                bool sHasPositiveUserTargetings = false;
 
-            if (sCamp.m_Package != nullptr)
-            {
-                for (Pad* sPad : sCamp.m_Package->m_PositiveTargetingPad)
+                for (Pad* sPad : sCamp.m_PositiveTargetingPad)
                 {
-                    sPositive.emplace_back(sPad->m_Id, i);
-                    sHasPositivePackageTargetings = true;
+                    sChunkPos.emplace_back(sPad->m_Id, i);
+                    sHasPositiveTargetings = true;
                 }
-                for (Pad* sPad : sCamp.m_Package->m_NegatineTargetingPad)
-                    sNegative.emplace_back(sPad->m_Id, i);
-            }
+                for (Pad* sPad : sCamp.m_NegatineTargetingPad)
+                    sChunkNeg.emplace_back(sPad->m_Id, i);
 
-            User* sUser = sCamp.m_User;
-            while (sUser != nullptr)
-            {
-                for (Pad* sPad : sUser->m_PositiveTargetingPad)
+                if (sCamp.m_Package != nullptr)
                 {
-                    sPositive.emplace_back(sPad->m_Id, i);
-                    sHasPositiveUserTargetings = true;
+                    for (Pad* sPad : sCamp.m_Package->m_PositiveTargetingPad)
+                    {
+                        sChunkPos.emplace_back(sPad->m_Id, i);
+                        sHasPositivePackageTargetings = true;
+                    }
+                    for (Pad* sPad : sCamp.m_Package->m_NegatineTargetingPad)
+                        sChunkNeg.emplace_back(sPad->m_Id, i);
                 }
-                for (Pad* sPad : sUser->m_NegatineTargetingPad)
-                    sNegative.emplace_back(sPad->m_Id, i);
 
-                sUser = sUser->m_Parent;
-            }
+                for (const User* sUser = sCamp.m_User; sUser != nullptr; sUser = sUser->m_Parent)
+                {
+                    for (Pad* sPad : sUser->m_PositiveTargetingPad)
+                    {
+                        sChunkPos.emplace_back(sPad->m_Id, i);
+                        sHasPositiveUserTargetings = true;
+                    }
+                    for (Pad* sPad : sUser->m_NegatineTargetingPad)
+                        sChunkNeg.emplace_back(sPad->m_Id, i);
+                }
 
-            check(sHasPositiveTargetings != sHasPositivePackageTargetings, "This case will work incorrect in this test");
-            check(!sHasPositiveUserTargetings, "This case will work incorrect in this test");
+                check(sHasPositiveTargetings != sHasPositivePackageTargetings, "This case will work incorrect in this test");
+                check(!sHasPositiveUserTargetings, "This case will work incorrect in this test");
+            }
+        });
+        for (size_t i = 0; i < sChunks; i++)
+        {
+            sPositive.insert(sPositive.end(), sChunkPositive[i].begin(), sChunkPositive[i].end());
+            sNegative.insert(sNegative.end(), sChunkNegative[i].begin(), sChunkNegative[i].end());
         }
-        std::sort(sPositive.begin(), sPositive.end());
-        std::sort(sNegative.begin(), sNegative.end());
+
+        // Targetings of all owners, including ones without indexed campaigns.
+        auto sCountTargetings = [](const TargetingPadList& aPositive, const TargetingPadList& aNegative)
+        {
+            for (Pad* sPad : aPositive)
+                PadTargetingCounts[sPad->m_Id]++;
+            for (Pad* sPad : aNegative)
+                PadTargetingCounts[sPad->m_Id]++;
+        };
+        for (const auto& sPair : Campaigns)
+            sCountTargetings(sPair.second.m_PositiveTargetingPad, sPair.second.m_NegatineTargetingPad);
+        for (const auto& sPair : Packages)
+            sCountTargetings(sPair.second.m_PositiveTargetingPad, sPair.second.m_NegatineTargetingPad);
+        for (const auto& sPair : Users)
+            sCountTargetings(sPair.second.m_PositiveTargetingPad, sPair.second.m_NegatineTargetingPad);
+
+        parallelSort(sPool, sPositive);
+        parallelSort(sPool, sNegative);
     }
 
     std::cout << "Total positive : " << sPositive.size() << std::endl;
     std::cout << "Total negative : " << sNegative.size() << std::endl;
 
     {
-        CTitle title("Indexing: Filling targeting bitsets");
-        uint32_t sLastPadId = 0;
-        target::dynamic_bitset* sCurrentPadBitset = nullptr;
-        for (const PadReoder& sPair : sPositive)
-        {
-            if (sLastPadId != sPair.m_PadId)
-            {
-                sLastPadId = sPair.m_PadId;
-                sCurrentPadBitset = &PositiveCampaigns[sPair.m_PadId];
-                sCurrentPadBitset->resize(IndexedCampaigns.size(), false);
-            }
-            sCurrentPadBitset->set(sPair.m_CampaignPos);
-        }
-        for (const PadReoder& sPair : sNegative)
-        {
-            if (sLastPadId != sPair.m_PadId)
-            {
-                sLastPadId = sPair.m_PadId;
-                sCurrentPadBitset = &NegativeCampaigns[sPair.m_PadId];
-                sCurrentPadBitset->resize(IndexedCampaigns.size(), true);
-            }
-            sCurrentPadBitset->reset(sPair.m_CampaignPos);
-        }
+        CParallelTitle title(sPool, "Indexing: Filling targeting bitsets");
+        fillPadBitsets(sPool, sPositive, false, PadPositiveBitsets);
+        fillPadBitsets(sPool, sNegative, true, PadNegativeBitsets);
     }
 }
 
-// fill NegativeCampaigns and FilteredBanners by all filters.
+// fill PadNegativeBitsets, PadFilterOnlyBitsets and FilteredBanners by all filters.
 static void buildFilters()
 {
+    CThreadPool& sPool = buildPool();
     {
-        CTitle title("Indexing: Adding fully filtered campaigns");
+        CParallelTitle title(sPool, "Indexing: Adding fully filtered campaigns");
+        // Negative bitsets of pads that have negative targetings are restricted in parallel.
+        std::vector<std::pair<target::dynamic_bitset*, const target::dynamic_bitset*>> sRestricted;
         for (auto& sPair : PadFilters)
         {
             uint32_t sPadId = sPair.first;
             PadFilter& sPadFilter = sPair.second;
 
-            target::dynamic_bitset& sCurrentPadBitset = NegativeCampaigns[sPadId];
-            if (sCurrentPadBitset.empty())
-                sCurrentPadBitset = *sPadFilter.m_Any;
+            auto sItr = PadNegativeBitsets.find(sPadId);
+            if (sItr == PadNegativeBitsets.end())
+                PadFilterOnlyBitsets[sPadId] = sPadFilter.m_Any;
             else
-                sCurrentPadBitset &= *sPadFilter.m_Any;
+                sRestricted.emplace_back(&sItr->second, sPadFilter.m_Any);
         }
+        sPool.ParallelFor(0, sRestricted.size(), 64, [&](size_t aFirst, size_t aLast)
+        {
+            for (size_t i = aFirst; i < aLast; i++)
+                *sRestricted[i].first &= *sRestricted[i].second;
+        });
     }
 
     {
-        CTitle title("Indexing: Adding filtered banners of partially filtered campaigns");
-        for (auto& sPair : PadFilters)
-        {
-            uint32_t sPadId = sPair.first;
-            PadFilter& sPadFilter = sPair.second;
-            std::unordered_set<uint32_t>* sFilteredBannerd = nullptr;
+        CParallelTitle title(sPool, "Indexing: Adding filtered banners of partially filtered campaigns");
+        FilteredBanners.clear();
+        std::vector<std::pair<uint32_t, const PadFilter*>> sFilters;
+        for (const auto& sPair : PadFilters)
+            sFilters.emplace_back(sPair.first, &sPair.second);
+        std::vector<FilteredBannerList> sFilteredBanners(sFilters.size());
 
-            // Temporarily exclude fully passing campaigns. (1)
-            *sPadFilter.m_Any -= *sPadFilter.m_All;
-            // Now sPadFilter.m_Any reveals campaigns that have some banners that
-            // passes filters and some banners that fails filters.
-
-            for (size_t i = sPadFilter.m_Any->find_first();
-                 i != sPadFilter.m_Any->npos;
-                 i = sPadFilter.m_Any->find_next(i))
+        sPool.ParallelFor(0, sFilters.size(), 16, [&](size_t aFirst, size_t aLast)
+        {
+            target::dynamic_bitset sPartial;
+            for (size_t sPad = aFirst; sPad < aLast; sPad++)
             {
-                for (size_t j = 0; j < IndexedCampaigns[i].m_BannerCount; j++)
+                const PadFilter& sPadFilter = *sFilters[sPad].second;
+                // Campaigns that have some banners that passes filters and some
+                // banners that fails filters. Filter bitsets may be shared by pads,
+                // so they are not modified.
+                sPartial = *sPadFilter.m_Any;
+                sPartial -= *sPadFilter.m_All;
+
+                // Campaigns and their banners are visited in order of positions,
+                // so the positions are appended already sorted.
+                FilteredBannerList& sFilteredBannerd = sFilteredBanners[sPad];
+                for (size_t i = sPartial.find_first(); i != sPartial.npos; i = sPartial.find_next(i))
                 {
-                    size_t k = IndexedCampaigns[i].m_FirstBannerPosition + j;
-                    if (!sPadFilter.m_Banners->test(k))
+                    for (size_t j = 0; j < IndexedCampaigns[i].m_BannerCount; j++)
                     {
-                        if (nullptr == sFilteredBannerd)
-                            sFilteredBannerd = &FilteredBanners[sPadId];
-                        sFilteredBannerd->insert(IndexedBanners[k].m_BannerId);
+                        size_t k = IndexedCampaigns[i].m_FirstBannerPosition + j;
+                        if (!sPadFilter.m_Banners->test(k))
+                            sFilteredBannerd.push_back((uint32_t)k);
                     }
                 }
             }
+        });
+        for (size_t sPad = 0; sPad < sFilters.size(); sPad++)
+        {
+            if (!sFilteredBanners[sPad].empty())
+                FilteredBanners[sFilters[sPad].first] = std::move(sFilteredBanners[sPad]);
+        }
+    }
+}
 
-            // Restore back. (1)
-            *sPadFilter.m_Any |= *sPadFilter.m_All;
+// Find a bitset in TargetingBitsetBank or add it there, and add a reference to it.
+// Returns number of the bitset in the bank.
+template <class Bitset>
+static uint32_t internTargetingBitset(Bitset&& aBitset)
+{
+    TargetingBitsetNumbers& sCandidates = TargetingBitsetsByHash[aBitset.hash()];
+    for (uint32_t sNumber : sCandidates)
+    {
+        if (TargetingBitsetBank[sNumber] == aBitset)
+        {
+            TargetingBitsetRefs[sNumber]++;
+            return sNumber;
         }
     }
+    uint32_t sNumber;
+    if (!FreeTargetingBitsets.empty())
+    {
+        sNumber = FreeTargetingBitsets.back();
+        FreeTargetingBitsets.pop_back();
+        TargetingBitsetBank[sNumber] = std::forward<Bitset>(aBitset);
+    }
+    else
+    {
+        sNumber = (uint32_t)TargetingBitsetBank.size();
+        TargetingBitsetBank.push_back(std::forward<Bitset>(aBitset));
+        TargetingBitsetRefs.push_back(0);
+    }
+    TargetingBitsetRefs[sNumber] = 1;
+    sCandidates.push_back(sNumber);
+    return sNumber;
 }
 
-// Set m_EffectivePads, m_EffectivePadsAreBuilt members for given pad.
-static void buildEffectivePads(Pad& aPad)
+// Remove a reference to a bitset of TargetingBitsetBank, the bitset is freed
+// when there are no references.
+static void releaseTargetingBitset(uint32_t aNumber)
 {
-    if (aPad.m_EffectivePadsAreBuilt)
+    if (--TargetingBitsetRefs[aNumber] != 0)
         return;
+    target::dynamic_bitset& sBitset = TargetingBitsetBank[aNumber];
+    auto sItr = TargetingBitsetsByHash.find(sBitset.hash());
+    TargetingBitsetNumbers& sCandidates = sItr->second;
+    sCandidates.erase(std::find(sCandidates.begin(), sCandidates.end(), aNumber));
+    if (sCandidates.empty())
+        TargetingBitsetsByHash.erase(sItr);
+    sBitset = target::dynamic_bitset();
+    FreeTargetingBitsets.push_back(aNumber);
+    // The number may be reused for another bitset.
+    if (aNumber < DenseBitsetNumbers.size())
+        DenseBitsetNumbers[aNumber] = DenseIndex::NO_POSITION;
+}
 
-    if (aPad.m_HasTargetingsOrFilters)
-        aPad.m_EffectivePads.push_back(aPad.m_Id);
+// Count of bitsets in TargetingBitsetBank that are in use.
+static size_t targetingBitsetCount()
+{
+    return TargetingBitsetBank.size() - FreeTargetingBitsets.size();
+}
 
-    for (Pad* sParent : aPad.m_DirectParents)
+// Move bitsets of pads to TargetingBitsetBank, storing identical bitsets once,
+// and fill PositiveCampaigns and NegativeCampaigns.
+static void internTargetingBitsets()
+{
     {
-        buildEffectivePads(*sParent);
-        // Append effective pad IDs of that parent.
-        aPad.m_EffectivePads.insert(aPad.m_EffectivePads.end(),
-                                    sParent->m_EffectivePads.begin(),
-                                    sParent->m_EffectivePads.end());
+        CTitle title("Indexing: Intern targeting bitsets");
+        TargetingBitsetBank.clear();
+        TargetingBitsetRefs.clear();
+        FreeTargetingBitsets.clear();
+        TargetingBitsetsByHash.clear();
+        PositiveCampaigns.clear();
+        NegativeCampaigns.clear();
+        PositiveCampaigns.reserve(PadPositiveBitsets.size());
+        NegativeCampaigns.reserve(PadNegativeBitsets.size() + PadFilterOnlyBitsets.size());
+
+        for (auto& sPair : PadPositiveBitsets)
+            PositiveCampaigns[sPair.first] = internTargetingBitset(std::move(sPair.second));
+        for (auto& sPair : PadNegativeBitsets)
+            NegativeCampaigns[sPair.first] = internTargetingBitset(std::move(sPair.second));
+        for (auto& sPair : PadFilterOnlyBitsets)
+            NegativeCampaigns[sPair.first] = internTargetingBitset(*sPair.second);
+        PadPositiveBitsets.clear();
+        PadNegativeBitsets.clear();
+        PadFilterOnlyBitsets.clear();
     }
 
-    // Sort and remove duplicates.
-    std::sort(aPad.m_EffectivePads.begin(), aPad.m_EffectivePads.end());
-    aPad.m_EffectivePads.erase(std::unique(aPad.m_EffectivePads.begin(),
-                                           aPad.m_EffectivePads.end()),
-                               aPad.m_EffectivePads.end());
+    std::cout << "Targeting bitsets: pad bitsets / distinct: "
+              << PositiveCampaigns.size() + NegativeCampaigns.size()
+              << " / " << targetingBitsetCount() << std::endl;
+}
 
+// Set m_EffectivePads, m_EffectivePadsAreBuilt members for given pad,
+// effective pads of its parents must be built. aMerged and aNext are scratch
+// buffers of the caller, so their capacity is reused from pad to pad.
+static void mergeEffectivePads(Pad& aPad, std::vector<uint32_t>& aMerged, std::vector<uint32_t>& aNext)
+{
+    // Effective pads of parents are sorted, so they are merged into a sorted
+    // union one by one.
+    aMerged.clear();
+    if (aPad.m_HasTargetingsOrFilters)
+        aMerged.push_back(aPad.m_Id);
+    for (const Pad* sParent : aPad.m_DirectParents)
+    {
+        const EffectivePadList& sParentPads = sParent->m_EffectivePads;
+        if (aMerged.empty())
+        {
+            aMerged.assign(sParentPads.begin(), sParentPads.end());
+            continue;
+        }
+        aNext.clear();
+        std::set_union(aMerged.begin(), aMerged.end(), sParentPads.begin(), sParentPads.end(),
+                       std::back_inserter(aNext));
+        aMerged.swap(aNext);
+    }
+    aPad.m_EffectivePads.assign(aMerged.begin(), aMerged.end());
     aPad.m_EffectivePadsAreBuilt = true;
 }
 
+void collectEffectivePads(const std::vector<Pad*>& aPads)
+{
+    // Depth-first walk from every pad up to its ancestors, without recursion:
+    // pads whose parents are being built and the next parent to visit.
+    // A pad is built after all its parents, i.e. in topological order.
+    std::vector<std::pair<Pad*, size_t>> sStack;
+    std::vector<uint32_t> sMerged;
+    std::vector<uint32_t> sNext;
+    for (Pad* sStart : aPads)
+    {
+        if (sStart->m_EffectivePadsAreBuilt)
+            continue;
+        sStart->m_EffectivePadsAreBeingBuilt = true;
+        sStack.emplace_back(sStart, 0);
+        while (!sStack.empty())
+        {
+            Pad& sPad = *sStack.back().first;
+            size_t& sNextParent = sStack.back().second;
+            while (sNextParent < sPad.m_DirectParents.size() &&
+                   sPad.m_DirectParents[sNextParent]->m_EffectivePadsAreBuilt)
+                sNextParent++;
+            if (sNextParent == sPad.m_DirectParents.size())
+            {
+                mergeEffectivePads(sPad, sMerged, sNext);
+                sPad.m_EffectivePadsAreBeingBuilt = false;
+                sStack.pop_back();
+                continue;
+            }
+            // A parent that is on the stack is an ancestor of itself.
+            Pad* sParent = sPad.m_DirectParents[sNextParent];
+            check(!sParent->m_EffectivePadsAreBeingBuilt, "Pad relations have a cycle");
+            sParent->m_EffectivePadsAreBeingBuilt = true;
+            sStack.emplace_back(sParent, 0);
+        }
+    }
+}
+
+uint64_t effectivePadsHash(const EffectivePadList& aEffectivePads)
+{
+    // Multiply-xorshift of every ID, then the final mix of MurmurHash3.
+    uint64_t sHash = 0x9E3779B97F4A7C15ull ^ aEffectivePads.size();
+    for (uint32_t sId : aEffectivePads)
+    {
+        sHash = (sHash ^ sId) * 0xFF51AFD7ED558CCDull;
+        sHash ^= sHash >> 32;
+    }
+    sHash ^= sHash >> 33;
+    sHash *= 0xC4CEB9FE1A85EC53ull;
+    sHash ^= sHash >> 33;
+    return sHash;
+}
+
+// Set m_EffectivePadsGroupId of a pad: find a group with identical effective pads
+// in GroupsByHash or start a new group, and add the pad to GroupMembers.
+// aHash is effectivePadsHash() of the pad. Returns true if a new group is started.
+static bool joinGroup(Pad& aPad, uint64_t aHash)
+{
+    // Pads with equal hashes have identical effective pads, unless the hash collides.
+    GroupPadList& sPossiblyIdenticalGroups = GroupsByHash[aHash];
+    for (uint32_t sGroupCandidateId : sPossiblyIdenticalGroups)
+    {
+        // ID of a group is ID of one of its pads.
+        const Pad& sCandidate = Pads[sGroupCandidateId];
+        if (aPad.m_EffectivePads != sCandidate.m_EffectivePads)
+            continue;
+        aPad.m_EffectivePadsGroupId = sGroupCandidateId;
+        GroupMembers[sGroupCandidateId].push_back(aPad.m_Id);
+        return false;
+    }
+    aPad.m_EffectivePadsGroupId = aPad.m_Id;
+    sPossiblyIdenticalGroups.push_back(aPad.m_Id);
+    GroupMembers[aPad.m_Id].push_back(aPad.m_Id);
+    return true;
+}
+
 // Set m_EffectivePads, m_EffectivePadsAreBuilt and m_EffectivePadsGroupId members for all pads.
 static void buildEffectivePads()
 {
     size_t sNumberOfPads = Pads.size();
     size_t sNumberOfEmptyPads = 0; // Pads with empty m_EffectivePads vector
+    std::vector<Pad*> sPads;
+    sPads.reserve(Pads.size());
+    for (auto& sPair : Pads)
+        sPads.push_back(&sPair.second);
 
     {
         // Set m_EffectivePads, m_EffectivePadsAreBuilt
         CTitle title("Indexing: Collect effective pads");
-        for (auto& sPair : Pads)
+        collectEffectivePads(sPads);
+        for (const Pad* sPad : sPads)
         {
-            //uint32_t sPadId = sPair.first;
-            Pad& sPad = sPair.second;
-            buildEffectivePads(sPad);
-            if (sPad.m_EffectivePads.empty())
+            if (sPad->m_EffectivePads.empty())
                 sNumberOfEmptyPads++;
         }
     }
@@ -239,45 +574,21 @@ static void buildEffectivePads()
     size_t sNumberOfEmptyGroups = 0; // Groups with empty m_EffectivePads vector
     {
         // Set m_EffectivePadsGroupId
-        CTitle title("Indexing: Group effective pads");
-        // For each pad let's calculate a hash of all its effective pads.
-        // For each hash let's store pad IDs that have this hash.
-        std::unordered_map<uint32_t, std::vector<uint32_t>> sPadsByHash;
-
-        for (auto& sPair : Pads)
+        CThreadPool& sPool = buildPool();
+        CParallelTitle title(sPool, "Indexing: Group effective pads");
+        GroupsByHash.clear();
+        GroupMembers.clear();
+        std::vector<uint64_t> sHashes(sPads.size());
+        sPool.ParallelFor(0, sPads.size(), 1024, [&](size_t aFirst, size_t aLast)
         {
-            uint32_t sPadId = sPair.first;
-            Pad& sPad = sPair.second;
-            uint32_t sHash = 0;
-            for (uint32_t sId : sPad.m_EffectivePads)
-                sHash ^= sId;
-
-            std::vector<uint32_t>& sPossiblyIdenticalPads = sPadsByHash[sHash];
-            bool FoundIdentical = false;
-            for (uint32_t sGroupCandidateId : sPossiblyIdenticalPads)
-            {
-                Pad& sCandidate = Pads[sGroupCandidateId];
-                if (sPad.m_EffectivePads.size() != sCandidate.m_EffectivePads.size())
-                    continue;
-                bool sEqual = true;
-                for (size_t i = 0; i < sPad.m_EffectivePads.size(); i++)
-                {
-                    if (sPad.m_EffectivePads[i] != sCandidate.m_EffectivePads[i])
-                    {
-                        sEqual = false;
-                        break;
-                    }
-                }
-                if (!sEqual)
-                    continue;
-                FoundIdentical = true;
-                sPad.m_EffectivePadsGroupId = sGroupCandidateId;
-                break;
-            }
-            if (!FoundIdentical)
+            for (size_t i = aFirst; i < aLast; i++)
+                sHashes[i] = effectivePadsHash(sPads[i]->m_EffectivePads);
+        });
+        for (size_t i = 0; i < sPads.size(); i++)
+        {
+            Pad& sPad = *sPads[i];
+            if (joinGroup(sPad, sHashes[i]))
             {
-                sPad.m_EffectivePadsGroupId = sPadId;
-                sPossiblyIdenticalPads.push_back(sPadId);
                 sNumberOfGroups++;
                 if (sPad.m_EffectivePads.empty())
                     sNumberOfEmptyGroups++;
@@ -289,152 +600,1441 @@ static void buildEffectivePads()
               << sNumberOfGroups << " / " << sNumberOfEmptyGroups << std::endl;
 }
 
-// Fill GroupCumulativeFilteredBanners..
+// Collect sorted unique positions of banners that are filtered on any of given effective pads.
+template <class PadIds>
+static void collectCumulativeFilteredBanners(const PadIds& aEffectivePads, GroupFilteredBannerList& aResult)
+{
+    // Scratch of the thread, so merging doesn't reallocate for every group.
+    static thread_local std::vector<uint32_t> sBlockedBanners;
+    sBlockedBanners.clear();
+    size_t sSortedCount = 0;
+    for (uint32_t sFilteringPadId : aEffectivePads)
+    {
+        auto sItr = FilteredBanners.find(sFilteringPadId);
+        if (sItr == FilteredBanners.end())
+            continue;
+        // Merge the next sorted list into sorted head of the result.
+        sBlockedBanners.insert(sBlockedBanners.end(), sItr->second.begin(), sItr->second.end());
+        std::inplace_merge(sBlockedBanners.begin(), sBlockedBanners.begin() + sSortedCount,
+                           sBlockedBanners.end());
+        sSortedCount = sBlockedBanners.size();
+    }
+    sBlockedBanners.erase(std::unique(sBlockedBanners.begin(), sBlockedBanners.end()),
+                          sBlockedBanners.end());
+    aResult.assign(sBlockedBanners.begin(), sBlockedBanners.end());
+}
+
+// Fill GroupCumulativeFilteredBanners entry of a group by given effective pads of the group.
+static void buildGroupCumulativeFilteredBanners(uint32_t aGroupId, const EffectivePadList& aEffectivePads)
+{
+    GroupFilteredBannerList sBlockedBanners;
+    collectCumulativeFilteredBanners(aEffectivePads, sBlockedBanners);
+    if (!sBlockedBanners.empty())
+        GroupCumulativeFilteredBanners[aGroupId] = std::move(sBlockedBanners);
+}
+
+// Fill GroupCumulativeFilteredBanners, groups are merged in parallel.
 static void buildGroupCumulativeFilteredBanners()
 {
-    CTitle title("Indexing: Group cumulative filtered banners");
-    for (auto& sPair : Pads)
+    CThreadPool& sPool = buildPool();
+    CParallelTitle title(sPool, "Indexing: Group cumulative filtered banners");
+    GroupCumulativeFilteredBanners.clear();
+    // Positions in PadGraph of pads that give IDs to their groups.
+    std::vector<uint32_t> sGroups;
+    sGroups.reserve(GroupMembers.size());
+    for (uint32_t i = 0; i < PadGraph.Size(); i++)
+    {
+        if (PadGraph.GroupId(i) == PadGraph.PadId(i))
+            sGroups.push_back(i);
+    }
+    std::vector<GroupFilteredBannerList> sGroupBanners(sGroups.size());
+
+    sPool.ParallelFor(0, sGroups.size(), 64, [&](size_t aFirst, size_t aLast)
+    {
+        for (size_t i = aFirst; i < aLast; i++)
+            collectCumulativeFilteredBanners(PadGraph.EffectivePads(sGroups[i]), sGroupBanners[i]);
+    });
+    for (size_t i = 0; i < sGroups.size(); i++)
     {
-        uint32_t sPadId = sPair.first;
-        Pad& sPad = sPair.second;
-        if (GroupCumulativeFilteredBanners.find(sPadId) != GroupCumulativeFilteredBanners.end())
+        if (!sGroupBanners[i].empty())
+            GroupCumulativeFilteredBanners[PadGraph.PadId(sGroups[i])] = std::move(sGroupBanners[i]);
+    }
+}
+
+// Position of a pad in dense index, NO_POSITION if there's no such pad.
+static uint32_t densePadPosition(const DenseIndex& aIndex, uint32_t aPadId)
+{
+    if (!aIndex.m_PositionById.empty())
+        return aPadId < aIndex.m_PositionById.size() ? aIndex.m_PositionById[aPadId] : DenseIndex::NO_POSITION;
+    auto sItr = std::lower_bound(aIndex.m_PadIds.begin(), aIndex.m_PadIds.end(), aPadId);
+    if (sItr == aIndex.m_PadIds.end() || *sItr != aPadId)
+        return DenseIndex::NO_POSITION;
+    return (uint32_t)(sItr - aIndex.m_PadIds.begin());
+}
+
+// Number of a TargetingBitsetBank bitset in a dense bank of aWords words per
+// bitset (see DenseBitsetNumbers). The bitset is appended to the bank when it's
+// referenced for the first time, so bitsets of the same group are placed nearby,
+// and pads that share a bitset share the number.
+static uint32_t denseBitsetNumber(uint32_t aNumber, size_t aWords, std::vector<DenseIndex::word_t>& aBank)
+{
+    if (aNumber >= DenseBitsetNumbers.size())
+        DenseBitsetNumbers.resize(TargetingBitsetBank.size(), DenseIndex::NO_POSITION);
+    if (DenseBitsetNumbers[aNumber] != DenseIndex::NO_POSITION)
+        return DenseBitsetNumbers[aNumber];
+    const target::dynamic_bitset& sBitset = TargetingBitsetBank[aNumber];
+    aBank.insert(aBank.end(), sBitset.data(), sBitset.data() + aWords);
+    DenseBitsetNumbers[aNumber] = DenseBitsetCount;
+    return DenseBitsetCount++;
+}
+
+// Forget bitsets numbered from aCount on, which were appended to a bank that is
+// not published (see patchIndexVersion()).
+static void truncateDenseBitsets(uint32_t aCount)
+{
+    for (uint32_t& sNumber : DenseBitsetNumbers)
+    {
+        if (sNumber != DenseIndex::NO_POSITION && sNumber >= aCount)
+            sNumber = DenseIndex::NO_POSITION;
+    }
+    DenseBitsetCount = aCount;
+}
+
+// Fill dense layout of an index version.
+static void buildDenseIndex(DenseIndex& aIndex)
+{
+    {
+        CTitle title("Indexing: Build dense index");
+        aIndex.m_CampaignCount = IndexedCampaigns.size();
+        aIndex.m_BitsetWords = target::dynamic_bitset::words_count(IndexedCampaigns.size());
+
+        // Remap pad IDs, positions are the ones of PadGraph.
+        std::vector<uint32_t> sPadIds(PadGraph.PadIds().begin(), PadGraph.PadIds().end());
+        uint32_t sMaxId = sPadIds.empty() ? 0 : sPadIds.back();
+        // Direct table is used if it's not too sparse.
+        std::vector<uint32_t> sPositionById;
+        if (sMaxId / 4 <= sPadIds.size())
         {
-            // already caclulated
-            continue;
+            sPositionById.assign(size_t(sMaxId) + 1, DenseIndex::NO_POSITION);
+            for (size_t i = 0; i < sPadIds.size(); i++)
+                sPositionById[sPadIds[i]] = (uint32_t)i;
+        }
+
+        std::vector<DenseIndex::word_t> sBitsetBank;
+        DenseBitsetNumbers.assign(TargetingBitsetBank.size(), DenseIndex::NO_POSITION);
+        DenseBitsetCount = 0;
+        auto sBitsetNumber = [&](uint32_t aNumber) -> uint32_t
+        {
+            return denseBitsetNumber(aNumber, aIndex.m_BitsetWords, sBitsetBank);
+        };
+
+        // Group numbers and lists of group bitsets and banners.
+        std::unordered_map<uint32_t, uint32_t> sGroupNumbers;
+        std::vector<uint32_t> sPadGroups, sGroupIds;
+        std::vector<uint8_t> sPadIsLeaf;
+        std::vector<uint32_t> sGroupPositiveOffsets(1, 0), sGroupPositive;
+        std::vector<uint32_t> sGroupNegativeOffsets(1, 0), sGroupNegative;
+        std::vector<uint32_t> sGroupBannerOffsets(1, 0), sGroupBanners;
+        sPadGroups.reserve(sPadIds.size());
+        sPadIsLeaf.reserve(sPadIds.size());
+        for (uint32_t sPosition = 0; sPosition < sPadIds.size(); sPosition++)
+        {
+            uint32_t sGroupId = PadGraph.GroupId(sPosition);
+            sPadIsLeaf.push_back(PadGraph.Children(sPosition).empty() ? 1 : 0);
+            auto sInserted = sGroupNumbers.emplace(sGroupId, (uint32_t)sGroupIds.size());
+            sPadGroups.push_back(sInserted.first->second);
+            if (!sInserted.second)
+                continue;
+
+            // New group.
+            sGroupIds.push_back(sGroupId);
+            for (uint32_t sEffectivePadId : PadGraph.EffectivePads(sPosition))
+            {
+                auto sPosItr = PositiveCampaigns.find(sEffectivePadId);
+                if (sPosItr != PositiveCampaigns.end())
+                    sGroupPositive.push_back(sBitsetNumber(sPosItr->second));
+                auto sNegItr = NegativeCampaigns.find(sEffectivePadId);
+                if (sNegItr != NegativeCampaigns.end())
+                    sGroupNegative.push_back(sBitsetNumber(sNegItr->second));
+            }
+            sGroupPositiveOffsets.push_back((uint32_t)sGroupPositive.size());
+            sGroupNegativeOffsets.push_back((uint32_t)sGroupNegative.size());
+
+            auto sBanners = GroupCumulativeFilteredBanners.find(sGroupId);
+            if (sBanners != GroupCumulativeFilteredBanners.end())
+                sGroupBanners.insert(sGroupBanners.end(), sBanners->second.begin(), sBanners->second.end());
+            sGroupBannerOffsets.push_back((uint32_t)sGroupBanners.size());
         }
-        std::unordered_set<uint32_t>& sBlockedBanners = GroupCumulativeFilteredBanners[sPadId];
-        for (uint32_t sFilteringPadId : sPad.m_EffectivePads)
+
+        aIndex.m_BitsetBank = std::move(sBitsetBank);
+        aIndex.m_PadIds = std::move(sPadIds);
+        aIndex.m_PositionById = std::move(sPositionById);
+        aIndex.m_PadGroups = std::move(sPadGroups);
+        aIndex.m_PadIsLeaf = std::move(sPadIsLeaf);
+        aIndex.m_GroupIds = std::move(sGroupIds);
+        aIndex.m_GroupPositiveOffsets = std::move(sGroupPositiveOffsets);
+        aIndex.m_GroupPositive = std::move(sGroupPositive);
+        aIndex.m_GroupNegativeOffsets = std::move(sGroupNegativeOffsets);
+        aIndex.m_GroupNegative = std::move(sGroupNegative);
+        aIndex.m_GroupBannerOffsets = std::move(sGroupBannerOffsets);
+        aIndex.m_GroupBanners = std::move(sGroupBanners);
+        DenseBitsetsOfBuild = DenseBitsetCount;
+    }
+
+    std::cout << "Dense index: pads / groups / bitsets: " << aIndex.m_PadIds.size()
+              << " / " << aIndex.m_GroupIds.size() << " / " << DenseBitsetCount
+              << (aIndex.m_PositionById.empty() ? " (sparse pad IDs)" : "") << std::endl;
+}
+
+// Groups of a dense index to materialize by MaterializeThresholds:
+// group number -> number of the result or NO_POSITION. Returns count of results.
+static size_t chooseMaterializedGroups(const DenseIndex& aIndex, std::vector<uint32_t>& aResultNumbers)
+{
+    const MaterializeSettings& sSettings = MaterializeThresholds;
+    size_t sGroupCount = aIndex.m_GroupIds.size();
+    aResultNumbers.assign(sGroupCount, DenseIndex::NO_POSITION);
+    if (0 == sSettings.m_MinEffectivePads && 0 == sSettings.m_MinQueries)
+        return 0;
+
+    std::vector<uint64_t> sGroupQueries(sGroupCount, 0);
+    for (const auto& sPair : PadQueryCounts)
+    {
+        uint32_t sPosition = densePadPosition(aIndex, sPair.first);
+        if (sPosition != DenseIndex::NO_POSITION)
+            sGroupQueries[aIndex.m_PadGroups[sPosition]] += sPair.second;
+    }
+    // Pads of a group have the same effective pads.
+    std::vector<size_t> sGroupEffectivePads(sGroupCount);
+    for (uint32_t i = 0; i < aIndex.m_PadGroups.size(); i++)
+        sGroupEffectivePads[aIndex.m_PadGroups[i]] = PadGraph.EffectivePads(i).size();
+    std::vector<uint32_t> sCandidates;
+    for (uint32_t sGroup = 0; sGroup < sGroupCount; sGroup++)
+    {
+        if ((0 != sSettings.m_MinEffectivePads && sGroupEffectivePads[sGroup] >= sSettings.m_MinEffectivePads) ||
+            (0 != sSettings.m_MinQueries && sGroupQueries[sGroup] >= sSettings.m_MinQueries))
+            sCandidates.push_back(sGroup);
+    }
+    std::sort(sCandidates.begin(), sCandidates.end(), [&](uint32_t aLeft, uint32_t aRight)
+    {
+        if (sGroupQueries[aLeft] != sGroupQueries[aRight])
+            return sGroupQueries[aLeft] > sGroupQueries[aRight];
+        if (sGroupEffectivePads[aLeft] != sGroupEffectivePads[aRight])
+            return sGroupEffectivePads[aLeft] > sGroupEffectivePads[aRight];
+        return aLeft < aRight;
+    });
+    size_t sResultSize = aIndex.m_BitsetWords * sizeof(DenseIndex::word_t);
+    size_t sResults = 0 == sResultSize ? 0 : std::min(sCandidates.size(), sSettings.m_MaxBytes / sResultSize);
+    for (size_t i = 0; i < sResults; i++)
+        aResultNumbers[sCandidates[i]] = (uint32_t)i;
+    return sResults;
+}
+
+// Fill materialized results of the dense index.
+// Pads are walked in topological order, and OR of positive bitsets and AND of
+// negative bitsets of a group are derived from those of groups of the parents
+// of its first walked pad, plus bitsets of the pad itself, as effective pads of
+// a pad are the pad and effective pads of its parents. Partial results of a group
+// are freed as soon as all children of its pads are walked.
+static void materializeGroupResults(DenseIndex& aIndex)
+{
+    std::vector<uint32_t> sResultNumbers;
+    size_t sResultCount = chooseMaterializedGroups(aIndex, sResultNumbers);
+    if (0 == sResultCount)
+    {
+        aIndex.m_GroupResultNumbers = std::vector<uint32_t>();
+        aIndex.m_GroupResults = std::vector<DenseIndex::word_t>();
+        return;
+    }
+
+    size_t sMaxPartials = 0;
+    {
+        CTitle title("Indexing: Materialize group results");
+        size_t sPadCount = aIndex.m_PadIds.size();
+        size_t sGroupCount = aIndex.m_GroupIds.size();
+        size_t sWords = aIndex.m_BitsetWords;
+        // Positions of the dense index are the ones of PadGraph.
+        std::vector<uint32_t> sChildEdges(sGroupCount, 0);
+        for (uint32_t i = 0; i < sPadCount; i++)
+            sChildEdges[aIndex.m_PadGroups[i]] += (uint32_t)PadGraph.Children(i).size();
+
+        std::vector<DenseIndex::word_t> sResults(sResultCount * sWords);
+        std::vector<target::dynamic_bitset> sPartialOr(sGroupCount), sPartialAnd(sGroupCount);
+        std::vector<uint8_t> sGroupDone(sGroupCount, 0);
+        size_t sPartials = 0;
+        auto sReleaseGroup = [&](uint32_t aGroup)
         {
-            const std::unordered_set<uint32_t>& sBlockedDirectly = FilteredBanners[sFilteringPadId];
-            sBlockedBanners.insert(sBlockedDirectly.begin(), sBlockedDirectly.end());
+            sPartialOr[aGroup] = target::dynamic_bitset();
+            sPartialAnd[aGroup] = target::dynamic_bitset();
+            sPartials--;
+        };
+        auto sWalkPad = [&](uint32_t aPosition)
+        {
+            uint32_t sPadId = PadGraph.PadId(aPosition);
+            uint32_t sGroup = aIndex.m_PadGroups[aPosition];
+            bool sNewGroup = 0 == sGroupDone[sGroup];
+            if (sNewGroup)
+            {
+                target::dynamic_bitset& sOr = sPartialOr[sGroup];
+                target::dynamic_bitset& sAnd = sPartialAnd[sGroup];
+                sOr.resize(aIndex.m_CampaignCount, false);
+                sAnd.resize(aIndex.m_CampaignCount, true);
+                auto sPosItr = PositiveCampaigns.find(sPadId);
+                if (sPosItr != PositiveCampaigns.end())
+                    sOr |= TargetingBitsetBank[sPosItr->second];
+                auto sNegItr = NegativeCampaigns.find(sPadId);
+                if (sNegItr != NegativeCampaigns.end())
+                    sAnd &= TargetingBitsetBank[sNegItr->second];
+                for (uint32_t sParent : PadGraph.Parents(aPosition))
+                {
+                    uint32_t sParentGroup = aIndex.m_PadGroups[sParent];
+                    sOr |= sPartialOr[sParentGroup];
+                    sAnd &= sPartialAnd[sParentGroup];
+                }
+                sGroupDone[sGroup] = 1;
+                sMaxPartials = std::max(sMaxPartials, ++sPartials);
+                if (sResultNumbers[sGroup] != DenseIndex::NO_POSITION)
+                {
+                    target::dynamic_bitset sResult = sOr;
+                    sResult &= sAnd;
+                    std::copy(sResult.data(), sResult.data() + sWords, sResults.data() + sResultNumbers[sGroup] * sWords);
+                }
+            }
+            for (uint32_t sParent : PadGraph.Parents(aPosition))
+            {
+                uint32_t sParentGroup = aIndex.m_PadGroups[sParent];
+                if (0 == --sChildEdges[sParentGroup])
+                    sReleaseGroup(sParentGroup);
+            }
+            if (sNewGroup && 0 == sChildEdges[sGroup])
+                sReleaseGroup(sGroup);
+        };
+
+        // Depth-first walk from every pad up to its ancestors, like collectEffectivePads().
+        std::vector<uint8_t> sWalked(sPadCount, 0);
+        std::vector<std::pair<uint32_t, size_t>> sStack;
+        for (uint32_t sStart = 0; sStart < sPadCount; sStart++)
+        {
+            if (sWalked[sStart])
+                continue;
+            sStack.emplace_back(sStart, 0);
+            while (!sStack.empty())
+            {
+                uint32_t sPosition = sStack.back().first;
+                size_t& sNextParent = sStack.back().second;
+                CPadRange sParents = PadGraph.Parents(sPosition);
+                while (sNextParent < sParents.size() && sWalked[sParents[sNextParent]])
+                    sNextParent++;
+                if (sNextParent == sParents.size())
+                {
+                    sWalkPad(sPosition);
+                    sWalked[sPosition] = 1;
+                    sStack.pop_back();
+                    continue;
+                }
+                sStack.emplace_back(sParents[sNextParent], 0);
+            }
         }
+
+        aIndex.m_GroupResultNumbers = std::move(sResultNumbers);
+        aIndex.m_GroupResults = std::move(sResults);
     }
+
+    std::cout << "Materialized groups: " << sResultCount << " of " << aIndex.m_GroupIds.size()
+              << ", " << aIndex.m_GroupResults.mem_size() / 1024 << "KB"
+              << " (max partial results at once " << sMaxPartials << ")" << std::endl;
+}
+
+// Add one allocation of aBytes (if any) to memory usage.
+static void addMemSize(MemoryUsage& aUsage, size_t aBytes)
+{
+    if (0 == aBytes)
+        return;
+    aUsage.m_Bytes += aBytes;
+    aUsage.m_Allocations++;
+}
+
+// Memory of a vector of bitsets: the vector itself and words of every bitset.
+static MemoryUsage bitsetsMemUsage(const std::vector<target::dynamic_bitset>& aBitsets)
+{
+    MemoryUsage sUsage;
+    addMemSize(sUsage, aBitsets.capacity() * sizeof(target::dynamic_bitset));
+    for (const target::dynamic_bitset& sBitset : aBitsets)
+        addMemSize(sUsage, sBitset.mem_size());
+    return sUsage;
+}
+
+// Memory of arrays that an index version owns (none if it refers a mapped snapshot).
+static MemoryUsage indexVersionMemUsage(const IndexVersion& aIndex)
+{
+    const DenseIndex& sIndex = aIndex.m_Dense;
+    MemoryUsage sUsage;
+    for (size_t sBytes : {aIndex.m_Campaigns.mem_size(), aIndex.m_BannerIds.mem_size(),
+                          aIndex.m_BannerCampaignIds.mem_size(), aIndex.m_BannerUserIds.mem_size(), sIndex.m_BitsetBank.mem_size(),
+                          sIndex.m_PadIds.mem_size(), sIndex.m_PositionById.mem_size(), sIndex.m_PadGroups.mem_size(),
+                          sIndex.m_PadIsLeaf.mem_size(), sIndex.m_GroupIds.mem_size(),
+                          sIndex.m_GroupPositiveOffsets.mem_size(), sIndex.m_GroupPositive.mem_size(),
+                          sIndex.m_GroupNegativeOffsets.mem_size(), sIndex.m_GroupNegative.mem_size(),
+                          sIndex.m_GroupBannerOffsets.mem_size(), sIndex.m_GroupBanners.mem_size(),
+                          sIndex.m_GroupResultNumbers.mem_size(), sIndex.m_GroupResults.mem_size()})
+        addMemSize(sUsage, sBytes);
+    return sUsage;
+}
+
+// Effective pads group number of a pad in dense index, it's the key of the result cache.
+// Returns false for unknown pads, nothing is allowed on them.
+static bool findPadGroup(const DenseIndex& aIndex, uint32_t aPadId, uint32_t& aGroup)
+{
+    uint32_t sPosition = densePadPosition(aIndex, aPadId);
+    if (sPosition == DenseIndex::NO_POSITION)
+        return false;
+    aGroup = aIndex.m_PadGroups[sPosition];
+    return true;
+}
+
+// Materialized campaignsByPad() result of a group returned by findPadGroup(),
+// nullptr if it's not materialized.
+static const DenseIndex::word_t* materializedGroupResult(const DenseIndex& aIndex, uint32_t aGroup)
+{
+    if (aIndex.m_GroupResultNumbers.empty() || aIndex.m_GroupResultNumbers[aGroup] == DenseIndex::NO_POSITION)
+        return nullptr;
+    return aIndex.m_GroupResults.data() + size_t(aIndex.m_GroupResultNumbers[aGroup]) * aIndex.m_BitsetWords;
+}
+
+// Append words of positive and negative bitsets of a group returned by findPadGroup().
+// Positive targetings: every campaign that is allowed directly on the pad
+// or on any ancestor is allowed to show.
+// Negative targetings: every campaign that is not allowed directly on the pad
+// or on any ancestor is not allowed to show.
+static void collectGroupOperands(const DenseIndex& aIndex, uint32_t aGroup,
+                                 std::vector<const DenseIndex::word_t*>& aPositive,
+                                 std::vector<const DenseIndex::word_t*>& aNegative)
+{
+    const DenseIndex::word_t* sBank = aIndex.m_BitsetBank.data();
+    for (uint32_t i = aIndex.m_GroupPositiveOffsets[aGroup]; i < aIndex.m_GroupPositiveOffsets[aGroup + 1]; i++)
+        aPositive.push_back(sBank + aIndex.m_GroupPositive[i] * aIndex.m_BitsetWords);
+    for (uint32_t i = aIndex.m_GroupNegativeOffsets[aGroup]; i < aIndex.m_GroupNegativeOffsets[aGroup + 1]; i++)
+        aNegative.push_back(sBank + aIndex.m_GroupNegative[i] * aIndex.m_BitsetWords);
+}
+
+// campaignsByPad() in given index version. The result cache is used only by
+// queries (aUseCache), so its contents and counters reflect their traffic.
+static void campaignsByPad(const IndexVersion& aIndex, uint32_t aPadId, target::dynamic_bitset& aResult,
+                           bool aUseCache = true)
+{
+    const DenseIndex& sDense = aIndex.m_Dense;
+    uint32_t sGroup;
+    if (!findPadGroup(sDense, aPadId, sGroup))
+    {
+        aResult.resize(sDense.m_CampaignCount);
+        aResult.reset();
+        return;
+    }
+
+    const DenseIndex::word_t* sMaterialized = materializedGroupResult(sDense, sGroup);
+    if (nullptr != sMaterialized)
+    {
+        aResult.assign_or_and(sDense.m_CampaignCount, &sMaterialized, 1, nullptr, 0);
+        return;
+    }
+
+    CGroupCache& sCache = aIndex.m_CampaignsCache;
+    bool sUseCache = aUseCache && sCache.Enabled();
+    if (sUseCache && sCache.Find(sGroup, aResult))
+        return;
+
+    // Collect both lists of operands and evaluate them in one pass.
+    static thread_local std::vector<const DenseIndex::word_t*> sPositive;
+    static thread_local std::vector<const DenseIndex::word_t*> sNegative;
+    sPositive.clear();
+    sNegative.clear();
+    collectGroupOperands(sDense, sGroup, sPositive, sNegative);
+
+    aResult.assign_or_and(sDense.m_CampaignCount,
+                          sPositive.data(), sPositive.size(),
+                          sNegative.data(), sNegative.size());
+    if (sUseCache)
+        sCache.Insert(sGroup, aResult);
 }
 
 // Calculate how many advertisments and campaingns are allowed to show on every pad.
 // For simplification we don't store this statistics; in real program we do.
 // TODO: is it possible to calculate how many banners are allowed to show on every pad?
-static void calcPadStat()
+// Pads are queried in the built version directly and bypass its result cache,
+// so they are not counted as queries.
+static void calcPadStat(const IndexVersion& aIndex)
 {
-    size_t sTotalUsers = 0;
-    size_t sTotalCampaigns = 0;
+    std::atomic<size_t> sTotalUsers{0};
+    std::atomic<size_t> sTotalCampaigns{0};
 
     {
-        CTitle title("Indexing: calculate pad stats");
+        CThreadPool& sPool = buildPool();
+        CParallelTitle title(sPool, "Indexing: calculate pad stats");
 
-        for (auto& sPair : Pads)
-        {
-            uint32_t sPadId = sPair.first;
+        // Pads are visited in order of IDs, i.e. in order of the dense index.
+        CPadRange sPadIds = PadGraph.PadIds();
 
+        sPool.ParallelFor(0, sPadIds.size(), 256, [&](size_t aFirst, size_t aLast)
+        {
+            target::dynamic_bitset sCampaignBitset;
             size_t sUsers = 0;
             size_t sCampaigns = 0;
-            uint32_t sLastUser = 0;
-            target::dynamic_bitset sCampaignBitset = campaignsByPad(sPadId);
-            for (size_t sBit = sCampaignBitset.find_first();
-                 sBit != sCampaignBitset.npos;
-                 sBit = sCampaignBitset.find_next(sBit))
+            for (size_t i = aFirst; i < aLast; i++)
             {
-                sCampaigns++;
-                if (sLastUser != IndexedCampaigns[sBit].m_UserId)
+                uint32_t sLastUser = 0;
+                campaignsByPad(aIndex, sPadIds[i], sCampaignBitset, false);
+                for (size_t sBit = sCampaignBitset.find_first();
+                     sBit != sCampaignBitset.npos;
+                     sBit = sCampaignBitset.find_next(sBit))
                 {
-                    sUsers++;
-                    sLastUser = IndexedCampaigns[sBit].m_UserId;
+                    sCampaigns++;
+                    if (sLastUser != IndexedCampaigns[sBit].m_UserId)
+                    {
+                        sUsers++;
+                        sLastUser = IndexedCampaigns[sBit].m_UserId;
+                    }
                 }
             }
-
             sTotalUsers += sUsers;
             sTotalCampaigns += sCampaigns;
-        }
+        });
     }
 
     std::cout << "Total statat : advertisments / campaigns "
               << sTotalUsers << " / " << sTotalCampaigns << std::endl;
 }
 
-static void reportIndexSizes()
+static void printCampaignsCache(const CGroupCache& aCache)
 {
-    std::cout << "!!!Approximate size of the index!!!:" << std::endl;
-    size_t sPositiveBitsets = 0;
-    for (const auto& sPair : PositiveCampaigns)
+    if (!aCache.Enabled())
     {
-        const target::dynamic_bitset& sBitset = sPair.second;
-        sPositiveBitsets += sBitset.mem_size();
+        std::cout << "Campaigns cache: disabled" << std::endl;
+        return;
     }
-    size_t sNegativeBitsets = 0;
-    for (const auto& sPair : NegativeCampaigns)
+    size_t sLookups = aCache.Hits() + aCache.Misses();
+    std::cout << "Campaigns cache: budget " << aCache.Budget() / 1024 / 1024 << "MB"
+              << ", used " << aCache.MemSize() / 1024 << "KB"
+              << ", entries " << aCache.Size() << std::endl;
+    std::cout << "Campaigns cache: hits / misses / evictions "
+              << aCache.Hits() << " / " << aCache.Misses()
+              << " / " << aCache.Evictions()
+              << " (hit rate " << (0 == sLookups ? 0 : aCache.Hits() * 100 / sLookups) << "%)"
+              << std::endl;
+    if (0 != aCache.Rejected())
+        std::cout << "Campaigns cache: " << aCache.Rejected() << " results are larger than "
+                  << aCache.Budget() / CGroupCache::SHARD_COUNT << " bytes (budget of a shard) and not cached"
+                  << std::endl;
+}
+
+// Print heap memory of Db, filters and every structure of the index. Hash maps and
+// containers in them are counted by their allocators (see MemoryUsage.hpp), so hash
+// table nodes and buckets are included; flat vectors and bitsets are counted by capacity.
+static void reportIndexSizes(const IndexVersion& aIndex)
+{
+    std::cout << "!!!Size of the index!!!:" << std::endl;
+    MemoryUsage sTotal;
+    auto sReport = [&sTotal](const char* aName, const MemoryUsage& aUsage)
     {
-        const target::dynamic_bitset& sBitset = sPair.second;
-        sNegativeBitsets += sBitset.mem_size();
-    }
-    size_t sBannerHashTableEntries = 0;
+        std::cout << aName << ": " << aUsage.m_Bytes / 1024 << "KB in "
+                  << aUsage.m_Allocations << " allocations" << std::endl;
+        sTotal.m_Bytes += aUsage.m_Bytes;
+        sTotal.m_Allocations += aUsage.m_Allocations;
+    };
+
+    for (size_t i = 0; i < (size_t)MemoryCategory::Count; i++)
+        sReport(memoryCategoryName((MemoryCategory)i), memoryUsage((MemoryCategory)i));
+
+    MemoryUsage sIndexedCampaigns;
+    addMemSize(sIndexedCampaigns, IndexedCampaigns.capacity() * sizeof(IndexedCampaign));
+    sReport("IndexedCampaigns", sIndexedCampaigns);
+    MemoryUsage sIndexedBanners;
+    addMemSize(sIndexedBanners, IndexedBanners.m_BannerIds.capacity() * sizeof(uint32_t));
+    addMemSize(sIndexedBanners, IndexedBanners.m_CampaignIds.capacity() * sizeof(uint32_t));
+    addMemSize(sIndexedBanners, IndexedBanners.m_UserIds.capacity() * sizeof(uint32_t));
+    sReport("IndexedBanners", sIndexedBanners);
+
+    MemoryUsage sFilterBitsets = bitsetsMemUsage(PadBannerBitsetBank);
+    MemoryUsage sCampaignFilterBitsets = bitsetsMemUsage(PadCampaignBitsetBank);
+    sFilterBitsets.m_Bytes += sCampaignFilterBitsets.m_Bytes;
+    sFilterBitsets.m_Allocations += sCampaignFilterBitsets.m_Allocations;
+    sReport("PadFilterBitsetBanks", sFilterBitsets);
+
+    MemoryUsage sTargetingBitsets = bitsetsMemUsage(TargetingBitsetBank);
+    addMemSize(sTargetingBitsets, TargetingBitsetRefs.capacity() * sizeof(uint32_t));
+    addMemSize(sTargetingBitsets, FreeTargetingBitsets.capacity() * sizeof(uint32_t));
+    sReport("TargetingBitsetBank", sTargetingBitsets);
+    // Every pad refers its bitset in the bank, that is what interning saves.
+    size_t sNotInternedBitsets = (PositiveCampaigns.size() + NegativeCampaigns.size()) *
+                                 target::dynamic_bitset::words_count(IndexedCampaigns.size()) * sizeof(DenseIndex::word_t);
+    std::cout << "  (not interned " << sNotInternedBitsets / 1024 / 1024 << "MB)" << std::endl;
+
+    size_t sFilteredBannerPositions = 0;
     for (const auto& sPair : GroupCumulativeFilteredBanners)
+        sFilteredBannerPositions += sPair.second.size();
+    std::cout << "  (GroupFilteredBanners: " << sFilteredBannerPositions << " positions in "
+              << GroupCumulativeFilteredBanners.size() << " groups)" << std::endl;
+
+    sReport("IndexVersion", indexVersionMemUsage(aIndex));
+    const DenseIndex& sDense = aIndex.m_Dense;
+    if (!sDense.m_GroupResultNumbers.empty())
+    {
+        size_t sMaterialized = sDense.m_GroupResults.size() / std::max<size_t>(1, sDense.m_BitsetWords);
+        std::cout << "  (MaterializedGroupResults: " << sMaterialized << " groups, "
+                  << (sDense.m_GroupResultNumbers.mem_size() + sDense.m_GroupResults.mem_size()) / 1024 << "KB)" << std::endl;
+    }
+
+    std::cout << "Total: " << sTotal.m_Bytes / 1024 / 1024 << "MB in "
+              << sTotal.m_Allocations << " allocations" << std::endl;
+    // The cache isn't counted in the total, its size is estimated by itself.
+    printCampaignsCache(aIndex.m_CampaignsCache);
+}
+
+// Build a new index version from hash map parts of the index.
+static std::unique_ptr<IndexVersion> buildIndexVersion()
+{
+    std::unique_ptr<IndexVersion> sIndex(new IndexVersion);
+    sIndex->m_Campaigns = std::vector<IndexedCampaign>(IndexedCampaigns);
+    sIndex->m_BannerIds = std::vector<uint32_t>(IndexedBanners.m_BannerIds);
+    sIndex->m_BannerCampaignIds = std::vector<uint32_t>(IndexedBanners.m_CampaignIds);
+    sIndex->m_BannerUserIds = std::vector<uint32_t>(IndexedBanners.m_UserIds);
+    buildDenseIndex(sIndex->m_Dense);
+    materializeGroupResults(sIndex->m_Dense);
+    IndexVersionIsPatchable = true;
+    ChangedBitsetPads.clear();
+    return sIndex;
+}
+
+// Build a new index version from the published one aPrevious (built by
+// buildIndexVersion() or by this function) when targeting bitsets of
+// ChangedBitsetPads are changed and groups are not.
+// Only groups whose effective pads include a changed pad are affected: their
+// lists of bitsets and materialized results are recalculated, and new bitsets
+// are appended to a copy of the bank. The rest arrays are shared with aPrevious,
+// and cached results of the rest groups are moved to the new version.
+// Returns nullptr, leaving numbers of dense bitsets as they were, if too many stale
+// bitsets are accumulated in the bank since the last full build; then the version
+// should be rebuilt.
+static std::unique_ptr<IndexVersion> patchIndexVersion(const IndexVersion& aPrevious)
+{
+    std::unique_ptr<IndexVersion> sIndex(new IndexVersion);
+    const DenseIndex& sOld = aPrevious.m_Dense;
+    DenseIndex& sNew = sIndex->m_Dense;
+    size_t sWords = sOld.m_BitsetWords;
+    size_t sGroupCount = sOld.m_GroupIds.size();
+    size_t sAffectedCount = 0;
+    uint32_t sOldBitsetCount = DenseBitsetCount;
+    {
+        CTitle title("Indexing: Patch index version");
+        // Group number -> position of one of its pads if the group is affected.
+        std::vector<uint32_t> sAffected(sGroupCount, DenseIndex::NO_POSITION);
+        // Changed pads are effective pads of all their descendants (and of themselves).
+        std::vector<uint8_t> sWalked(PadGraph.Size(), 0);
+        std::vector<uint32_t> sQueue;
+        for (uint32_t sPadId : ChangedBitsetPads)
+        {
+            uint32_t sPosition = PadGraph.Position(sPadId);
+            if (sPosition != CPadGraph::NO_POSITION && !sWalked[sPosition])
+            {
+                sWalked[sPosition] = 1;
+                sQueue.push_back(sPosition);
+            }
+        }
+        for (size_t i = 0; i < sQueue.size(); i++)
+        {
+            uint32_t sGroup = sOld.m_PadGroups[sQueue[i]];
+            if (sAffected[sGroup] == DenseIndex::NO_POSITION)
+            {
+                sAffected[sGroup] = sQueue[i];
+                sAffectedCount++;
+            }
+            for (uint32_t sChild : PadGraph.Children(sQueue[i]))
+            {
+                if (!sWalked[sChild])
+                {
+                    sWalked[sChild] = 1;
+                    sQueue.push_back(sChild);
+                }
+            }
+        }
+
+        std::vector<DenseIndex::word_t> sBitsetBank(sOld.m_BitsetBank.begin(), sOld.m_BitsetBank.end());
+        std::vector<uint32_t> sGroupPositiveOffsets(1, 0), sGroupPositive;
+        std::vector<uint32_t> sGroupNegativeOffsets(1, 0), sGroupNegative;
+        sGroupPositiveOffsets.reserve(sGroupCount + 1);
+        sGroupNegativeOffsets.reserve(sGroupCount + 1);
+        sGroupPositive.reserve(sOld.m_GroupPositive.size());
+        sGroupNegative.reserve(sOld.m_GroupNegative.size());
+        for (uint32_t sGroup = 0; sGroup < sGroupCount; sGroup++)
+        {
+            if (sAffected[sGroup] == DenseIndex::NO_POSITION)
+            {
+                sGroupPositive.insert(sGroupPositive.end(),
+                                      sOld.m_GroupPositive.data() + sOld.m_GroupPositiveOffsets[sGroup],
+                                      sOld.m_GroupPositive.data() + sOld.m_GroupPositiveOffsets[sGroup + 1]);
+                sGroupNegative.insert(sGroupNegative.end(),
+                                      sOld.m_GroupNegative.data() + sOld.m_GroupNegativeOffsets[sGroup],
+                                      sOld.m_GroupNegative.data() + sOld.m_GroupNegativeOffsets[sGroup + 1]);
+            }
+            else
+            {
+                // The same as in buildDenseIndex().
+                for (uint32_t sEffectivePadId : PadGraph.EffectivePads(sAffected[sGroup]))
+                {
+                    auto sPosItr = PositiveCampaigns.find(sEffectivePadId);
+                    if (sPosItr != PositiveCampaigns.end())
+                        sGroupPositive.push_back(denseBitsetNumber(sPosItr->second, sWords, sBitsetBank));
+                    auto sNegItr = NegativeCampaigns.find(sEffectivePadId);
+                    if (sNegItr != NegativeCampaigns.end())
+                        sGroupNegative.push_back(denseBitsetNumber(sNegItr->second, sWords, sBitsetBank));
+                }
+            }
+            sGroupPositiveOffsets.push_back((uint32_t)sGroupPositive.size());
+            sGroupNegativeOffsets.push_back((uint32_t)sGroupNegative.size());
+        }
+        if (DenseBitsetCount - DenseBitsetsOfBuild > DenseBitsetsOfBuild)
+        {
+            // Numbers of the new bitsets refer to sBitsetBank, which is dropped.
+            truncateDenseBitsets(sOldBitsetCount);
+            return nullptr;
+        }
+
+        sNew.m_CampaignCount = sOld.m_CampaignCount;
+        sNew.m_BitsetWords = sWords;
+        sNew.m_BitsetBank = std::move(sBitsetBank);
+        sNew.m_PadIds = sOld.m_PadIds.Share();
+        sNew.m_PositionById = sOld.m_PositionById.Share();
+        sNew.m_PadGroups = sOld.m_PadGroups.Share();
+        sNew.m_PadIsLeaf = sOld.m_PadIsLeaf.Share();
+        sNew.m_GroupIds = sOld.m_GroupIds.Share();
+        sNew.m_GroupPositiveOffsets = std::move(sGroupPositiveOffsets);
+        sNew.m_GroupPositive = std::move(sGroupPositive);
+        sNew.m_GroupNegativeOffsets = std::move(sGroupNegativeOffsets);
+        sNew.m_GroupNegative = std::move(sGroupNegative);
+        sNew.m_GroupBannerOffsets = sOld.m_GroupBannerOffsets.Share();
+        sNew.m_GroupBanners = sOld.m_GroupBanners.Share();
+        sNew.m_GroupResultNumbers = sOld.m_GroupResultNumbers.Share();
+
+        // Materialized results of affected groups are evaluated like campaignsByPad() does.
+        if (sOld.m_GroupResultNumbers.empty())
+            sNew.m_GroupResults = sOld.m_GroupResults.Share();
+        else
+        {
+            std::vector<DenseIndex::word_t> sResults(sOld.m_GroupResults.begin(), sOld.m_GroupResults.end());
+            std::vector<const DenseIndex::word_t*> sPositive, sNegative;
+            target::dynamic_bitset sResult;
+            for (uint32_t sGroup = 0; sGroup < sGroupCount; sGroup++)
+            {
+                uint32_t sNumber = sOld.m_GroupResultNumbers[sGroup];
+                if (sAffected[sGroup] == DenseIndex::NO_POSITION || sNumber == DenseIndex::NO_POSITION)
+                    continue;
+                sPositive.clear();
+                sNegative.clear();
+                collectGroupOperands(sNew, sGroup, sPositive, sNegative);
+                sResult.assign_or_and(sNew.m_CampaignCount, sPositive.data(), sPositive.size(),
+                                      sNegative.data(), sNegative.size());
+                std::copy(sResult.data(), sResult.data() + sWords, sResults.data() + size_t(sNumber) * sWords);
+            }
+            sNew.m_GroupResults = std::move(sResults);
+        }
+
+        sIndex->m_Campaigns = aPrevious.m_Campaigns.Share();
+        sIndex->m_BannerIds = aPrevious.m_BannerIds.Share();
+        sIndex->m_BannerCampaignIds = aPrevious.m_BannerCampaignIds.Share();
+        sIndex->m_BannerUserIds = aPrevious.m_BannerUserIds.Share();
+        sIndex->m_Storage = aPrevious.m_Storage;
+
+        // Group numbers are not changed, so cached results of the rest groups are valid.
+        sIndex->m_CampaignsCache.SetBudget(CampaignsCacheBudget);
+        sIndex->m_CampaignsCache.InsertFrom(aPrevious.m_CampaignsCache, [&sAffected](uint32_t aGroup)
+        {
+            return sAffected[aGroup] == DenseIndex::NO_POSITION;
+        });
+        ChangedBitsetPads.clear();
+    }
+
+    std::cout << "Patched index version: groups " << sAffectedCount << " of " << sGroupCount
+              << ", new bitsets " << DenseBitsetCount - sOldBitsetCount
+              << ", cached results kept " << sIndex->m_CampaignsCache.Size() << std::endl;
+    return sIndex;
+}
+
+// Publish an index version instead of the current one, and free the current
+// one when queries that may use it are finished.
+static void publishIndex(std::unique_ptr<IndexVersion> aIndex)
+{
+    std::unique_ptr<const IndexVersion> sPrevious;
     {
-        sBannerHashTableEntries++;
-        sBannerHashTableEntries += sPair.second.size();
+        std::lock_guard<std::mutex> sLock(CampaignsCacheBudgetMutex);
+        aIndex->m_CampaignsCache.SetBudget(CampaignsCacheBudget);
+        sPrevious.reset(CurrentIndex.exchange(aIndex.release()));
     }
-    size_t sBannerHashTableMemSize = sBannerHashTableEntries * 36; // Approximate..
-    size_t sTotal = sPositiveBitsets + sNegativeBitsets + sBannerHashTableMemSize;
+    synchronizeEpochReaders();
+}
 
-    std::cout << "BannerHashTableEntries: " << sBannerHashTableEntries << std::endl;
-    std::cout << "PositiveBitsets: " << sPositiveBitsets / 1024 / 1024 << "MB" << std::endl;
-    std::cout << "NegativeBitsets: " << sNegativeBitsets / 1024 / 1024 << "MB" << std::endl;
-    std::cout << "BannerHashTableMemSize: " << sBannerHashTableMemSize / 1024 / 1024 << "MB" << std::endl;
-    std::cout << "Total: " << sTotal / 1024 / 1024 << "MB" << std::endl;
+// Index version for queries, the caller must be inside a read section.
+// An empty version is returned if none is published, so nothing is allowed anywhere.
+static const IndexVersion& queryIndex()
+{
+    static const IndexVersion sEmptyIndex{};
+    const IndexVersion* sIndex = CurrentIndex.load();
+    return nullptr != sIndex ? *sIndex : sEmptyIndex;
+}
+
+const IndexVersion* currentIndex()
+{
+    return CurrentIndex.load();
+}
+
+void installIndex(std::unique_ptr<IndexVersion> aIndex)
+{
+    std::lock_guard<std::mutex> sLock(IndexWriterMutex);
+    PositiveCampaigns.clear();
+    NegativeCampaigns.clear();
+    TargetingBitsetBank.clear();
+    TargetingBitsetRefs.clear();
+    FreeTargetingBitsets.clear();
+    TargetingBitsetsByHash.clear();
+    FilteredBanners.clear();
+    GroupCumulativeFilteredBanners.clear();
+    GroupsByHash.clear();
+    GroupMembers.clear();
+    CampaignPositions.clear();
+    PackageCampaigns.clear();
+    UserCampaigns.clear();
+    PadTargetingCounts.clear();
+    PadGraph.Clear();
+    PadGraphIsStale = false;
+    IndexVersionIsPatchable = false;
+    DenseBitsetNumbers.clear();
+    ChangedBitsetPads.clear();
+    HashIndexBuilt = false;
+    publishIndex(std::move(aIndex));
+}
+
+void setCampaignsCacheBudget(size_t aBytes)
+{
+    std::lock_guard<std::mutex> sLock(CampaignsCacheBudgetMutex);
+    CampaignsCacheBudget = aBytes;
+    CEpochReadScope sScope;
+    const IndexVersion* sIndex = CurrentIndex.load();
+    if (nullptr != sIndex)
+        sIndex->m_CampaignsCache.SetBudget(aBytes);
+}
+
+size_t campaignsCacheBudget()
+{
+    return CampaignsCacheBudget;
+}
+
+void reportCampaignsCache()
+{
+    CEpochReadScope sScope;
+    printCampaignsCache(queryIndex().m_CampaignsCache);
+}
+
+void setMaterializeSettings(const MaterializeSettings& aSettings)
+{
+    std::lock_guard<std::mutex> sLock(IndexWriterMutex);
+    MaterializeThresholds = aSettings;
+    // Materialized groups are chosen by them when a version is built.
+    IndexVersionIsPatchable = false;
+}
+
+void setPadQueryCounts(const std::unordered_map<uint32_t, uint64_t>& aCounts)
+{
+    std::lock_guard<std::mutex> sLock(IndexWriterMutex);
+    PadQueryCounts = aCounts;
+    // Materialized groups are chosen by them when a version is built.
+    IndexVersionIsPatchable = false;
+}
+
+void setIndexBuildThreads(size_t aThreads)
+{
+    std::lock_guard<std::mutex> sLock(IndexWriterMutex);
+    IndexBuildThreads = aThreads;
 }
 
 void buildIndexes()
 {
+    std::lock_guard<std::mutex> sLock(IndexWriterMutex);
     buildTargetings();
     buildFilters();
+    internTargetingBitsets();
     buildEffectivePads();
+    PadGraph.Build();
     buildGroupCumulativeFilteredBanners();
-    calcPadStat();
-    reportIndexSizes();
+    HashIndexBuilt = true;
+    std::unique_ptr<IndexVersion> sIndex = buildIndexVersion();
+    // Only this function may replace the version, so it stays valid.
+    const IndexVersion& sBuilt = *sIndex;
+    publishIndex(std::move(sIndex));
+    calcPadStat(sBuilt);
+    reportIndexSizes(sBuilt);
+}
+
+// Whether a campaign is targeted to a pad by itself, by its package or by its users.
+static bool isTargeted(const Campaign& aCampaign, const Pad* aPad, bool aPositive)
+{
+    auto sTargets = [aPad, aPositive](const TargetingPadList& aPositivePads, const TargetingPadList& aNegativePads)
+    {
+        const TargetingPadList& sPads = aPositive ? aPositivePads : aNegativePads;
+        return std::find(sPads.begin(), sPads.end(), aPad) != sPads.end();
+    };
+    if (sTargets(aCampaign.m_PositiveTargetingPad, aCampaign.m_NegatineTargetingPad))
+        return true;
+    if (aCampaign.m_Package != nullptr &&
+        sTargets(aCampaign.m_Package->m_PositiveTargetingPad, aCampaign.m_Package->m_NegatineTargetingPad))
+        return true;
+    for (const User* sUser = aCampaign.m_User; sUser != nullptr; sUser = sUser->m_Parent)
+    {
+        if (sTargets(sUser->m_PositiveTargetingPad, sUser->m_NegatineTargetingPad))
+            return true;
+    }
+    return false;
+}
+
+// Recalculate bits of given campaign positions in positive or negative bitset of a pad
+// the same way buildTargetings() and buildFilters() do it, and intern the new bitset.
+static void patchPadBitset(const Pad& aPad, bool aPositive, const std::vector<uint32_t>& aPositions)
+{
+    ChangedBitsetPads.push_back(aPad.m_Id);
+    PadBitsetNumbers& sPadBitsets = aPositive ? PositiveCampaigns : NegativeCampaigns;
+    auto sFilterItr = PadFilters.find(aPad.m_Id);
+    const target::dynamic_bitset* sFilterAny = aPositive || sFilterItr == PadFilters.end() ? nullptr : sFilterItr->second.m_Any;
+
+    auto sItr = sPadBitsets.find(aPad.m_Id);
+    target::dynamic_bitset sBitset;
+    if (sItr != sPadBitsets.end())
+        sBitset = TargetingBitsetBank[sItr->second];
+    else if (nullptr != sFilterAny)
+        sBitset = *sFilterAny;
+    else
+        sBitset.resize(IndexedCampaigns.size(), !aPositive);
+
+    for (uint32_t sPosition : aPositions)
+    {
+        const Campaign& sCamp = Campaigns[IndexedCampaigns[sPosition].m_CampaignId];
+        bool sTargeted = isTargeted(sCamp, &aPad, aPositive);
+        if (aPositive)
+            sBitset.set(sPosition, sTargeted);
+        else
+            sBitset.set(sPosition, !sTargeted && (nullptr == sFilterAny || sFilterAny->test(sPosition)));
+    }
+
+    // A pad without targetings (and filters) has no bitset.
+    bool sTrivial = aPositive ? sBitset.none() : nullptr == sFilterAny && sBitset.all();
+    if (sItr != sPadBitsets.end())
+    {
+        releaseTargetingBitset(sItr->second);
+        if (sTrivial)
+            sPadBitsets.erase(sItr);
+        else
+            sItr->second = internTargetingBitset(std::move(sBitset));
+    }
+    else if (!sTrivial)
+        sPadBitsets[aPad.m_Id] = internTargetingBitset(std::move(sBitset));
+}
+
+// Remove given pads from their groups. A group without pads is removed, a group
+// that loses the pad that gives ID to the group gets ID of one of the rest pads.
+static void leaveGroups(const std::vector<Pad*>& aPads, const std::unordered_map<uint32_t, Pad*>& aPadsById)
+{
+    std::vector<uint32_t> sGroupIds;
+    for (const Pad* sPad : aPads)
+        sGroupIds.push_back(sPad->m_EffectivePadsGroupId);
+    std::sort(sGroupIds.begin(), sGroupIds.end());
+    sGroupIds.erase(std::unique(sGroupIds.begin(), sGroupIds.end()), sGroupIds.end());
+
+    for (uint32_t sGroupId : sGroupIds)
+    {
+        auto sMembersItr = GroupMembers.find(sGroupId);
+        GroupPadList& sMembers = sMembersItr->second;
+        sMembers.erase(std::remove_if(sMembers.begin(), sMembers.end(),
+                                      [&aPadsById](uint32_t aId) { return aPadsById.count(aId) != 0; }),
+                       sMembers.end());
+        if (aPadsById.count(sGroupId) == 0)
+            continue;
+
+        // Effective pads of leaving pads are not changed yet, so the hash is the same.
+        auto sHashItr = GroupsByHash.find(effectivePadsHash(Pads[sGroupId].m_EffectivePads));
+        GroupPadList& sSameHashGroups = sHashItr->second;
+        auto sGroupItr = std::find(sSameHashGroups.begin(), sSameHashGroups.end(), sGroupId);
+        auto sBannersItr = GroupCumulativeFilteredBanners.find(sGroupId);
+        if (sMembers.empty())
+        {
+            sSameHashGroups.erase(sGroupItr);
+            if (sSameHashGroups.empty())
+                GroupsByHash.erase(sHashItr);
+            if (sBannersItr != GroupCumulativeFilteredBanners.end())
+                GroupCumulativeFilteredBanners.erase(sBannersItr);
+            GroupMembers.erase(sMembersItr);
+            continue;
+        }
+
+        uint32_t sNewGroupId = sMembers.front();
+        for (uint32_t sId : sMembers)
+            Pads[sId].m_EffectivePadsGroupId = sNewGroupId;
+        *sGroupItr = sNewGroupId;
+        if (sBannersItr != GroupCumulativeFilteredBanners.end())
+        {
+            GroupFilteredBannerList sBanners = std::move(sBannersItr->second);
+            GroupCumulativeFilteredBanners.erase(sBannersItr);
+            GroupCumulativeFilteredBanners[sNewGroupId] = std::move(sBanners);
+        }
+        GroupPadList sNewMembers = std::move(sMembers);
+        GroupMembers.erase(sMembersItr);
+        GroupMembers[sNewGroupId] = std::move(sNewMembers);
+    }
+}
+
+// Apply a change of targetings of aPad to the index.
+// aPositions are positions of campaigns whose targetings are changed.
+static void updatePadTargetings(Pad& aPad, bool aPositive, const std::vector<uint32_t>& aPositions)
+{
+    patchPadBitset(aPad, aPositive, aPositions);
+
+    bool sHasTargetingsOrFilters = PadTargetingCounts.count(aPad.m_Id) != 0 || PadFilters.count(aPad.m_Id) != 0;
+    bool sRegroup = sHasTargetingsOrFilters != aPad.m_HasTargetingsOrFilters;
+    aPad.m_HasTargetingsOrFilters = sHasTargetingsOrFilters;
+    if (!sRegroup)
+        return;
+    PadGraphIsStale = true;
+
+    std::vector<Pad*> sSubtree(1, &aPad);
+    std::unordered_map<uint32_t, Pad*> sSubtreeById;
+    sSubtreeById[aPad.m_Id] = &aPad;
+    for (size_t i = 0; i < sSubtree.size(); i++)
+    {
+        for (Pad* sChild : sSubtree[i]->m_DirectChildren)
+        {
+            if (sSubtreeById.emplace(sChild->m_Id, sChild).second)
+                sSubtree.push_back(sChild);
+        }
+    }
+
+    // The pad is added to or removed from effective pads of the whole subtree.
+    leaveGroups(sSubtree, sSubtreeById);
+    for (Pad* sPad : sSubtree)
+    {
+        EffectivePadList& sEffectivePads = sPad->m_EffectivePads;
+        auto sPlace = std::lower_bound(sEffectivePads.begin(), sEffectivePads.end(), aPad.m_Id);
+        if (sHasTargetingsOrFilters)
+            sEffectivePads.insert(sPlace, aPad.m_Id);
+        else
+            sEffectivePads.erase(sPlace);
+    }
+    for (Pad* sPad : sSubtree)
+    {
+        if (joinGroup(*sPad, effectivePadsHash(sPad->m_EffectivePads)))
+            buildGroupCumulativeFilteredBanners(sPad->m_Id, sPad->m_EffectivePads);
+    }
+}
+
+// Targeting lists of an owner and positions of its campaigns in IndexedCampaigns.
+// Returns false if there's no such owner.
+static bool findTargetingOwner(TargetingOwner aOwner, uint32_t aOwnerId, bool aCreate,
+                               TargetingPadList*& aPositive, TargetingPadList*& aNegative,
+                               std::vector<uint32_t>& aPositions)
+{
+    aPositions.clear();
+    switch (aOwner)
+    {
+    case TargetingOwner::Campaign:
+    {
+        auto sItr = Campaigns.find(aOwnerId);
+        if (sItr == Campaigns.end())
+            return false;
+        aPositive = &sItr->second.m_PositiveTargetingPad;
+        aNegative = &sItr->second.m_NegatineTargetingPad;
+        auto sPosItr = CampaignPositions.find(aOwnerId);
+        if (sPosItr != CampaignPositions.end())
+            aPositions.push_back(sPosItr->second);
+        return true;
+    }
+    case TargetingOwner::Package:
+    {
+        // Like in loadDb(), any package may have targetings.
+        auto sItr = Packages.find(aOwnerId);
+        if (sItr == Packages.end())
+        {
+            if (!aCreate)
+                return false;
+            sItr = Packages.emplace(aOwnerId, Package(aOwnerId)).first;
+        }
+        aPositive = &sItr->second.m_PositiveTargetingPad;
+        aNegative = &sItr->second.m_NegatineTargetingPad;
+        auto sPosItr = PackageCampaigns.find(aOwnerId);
+        if (sPosItr != PackageCampaigns.end())
+            aPositions.assign(sPosItr->second.begin(), sPosItr->second.end());
+        return true;
+    }
+    case TargetingOwner::User:
+    {
+        auto sItr = Users.find(aOwnerId);
+        if (sItr == Users.end())
+            return false;
+        aPositive = &sItr->second.m_PositiveTargetingPad;
+        aNegative = &sItr->second.m_NegatineTargetingPad;
+        auto sPosItr = UserCampaigns.find(aOwnerId);
+        if (sPosItr != UserCampaigns.end())
+            aPositions.assign(sPosItr->second.begin(), sPosItr->second.end());
+        return true;
+    }
+    }
+    return false;
+}
+
+// Add (aAdd) or remove one targeting, see addTargeting() and removeTargeting().
+static bool updateTargeting(TargetingOwner aOwner, uint32_t aOwnerId, uint32_t aPadId, bool aPositive, bool aAdd)
+{
+    std::lock_guard<std::mutex> sLock(IndexWriterMutex);
+    check(HashIndexBuilt, "Targeting updates require index built by buildIndexes()");
+    auto sPadItr = Pads.find(aPadId);
+    if (sPadItr == Pads.end())
+        return false;
+    Pad& sPad = sPadItr->second;
+
+    TargetingPadList* sPositive = nullptr;
+    TargetingPadList* sNegative = nullptr;
+    std::vector<uint32_t> sPositions;
+    if (!findTargetingOwner(aOwner, aOwnerId, aAdd, sPositive, sNegative, sPositions))
+        return false;
+    TargetingPadList& sTargetings = aPositive ? *sPositive : *sNegative;
+    if (aAdd)
+    {
+        sTargetings.push_back(&sPad);
+        PadTargetingCounts[aPadId]++;
+    }
+    else
+    {
+        auto sItr = std::find(sTargetings.begin(), sTargetings.end(), &sPad);
+        if (sItr == sTargetings.end())
+            return false;
+        sTargetings.erase(sItr);
+        auto sCountItr = PadTargetingCounts.find(aPadId);
+        if (--sCountItr->second == 0)
+            PadTargetingCounts.erase(sCountItr);
+    }
+
+    updatePadTargetings(sPad, aPositive, sPositions);
+    return true;
+}
+
+bool addTargeting(TargetingOwner aOwner, uint32_t aOwnerId, uint32_t aPadId, bool aPositive)
+{
+    return updateTargeting(aOwner, aOwnerId, aPadId, aPositive, true);
+}
+
+bool removeTargeting(TargetingOwner aOwner, uint32_t aOwnerId, uint32_t aPadId, bool aPositive)
+{
+    return updateTargeting(aOwner, aOwnerId, aPadId, aPositive, false);
+}
+
+void publishIndexUpdates()
+{
+    std::lock_guard<std::mutex> sLock(IndexWriterMutex);
+    check(HashIndexBuilt, "Targeting updates require index built by buildIndexes()");
+    if (PadGraphIsStale)
+    {
+        PadGraph.Build();
+        PadGraphIsStale = false;
+        IndexVersionIsPatchable = false;
+    }
+    std::unique_ptr<IndexVersion> sIndex;
+    // Only this module publishes patchable versions, so the current one is valid here.
+    if (IndexVersionIsPatchable)
+        sIndex = patchIndexVersion(*CurrentIndex.load());
+    if (nullptr == sIndex)
+        sIndex = buildIndexVersion();
+    publishIndex(std::move(sIndex));
 }
 
 // Get campaign bits that can be shown on given pad.
 target::dynamic_bitset campaignsByPad(uint32_t aPadId)
 {
-    target::dynamic_bitset sResult(IndexedCampaigns.size(), false);
-    const Pad& sPad = Pads[aPadId];
+    target::dynamic_bitset sResult;
+    campaignsByPad(aPadId, sResult);
+    return sResult;
+}
+
+// The same, but the result is written to caller-owned bitset.
+void campaignsByPad(uint32_t aPadId, target::dynamic_bitset& aResult)
+{
+    static CMetric& sMetric = metric(MetricKind::Query, "campaignsByPad");
+    CMetricTimer sTimer(sMetric);
+    CEpochReadScope sScope;
+    campaignsByPad(queryIndex(), aPadId, aResult);
+}
+
+// Operands of a group in campaignsByPads(): positive then negative bitsets.
+struct BatchOperands
+{
+    const DenseIndex::word_t* const* m_Positive;
+    size_t m_PositiveCount;
+    const DenseIndex::word_t* const* m_Negative;
+    size_t m_NegativeCount;
 
-    // Positive targetings: every campaign that is allowed directly on the pad
-    // or on any ancestor is allowed to show.
-    for (uint32_t sEffectivePadId : sPad.m_EffectivePads)
+    size_t size() const { return m_PositiveCount + m_NegativeCount; }
+    const DenseIndex::word_t* at(size_t i) const
     {
-        auto sItr = PositiveCampaigns.find(sEffectivePadId);
-        if (sItr == PositiveCampaigns.end())
-            continue;
-        const target::dynamic_bitset& sAllowed = sItr->second;
-        sResult |= sAllowed;
+        return i < m_PositiveCount ? m_Positive[i] : m_Negative[i - m_PositiveCount];
+    }
+};
+
+// Length of common prefix of two operand lists.
+static size_t commonPrefix(const BatchOperands& aFirst, const BatchOperands& aSecond)
+{
+    size_t sCount = std::min(aFirst.size(), aSecond.size());
+    size_t i = 0;
+    while (i < sCount && aFirst.at(i) == aSecond.at(i) &&
+           (i < aFirst.m_PositiveCount) == (i < aSecond.m_PositiveCount))
+        i++;
+    return i;
+}
+
+// Partial result of the first m_Length operands of a group in campaignsByPads():
+// OR of the first m_OrCount positive bitsets and AND of the first m_AndCount
+// negative ones.
+struct BatchPartial
+{
+    size_t m_Length = 0;
+    size_t m_OrCount = 0;
+    size_t m_AndCount = 0;
+    target::dynamic_bitset m_Or;
+    target::dynamic_bitset m_And;
+};
+
+// Operands that evaluate the first aLength operands of a group in campaignsByPads()
+// starting from partial result aBase (nullptr for no operands): the result is
+// OR of aOr AND all of aAnd.
+static void collectBatchOperands(const BatchOperands& aOperands, const BatchPartial* aBase, size_t aLength,
+                                 std::vector<const DenseIndex::word_t*>& aOr,
+                                 std::vector<const DenseIndex::word_t*>& aAnd)
+{
+    aOr.clear();
+    aAnd.clear();
+    size_t sBaseLength = 0;
+    if (nullptr != aBase)
+    {
+        sBaseLength = aBase->m_Length;
+        if (0 != aBase->m_OrCount)
+            aOr.push_back(aBase->m_Or.data());
+        if (0 != aBase->m_AndCount)
+            aAnd.push_back(aBase->m_And.data());
+    }
+    for (size_t i = sBaseLength; i < aLength; i++)
+        (i < aOperands.m_PositiveCount ? aOr : aAnd).push_back(aOperands.at(i));
+}
+
+// Get campaign bits of several pads at once.
+void campaignsByPads(const uint32_t* aPadIds, size_t aCount, CampaignsBatch& aResult)
+{
+    static CMetric& sMetric = metric(MetricKind::Query, "campaignsByPads");
+    CMetricTimer sTimer(sMetric);
+
+    using word_t = DenseIndex::word_t;
+    const uint32_t NO_GROUP = UINT32_MAX;
+    CEpochReadScope sScope;
+    const IndexVersion& sIndex = queryIndex();
+    const DenseIndex& sDense = sIndex.m_Dense;
+    CGroupCache& sCache = sIndex.m_CampaignsCache;
+    size_t sSize = sDense.m_CampaignCount;
+
+    // (group, number of requested pad), sorted to bucket pads by groups.
+    static thread_local std::vector<std::pair<uint32_t, uint32_t>> sPadGroups;
+    sPadGroups.clear();
+    for (size_t i = 0; i < aCount; i++)
+    {
+        uint32_t sGroup;
+        if (!findPadGroup(sDense, aPadIds[i], sGroup))
+            sGroup = NO_GROUP;
+        sPadGroups.emplace_back(sGroup, (uint32_t)i);
     }
+    std::sort(sPadGroups.begin(), sPadGroups.end());
 
-    // Negative targetings: every campaign that is not allowed directly on the pad
-    // or on any ancestor is not allowed to show.
-    for (uint32_t sEffectivePadId : sPad.m_EffectivePads)
+    // Distinct groups that need evaluation: operands of group r (number of result)
+    // are sOperands[sOffsets[r] .. sOffsets[r] + sPositiveCounts[r]) for positive
+    // bitsets and the rest up to sOffsets[r + 1] for negative ones.
+    static thread_local std::vector<const word_t*> sPositive, sNegative, sOperands;
+    static thread_local std::vector<uint32_t> sOffsets, sPositiveCounts, sResultGroups, sOrder;
+    sOperands.clear();
+    sOffsets.assign(1, 0);
+    sPositiveCounts.clear();
+    sResultGroups.clear();
+    sOrder.clear();
+    aResult.m_PadResults.resize(aCount);
+    aResult.m_ReusedOperands = 0;
+    aResult.m_EvaluatedOperands = 0;
+    size_t sResults = 0;
+    for (size_t i = 0; i < sPadGroups.size(); i++)
     {
-        auto sItr = NegativeCampaigns.find(sEffectivePadId);
-        if (sItr == NegativeCampaigns.end())
+        uint32_t sGroup = sPadGroups[i].first;
+        if (0 != i && sGroup == sPadGroups[i - 1].first)
+        {
+            aResult.m_PadResults[sPadGroups[i].second] = (uint32_t)(sResults - 1);
             continue;
-        const target::dynamic_bitset& sAllowed = sItr->second;
-        sResult &= sAllowed;
+        }
+        uint32_t sResult = (uint32_t)sResults++;
+        aResult.m_PadResults[sPadGroups[i].second] = sResult;
+        sResultGroups.push_back(sGroup);
+        if (aResult.m_Bitsets.size() < sResults)
+            aResult.m_Bitsets.resize(sResults);
+        target::dynamic_bitset& sBitset = aResult.m_Bitsets[sResult];
+
+        sPositive.clear();
+        sNegative.clear();
+        const word_t* sMaterialized = NO_GROUP != sGroup ? materializedGroupResult(sDense, sGroup) : nullptr;
+        if (nullptr != sMaterialized)
+            sBitset.assign_or_and(sSize, &sMaterialized, 1, nullptr, 0);
+        bool sCached = nullptr != sMaterialized ||
+                       (NO_GROUP != sGroup && sCache.Enabled() && sCache.Find(sGroup, sBitset));
+        if (!sCached && NO_GROUP != sGroup)
+            collectGroupOperands(sDense, sGroup, sPositive, sNegative);
+
+        if (sPositive.empty())
+        {
+            // Materialized, cached, unknown pad or nothing is allowed without positive targetings.
+            if (!sCached)
+            {
+                sBitset.resize(sSize);
+                sBitset.reset();
+            }
+        }
+        else
+            sOrder.push_back(sResult);
+        sOperands.insert(sOperands.end(), sPositive.begin(), sPositive.end());
+        sOperands.insert(sOperands.end(), sNegative.begin(), sNegative.end());
+        sOffsets.push_back((uint32_t)sOperands.size());
+        sPositiveCounts.push_back((uint32_t)sPositive.size());
     }
+    aResult.m_Bitsets.resize(sResults);
 
-    return sResult;
+    auto sGroupOperands = [&](uint32_t aResult) -> BatchOperands
+    {
+        const word_t* const* sFirst = sOperands.data() + sOffsets[aResult];
+        size_t sPositiveCount = sPositiveCounts[aResult];
+        return BatchOperands{sFirst, sPositiveCount, sFirst + sPositiveCount,
+                             sOffsets[aResult + 1] - sOffsets[aResult] - sPositiveCount};
+    };
+
+    // Evaluate groups in lexicographic order of their operand lists (positive
+    // then negative), so groups with common leading operands are next to each other.
+    std::less<const word_t*> sLess;
+    std::sort(sOrder.begin(), sOrder.end(), [&](uint32_t aLeft, uint32_t aRight)
+    {
+        BatchOperands sLeft = sGroupOperands(aLeft), sRight = sGroupOperands(aRight);
+        if (std::lexicographical_compare(sLeft.m_Positive, sLeft.m_Positive + sLeft.m_PositiveCount,
+                                         sRight.m_Positive, sRight.m_Positive + sRight.m_PositiveCount, sLess))
+            return true;
+        if (std::lexicographical_compare(sRight.m_Positive, sRight.m_Positive + sRight.m_PositiveCount,
+                                         sLeft.m_Positive, sLeft.m_Positive + sLeft.m_PositiveCount, sLess))
+            return false;
+        return std::lexicographical_compare(sLeft.m_Negative, sLeft.m_Negative + sLeft.m_NegativeCount,
+                                            sRight.m_Negative, sRight.m_Negative + sRight.m_NegativeCount, sLess);
+    });
+
+    // Partial results of common prefixes of the current group and the next ones,
+    // by increasing length. Common prefix of groups k and m (k < m) is the minimum
+    // of common prefixes of neighbours between them, so a partial result stays
+    // usable while it's not longer than common prefixes of the following groups.
+    static thread_local std::vector<BatchPartial> sPartials;
+    static thread_local std::vector<const word_t*> sOr, sAnd;
+    size_t sDepth = 0;
+    size_t sPrevPrefix = 0;
+    for (size_t k = 0; k < sOrder.size(); k++)
+    {
+        BatchOperands sOperandsOfGroup = sGroupOperands(sOrder[k]);
+        size_t sNextPrefix = k + 1 < sOrder.size() ? commonPrefix(sOperandsOfGroup, sGroupOperands(sOrder[k + 1])) : 0;
+        while (sDepth > 0 && sPartials[sDepth - 1].m_Length > sPrevPrefix)
+            sDepth--;
+        size_t sBaseLength = 0 == sDepth ? 0 : sPartials[sDepth - 1].m_Length;
+        aResult.m_ReusedOperands += sBaseLength;
+        aResult.m_EvaluatedOperands += sOperandsOfGroup.size() - sBaseLength;
+        // Keep partial result of the prefix that is shared with the next group.
+        // It costs one more pass, so a single operand is not worth keeping.
+        if (sNextPrefix > sBaseLength + 1)
+        {
+            if (sPartials.size() == sDepth)
+                sPartials.emplace_back();
+            collectBatchOperands(sOperandsOfGroup, 0 == sDepth ? nullptr : &sPartials[sDepth - 1],
+                                 sNextPrefix, sOr, sAnd);
+            BatchPartial& sPartial = sPartials[sDepth++];
+            sPartial.m_Length = sNextPrefix;
+            sPartial.m_OrCount = std::min(sNextPrefix, sOperandsOfGroup.m_PositiveCount);
+            sPartial.m_AndCount = sNextPrefix - sPartial.m_OrCount;
+            if (!sOr.empty())
+                sPartial.m_Or.assign_or_and(sSize, sOr.data(), sOr.size(), nullptr, 0);
+            if (!sAnd.empty())
+                sPartial.m_And.assign_or_and(sSize, sAnd.data(), 1, sAnd.data() + 1, sAnd.size() - 1);
+        }
+        collectBatchOperands(sOperandsOfGroup, 0 == sDepth ? nullptr : &sPartials[sDepth - 1],
+                             sOperandsOfGroup.size(), sOr, sAnd);
+        aResult.m_Bitsets[sOrder[k]].assign_or_and(sSize, sOr.data(), sOr.size(), sAnd.data(), sAnd.size());
+        sPrevPrefix = sNextPrefix;
+    }
+
+    for (uint32_t sResult : sOrder)
+        sCache.Insert(sResultGroups[sResult], aResult.m_Bitsets[sResult]);
+}
+
+// filteredBannersByPad() in given index version.
+static CFilteredBanners filteredBannersByPad(const IndexVersion& aIndex, uint32_t aPadId)
+{
+    const DenseIndex& sDense = aIndex.m_Dense;
+    uint32_t sGroup;
+    if (!findPadGroup(sDense, aPadId, sGroup))
+        return CFilteredBanners();
+    const uint32_t* sBanners = sDense.m_GroupBanners.data();
+    return CFilteredBanners(sBanners + sDense.m_GroupBannerOffsets[sGroup],
+                            sBanners + sDense.m_GroupBannerOffsets[sGroup + 1]);
 }
 
 // Get list of banners that are prohibited to show on given pad.
 // For optimisation the list doesn't include banners from fully filtered campaigns
 // (campaigns that are not present in campaignsByPad(aPadId) bitset).
-const std::unordered_set<uint32_t>& filteredBannersByPad(uint32_t aPadId)
+// The caller's read section keeps the version of the result alive.
+CFilteredBanners filteredBannersByPad(const CEpochReadScope&, uint32_t aPadId)
+{
+    static CMetric& sMetric = metric(MetricKind::Query, "filteredBannersByPad");
+    CMetricTimer sTimer(sMetric);
+    return filteredBannersByPad(queryIndex(), aPadId);
+}
+
+// Get banner bits that can be shown on given pad.
+target::dynamic_bitset bannersByPad(uint32_t aPadId)
 {
-    const Pad& sPad = Pads[aPadId];
-    auto sItr = GroupCumulativeFilteredBanners.find(sPad.m_EffectivePadsGroupId);
-    if (sItr == GroupCumulativeFilteredBanners.end())
+    target::dynamic_bitset sResult;
+    bannersByPad(aPadId, sResult);
+    return sResult;
+}
+
+// The same, but the result is written to caller-owned bitset.
+// Campaigns and filtered banners are taken from the same index version.
+void bannersByPad(uint32_t aPadId, target::dynamic_bitset& aResult)
+{
+    static CMetric& sMetric = metric(MetricKind::Query, "bannersByPad");
+    CMetricTimer sTimer(sMetric);
+    CEpochReadScope sScope;
+    const IndexVersion& sIndex = queryIndex();
+    static thread_local target::dynamic_bitset sCampaigns;
+    campaignsByPad(sIndex, aPadId, sCampaigns);
+    CFilteredBanners sFiltered = filteredBannersByPad(sIndex, aPadId);
+
+    aResult.resize(sIndex.m_BannerIds.size());
+    aResult.reset();
+    // Campaigns are visited in order of their banner ranges, so the sorted
+    // filtered positions are walked once along with them.
+    const uint32_t* sFilteredItr = sFiltered.begin();
+    for (size_t sBit = sCampaigns.find_first();
+         sBit != sCampaigns.npos;
+         sBit = sCampaigns.find_next(sBit))
     {
-        // No banners are filtered
-        static const std::unordered_set<uint32_t> sEmpty;
-        return sEmpty;
+        const IndexedCampaign& sIndCamp = sIndex.m_Campaigns[sBit];
+        uint32_t sFirst = sIndCamp.m_FirstBannerPosition;
+        uint32_t sLast = sFirst + sIndCamp.m_BannerCount;
+        aResult.set(sFirst, sIndCamp.m_BannerCount, true);
+        // Skip filtered banners of campaigns that are not allowed.
+        sFilteredItr = std::lower_bound(sFilteredItr, sFiltered.end(), sFirst);
+        for (; sFilteredItr != sFiltered.end() && *sFilteredItr < sLast; ++sFilteredItr)
+            aResult.reset(*sFilteredItr);
     }
-    return sItr->second;
-}
\ No newline at end of file
+}
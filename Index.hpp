@@ -1,11 +1,15 @@
 #pragma once
 
+#include <algorithm>
+#include <memory>
 #include <unordered_map>
-#include <unordered_set>
 #include <vector>
 
 #include "Db.hpp"
 #include "dynamic_bitset.hpp"
+#include "Epoch.hpp"
+#include "FlatArray.hpp"
+#include "GroupCache.hpp"
 #include "Win.hpp"
 
 // Campaign in index.
@@ -13,38 +17,289 @@ struct IndexedCampaign
 {
     uint32_t m_UserId;
     uint32_t m_CampaignId;
-    // Position of first banner in IndexedBanners array.
+    // Position of first banner in IndexedBanners columns.
     uint32_t m_FirstBannerPosition;
-    // Count of banners in IndexedBanners array.
+    // Count of banners in IndexedBanners columns.
     uint32_t m_BannerCount;
 };
 
 // Array of campaigns in the index.
 // This vector will be initialized during loading of filters.
 // Campaigns must be ordered by users (campaigns of the same user must be nearby)
+// It's the source of the index; queries use the copy in IndexVersion.
 extern std::vector<IndexedCampaign> IndexedCampaigns;
 
-// Bannerd in index.
-struct IndexedBanner
+// Banners in index, stored by columns: banner at position i is m_BannerIds[i].
+// Campaign and user of a banner are known from the campaign whose banner range
+// contains the position, so their columns are filled only on demand
+// (see setBannerOwnerColumns()), otherwise they are empty.
+struct IndexedBannerColumns
 {
-    uint32_t m_UserId;
-    uint32_t m_CampaignId;
-    uint32_t m_BannerId;
+    std::vector<uint32_t> m_BannerIds;
+    std::vector<uint32_t> m_CampaignIds;
+    std::vector<uint32_t> m_UserIds;
+
+    size_t size() const { return m_BannerIds.size(); }
 };
 
-// Array of banners in the index.
-// This vector will be initialized during loading of filters.
+// Banners in the index.
+// They will be initialized during loading of filters.
 // Banners must be ordered by campaigns (banners of the same campaigns must be nearby).
-// Also order of campaigns in this array is the same as in IndexedCampaigns.
-extern std::vector<IndexedBanner> IndexedBanners;
+// Also order of campaigns in this array is the same as in IndexedCampaigns, and
+// every campaign refers its banners by IndexedCampaign::m_FirstBannerPosition.
+// It's the source of the index; queries use the copy in IndexVersion.
+extern IndexedBannerColumns IndexedBanners;
+
+// Banners that are filtered on a pad: sorted positions in IndexedBanners.
+// Refers to memory of an index version, is valid while the caller is inside
+// a read section (CEpochReadScope) that was entered before the query.
+// Banners of a campaign occupy a contiguous range of positions, so filtered
+// banners of a campaign are a contiguous subrange too (see range()).
+class CFilteredBanners
+{
+public:
+    CFilteredBanners() = default;
+    CFilteredBanners(const uint32_t* aBegin, const uint32_t* aEnd) : m_Begin(aBegin), m_End(aEnd) {}
+
+    const uint32_t* begin() const { return m_Begin; }
+    const uint32_t* end() const { return m_End; }
+    size_t size() const { return m_End - m_Begin; }
+    bool empty() const { return m_Begin == m_End; }
+
+    bool contains(uint32_t aPosition) const
+    {
+        return std::binary_search(m_Begin, m_End, aPosition);
+    }
+
+    // Filtered banners among positions [aFirst, aFirst + aCount), e.g. among
+    // banners of a campaign (IndexedCampaign::m_FirstBannerPosition, m_BannerCount).
+    CFilteredBanners range(uint32_t aFirst, uint32_t aCount) const
+    {
+        if (m_Begin == m_End || aFirst > m_End[-1] || aFirst + aCount <= *m_Begin)
+            return CFilteredBanners();
+        const uint32_t* sBegin = std::lower_bound(m_Begin, m_End, aFirst);
+        const uint32_t* sEnd = std::lower_bound(sBegin, m_End, aFirst + aCount);
+        return CFilteredBanners(sBegin, sEnd);
+    }
+
+private:
+    const uint32_t* m_Begin = nullptr;
+    const uint32_t* m_End = nullptr;
+};
+
+// Dense layout of the index for queries.
+// Pad IDs are remapped to contiguous positions once per build, and everything
+// that a query needs is stored in flat arrays, so a query is pure array indexing:
+// pad_id -> position -> group number -> lists of bitsets -> fused OR/AND.
+// Hash maps (PositiveCampaigns etc) are used while the index is built and updated;
+// identical targeting bitsets are already interned by then and are stored once.
+// Arrays are either owned or refer to a mapped snapshot file (see Snapshot.hpp).
+struct DenseIndex
+{
+    using word_t = target::dynamic_bitset::word_t;
+    static const uint32_t NO_POSITION = UINT32_MAX;
+
+    // Size of campaign bitsets and count of words in each of them.
+    size_t m_CampaignCount = 0;
+    size_t m_BitsetWords = 0;
+    // All positive and negative bitsets one after another, m_BitsetWords words each.
+    CFlatArray<word_t> m_BitsetBank;
+
+    // Position -> pad_id, sorted by pad_id.
+    CFlatArray<uint32_t> m_PadIds;
+    // pad_id -> position (NO_POSITION if there's no such pad).
+    // Is built only if pad IDs are compact enough, otherwise m_PadIds is binary searched.
+    CFlatArray<uint32_t> m_PositionById;
+    // Position -> group number.
+    CFlatArray<uint32_t> m_PadGroups;
+    // Position -> 1 if the pad has no children, 0 otherwise.
+    CFlatArray<uint8_t> m_PadIsLeaf;
+
+    // Group number -> group ID (see Pad::m_EffectivePadsGroupId).
+    CFlatArray<uint32_t> m_GroupIds;
+    // Numbers of positive bitsets (in m_BitsetBank) of group g are stored in
+    // m_GroupPositive[m_GroupPositiveOffsets[g] .. m_GroupPositiveOffsets[g + 1]).
+    CFlatArray<uint32_t> m_GroupPositiveOffsets;
+    CFlatArray<uint32_t> m_GroupPositive;
+    // The same for negative bitsets.
+    CFlatArray<uint32_t> m_GroupNegativeOffsets;
+    CFlatArray<uint32_t> m_GroupNegative;
+    // The same for cumulative filtered banners of groups (see CFilteredBanners).
+    CFlatArray<uint32_t> m_GroupBannerOffsets;
+    CFlatArray<uint32_t> m_GroupBanners;
+
+    // Group number -> number of its materialized campaignsByPad() result
+    // (NO_POSITION if it's not materialized), empty if no group is materialized.
+    CFlatArray<uint32_t> m_GroupResultNumbers;
+    // Materialized results one after another, m_BitsetWords words each.
+    CFlatArray<word_t> m_GroupResults;
+};
+
+// Immutable version of the index that serves queries.
+// A new version is built aside and published by one atomic pointer swap, so
+// queries never wait for a rebuild. Queries use a version inside a read section
+// (CEpochReadScope), and the previous version is freed as soon as all read
+// sections that could see it are left.
+struct IndexVersion
+{
+    // Copies of IndexedCampaigns and IndexedBanners the version is built for;
+    // owner columns are empty if IndexedBanners has none.
+    CFlatArray<IndexedCampaign> m_Campaigns;
+    CFlatArray<uint32_t> m_BannerIds;
+    CFlatArray<uint32_t> m_BannerCampaignIds;
+    CFlatArray<uint32_t> m_BannerUserIds;
+    DenseIndex m_Dense;
+    // Cache of campaignsByPad() results of this version, keyed by group number.
+    mutable CGroupCache m_CampaignsCache;
+    // Memory the arrays refer to if they don't own it (e.g. mapped snapshot file).
+    std::shared_ptr<void> m_Storage;
+};
+
+// The published version of the index, nullptr if there's none yet.
+// The caller must be inside a read section (CEpochReadScope), the version
+// is valid until the section is left.
+const IndexVersion* currentIndex();
+
+// Publish given index version (e.g. loaded from a snapshot) instead of the current one.
+// Hash map parts of the index are dropped, so targeting updates are not possible
+// until the next buildIndexes().
+void installIndex(std::unique_ptr<IndexVersion> aIndex);
 
 // Build the index!
+// Then the new version is published, the previous one is served until then.
+// It may run on a background thread concurrently with queries, but not with
+// other buildIndexes(), installIndex(), targeting updates or loading of data.
 void buildIndexes();
 
+// Set m_EffectivePads of given pads that are not built yet (m_EffectivePadsAreBuilt)
+// and of their ancestors that are not built yet, in topological order, without
+// recursion. Calls may run concurrently if they don't reach the same pads that
+// are not built yet.
+void collectEffectivePads(const std::vector<Pad*>& aPads);
+
+// 64-bit hash of sorted effective pads, used to group pads with identical ones.
+uint64_t effectivePadsHash(const EffectivePadList& aEffectivePads);
+
+// Which groups get their campaignsByPad() result materialized when an index version
+// is built: a query of such a group copies the result instead of evaluating OR/AND
+// of bitsets of all effective pads. A group is materialized if it reaches any
+// of nonzero thresholds; if results don't fit into m_MaxBytes, the most queried
+// groups are preferred, then the ones with more effective pads.
+struct MaterializeSettings
+{
+    // Min count of effective pads of a group.
+    size_t m_MinEffectivePads = 0;
+    // Min count of queries of pads of a group (see setPadQueryCounts()).
+    uint64_t m_MinQueries = 0;
+    // Memory limit of materialized results.
+    size_t m_MaxBytes = SIZE_MAX;
+};
+
+// Set thresholds of materialized groups for next index versions; default
+// settings materialize nothing.
+void setMaterializeSettings(const MaterializeSettings& aSettings);
+
+// Set query frequencies of pads (pad_id -> count of queries, e.g. from logs)
+// for MaterializeSettings::m_MinQueries.
+void setPadQueryCounts(const std::unordered_map<uint32_t, uint64_t>& aCounts);
+
+// Set count of threads that run parallel phases of buildIndexes(), including the
+// calling one; zero (default) means all hardware threads.
+void setIndexBuildThreads(size_t aThreads);
+
+// Owner of a targeting: lines of Data/targeting_campaign.txt, targeting_package.txt
+// and targeting_user.txt respectively.
+enum class TargetingOwner
+{
+    Campaign,
+    Package,
+    User
+};
+
+// Incremental updates of targetings, without reloading Db and rebuilding the index.
+// Add or remove one positive or negative targeting of a campaign, package or user
+// to a pad. Only bits of the campaigns of the owner in the bitset of the pad are
+// recalculated. If the pad gets its first or loses its last targeting or filter,
+// effective pads and groups of the pad and its descendants are updated too.
+// Returns false and changes nothing if there's no such owner or pad, or no such
+// targeting to remove (any package may get a targeting, like in loadDb()).
+// Requires the index built by buildIndexes(), not loaded from a snapshot.
+// Updates are applied to hash map parts of the index, queries see them after
+// publishIndexUpdates(), so call it after a bunch of updates.
+bool addTargeting(TargetingOwner aOwner, uint32_t aOwnerId, uint32_t aPadId, bool aPositive);
+bool removeTargeting(TargetingOwner aOwner, uint32_t aOwnerId, uint32_t aPadId, bool aPositive);
+
+// Build a new index version from the updated hash map parts and publish it.
+// If groups are not changed by the updates, the published version is patched:
+// only groups whose effective pads have changed bitsets are recalculated, the
+// rest arrays and cached results are shared with or moved from it.
+void publishIndexUpdates();
+
+// Set memory budget (in bytes) of campaignsByPad() result cache.
+// The cache is keyed by effective pads group, zero budget disables it (default).
+// Every index version has its own cache, the budget applies to every version.
+// It may be called while queries run.
+void setCampaignsCacheBudget(size_t aBytes);
+
+// Current memory budget of campaignsByPad() result cache.
+size_t campaignsCacheBudget();
+
+// Print hit/miss statistics of campaignsByPad() result cache.
+void reportCampaignsCache();
+
+// Queries.
+// campaignsByPad(), campaignsByPads(), filteredBannersByPad() and bannersByPad()
+// use the current index version inside a read section and don't modify it (the
+// result cache is thread safe), so they may be called from any number of threads
+// at once, including while a new version is built and published or the cache
+// budget is changed.
+// Results of separate queries may come from different versions if a version
+// is published in between.
+
 // Get campaign bits that can be shown on given pad.
 target::dynamic_bitset campaignsByPad(uint32_t aPadId);
 
+// The same, but the result is written to caller-owned bitset.
+// Capacity of aResult is reused, so calling it in a loop with the same bitset
+// does no allocations.
+void campaignsByPad(uint32_t aPadId, target::dynamic_bitset& aResult);
+
+// Result of campaignsByPads().
+// Pads of the same effective pads group share one bitset.
+struct CampaignsBatch
+{
+    // Campaign bitsets of distinct groups of the requested pads.
+    std::vector<target::dynamic_bitset> m_Bitsets;
+    // Number of requested pad -> number of its bitset in m_Bitsets.
+    std::vector<uint32_t> m_PadResults;
+    // Operands that were taken from partial results of previous groups,
+    // and operands that were actually applied.
+    size_t m_ReusedOperands = 0;
+    size_t m_EvaluatedOperands = 0;
+
+    size_t size() const { return m_PadResults.size(); }
+    // Campaign bitset of requested pad number aPad.
+    const target::dynamic_bitset& operator[](size_t aPad) const { return m_Bitsets[m_PadResults[aPad]]; }
+};
+
+// Get campaign bits of several pads at once, the same as campaignsByPad() for each pad.
+// Pads are bucketed by effective pads group and every distinct group is evaluated once.
+// Groups are evaluated in order of their operand lists, and a group with the same
+// leading operands as the previous one continues from partial OR/AND results of them.
+// Capacity of aResult is reused by the next calls.
+void campaignsByPads(const uint32_t* aPadIds, size_t aCount, CampaignsBatch& aResult);
+
 // Get list of banners that are prohibited to show on given pad.
 // For optimisation the list doesn't include banners from fully filtered campaigns
 // (campaigns that are not present in campaignsByPad(aPadId) bitset).
-const std::unordered_set<uint32_t>& filteredBannersByPad(uint32_t aPadId);
+// The result refers to the current index version, so the caller passes its read
+// section (aScope), and the result is valid only until that section is left.
+CFilteredBanners filteredBannersByPad(const CEpochReadScope& aScope, uint32_t aPadId);
+
+// Get banner bits that can be shown on given pad.
+// Every bit of the bitset corresponds to the banner of IndexedBanners in the same position.
+// It is campaignsByPad() expanded to banners of the campaigns without filteredBannersByPad().
+target::dynamic_bitset bannersByPad(uint32_t aPadId);
+
+// The same, but the result is written to caller-owned bitset.
+void bannersByPad(uint32_t aPadId, target::dynamic_bitset& aResult);
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#ifdef WIN32
+#include <intrin.h>
+#endif
+
+#include "Win.hpp"
+
+// Histogram of latencies (or any non-negative values) with bounded relative error.
+// Values are bucketed by their highest bit and SUB_BITS following bits, so every
+// power of two range is split into 2^SUB_BITS buckets and a bucket is at most
+// 1/2^SUB_BITS (about 3%) of its values wide. Values below 2^SUB_BITS are exact.
+// Recording is a couple of bit operations and an increment, so it may be done
+// for every query.
+class CLatencyHistogram
+{
+public:
+    static const unsigned SUB_BITS = 5;
+    static const size_t SUB_BUCKETS = size_t(1) << SUB_BITS;
+    static const size_t BUCKET_COUNT = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    CLatencyHistogram() : m_Buckets(BUCKET_COUNT, 0) {}
+
+    void Record(uint64_t aValue)
+    {
+        m_Buckets[bucket(aValue)]++;
+        m_Count++;
+        m_Sum += aValue;
+        m_Min = std::min(m_Min, aValue);
+        m_Max = std::max(m_Max, aValue);
+    }
+
+    void Merge(const CLatencyHistogram& aOther)
+    {
+        for (size_t i = 0; i < BUCKET_COUNT; i++)
+            m_Buckets[i] += aOther.m_Buckets[i];
+        m_Count += aOther.m_Count;
+        m_Sum += aOther.m_Sum;
+        m_Min = std::min(m_Min, aOther.m_Min);
+        m_Max = std::max(m_Max, aOther.m_Max);
+    }
+
+    void Clear()
+    {
+        std::fill(m_Buckets.begin(), m_Buckets.end(), 0);
+        m_Count = 0;
+        m_Sum = 0;
+        m_Min = UINT64_MAX;
+        m_Max = 0;
+    }
+
+    uint64_t Count() const { return m_Count; }
+    uint64_t Sum() const { return m_Sum; }
+    uint64_t Min() const { return 0 == m_Count ? 0 : m_Min; }
+    uint64_t Max() const { return m_Max; }
+    double Mean() const { return 0 == m_Count ? 0. : double(m_Sum) / double(m_Count); }
+
+    // Value at quantile aLevel (0.5 for median, 0.999 for p99.9): the upper bound
+    // of the bucket of that value, but not more than the max recorded value.
+    uint64_t Percentile(double aLevel) const
+    {
+        if (0 == m_Count)
+            return 0;
+        uint64_t sRank = uint64_t(aLevel * double(m_Count));
+        sRank = std::min(sRank, m_Count - 1);
+        uint64_t sSeen = 0;
+        for (size_t i = 0; i < BUCKET_COUNT; i++)
+        {
+            sSeen += m_Buckets[i];
+            if (sSeen > sRank)
+                return std::min(m_Max, upperBound(i));
+        }
+        return m_Max;
+    }
+
+private:
+    static size_t bucket(uint64_t aValue)
+    {
+        if (aValue < SUB_BUCKETS)
+            return (size_t)aValue;
+        unsigned sHighBit = 63 - (unsigned)clz(aValue);
+        unsigned sShift = sHighBit - SUB_BITS;
+        // Buckets of [2^sHighBit, 2^(sHighBit + 1)) follow the exact ones.
+        return (sShift + 1) * SUB_BUCKETS + (size_t)((aValue >> sShift) - SUB_BUCKETS);
+    }
+
+    static uint64_t upperBound(size_t aBucket)
+    {
+        if (aBucket < SUB_BUCKETS)
+            return aBucket;
+        unsigned sShift = unsigned(aBucket / SUB_BUCKETS) - 1;
+        uint64_t sFirst = uint64_t(aBucket % SUB_BUCKETS + SUB_BUCKETS) << sShift;
+        return sFirst + ((uint64_t(1) << sShift) - 1);
+    }
+
+    static size_t clz(uint64_t aValue)
+    {
+#ifdef WIN32
+        unsigned long sIndex;
+        _BitScanReverse64(&sIndex, aValue);
+        return 63 - sIndex;
+#else
+        return __builtin_clzll(aValue);
+#endif
+    }
+
+    std::vector<uint64_t> m_Buckets;
+    uint64_t m_Count = 0;
+    uint64_t m_Sum = 0;
+    uint64_t m_Min = UINT64_MAX;
+    uint64_t m_Max = 0;
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <string>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only memory mapped file.
+class CMappedFile
+{
+public:
+    CMappedFile() = default;
+    CMappedFile(const CMappedFile&) = delete;
+    CMappedFile& operator=(const CMappedFile&) = delete;
+
+    ~CMappedFile()
+    {
+        Close();
+    }
+
+    bool Open(const std::string& aFilename)
+    {
+        Close();
+#ifdef _WIN32
+        m_File = CreateFileA(aFilename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                             OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (m_File == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER sSize;
+        if (!GetFileSizeEx(m_File, &sSize) || sSize.QuadPart == 0)
+        {
+            Close();
+            return false;
+        }
+        m_Mapping = CreateFileMappingA(m_File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (m_Mapping == nullptr)
+        {
+            Close();
+            return false;
+        }
+        m_Data = static_cast<const char*>(MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0));
+        if (m_Data == nullptr)
+        {
+            Close();
+            return false;
+        }
+        m_Size = (size_t)sSize.QuadPart;
+#else
+        int sFd = open(aFilename.c_str(), O_RDONLY);
+        if (sFd < 0)
+            return false;
+        struct stat sStat;
+        if (fstat(sFd, &sStat) != 0 || sStat.st_size == 0)
+        {
+            close(sFd);
+            return false;
+        }
+        void* sData = mmap(nullptr, (size_t)sStat.st_size, PROT_READ, MAP_PRIVATE, sFd, 0);
+        close(sFd);
+        if (sData == MAP_FAILED)
+            return false;
+        m_Data = static_cast<const char*>(sData);
+        m_Size = (size_t)sStat.st_size;
+#endif
+        return true;
+    }
+
+    void Close()
+    {
+#ifdef _WIN32
+        if (m_Data != nullptr)
+            UnmapViewOfFile(m_Data);
+        if (m_Mapping != nullptr)
+            CloseHandle(m_Mapping);
+        if (m_File != INVALID_HANDLE_VALUE)
+            CloseHandle(m_File);
+        m_Mapping = nullptr;
+        m_File = INVALID_HANDLE_VALUE;
+#else
+        if (m_Data != nullptr)
+            munmap(const_cast<char*>(m_Data), m_Size);
+#endif
+        m_Data = nullptr;
+        m_Size = 0;
+    }
+
+    const char* Data() const { return m_Data; }
+    size_t Size() const { return m_Size; }
+
+private:
+    const char* m_Data = nullptr;
+    size_t m_Size = 0;
+#ifdef _WIN32
+    HANDLE m_File = INVALID_HANDLE_VALUE;
+    HANDLE m_Mapping = nullptr;
+#endif
+};
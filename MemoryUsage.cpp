@@ -0,0 +1,24 @@
+#include "MemoryUsage.hpp"
+
+MemoryCounter MemoryCounters[(size_t)MemoryCategory::Count];
+
+static const char* const MemoryCategoryNames[(size_t)MemoryCategory::Count] = {
+    "Pads", "Users", "Packages", "Campaigns",
+    "PadRelations", "EffectivePads", "Targetings",
+    "PadGraph", "PadFilters",
+    "PadBitsets", "TargetingBitsetsByHash", "FilteredBanners", "GroupFilteredBanners",
+    "EffectivePadsGroups", "UpdateMaps"};
+
+MemoryUsage memoryUsage(MemoryCategory aCategory)
+{
+    const MemoryCounter& sCounter = MemoryCounters[(size_t)aCategory];
+    MemoryUsage sUsage;
+    sUsage.m_Bytes = sCounter.m_Bytes.load(std::memory_order_relaxed);
+    sUsage.m_Allocations = sCounter.m_Allocations.load(std::memory_order_relaxed);
+    return sUsage;
+}
+
+const char* memoryCategoryName(MemoryCategory aCategory)
+{
+    return MemoryCategoryNames[(size_t)aCategory];
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Win.hpp"
+
+// Structures whose heap memory is counted by CCountingAllocator.
+enum class MemoryCategory
+{
+    // Db: hash maps of pads, users, packages and campaigns (nodes and buckets).
+    Pads,
+    Users,
+    Packages,
+    Campaigns,
+    // Db: parents and children of pads, effective pads and targeting pads of owners.
+    PadRelations,
+    EffectivePads,
+    Targetings,
+    // Arrays of PadGraph.
+    PadGraph,
+    // Filters: PadFilters map.
+    PadFilters,
+    // Index: pad_id -> targeting bitset maps (PositiveCampaigns etc).
+    PadBitsets,
+    // Index: TargetingBitsetsByHash.
+    TargetingBitsetsByHash,
+    // Index: FilteredBanners and GroupCumulativeFilteredBanners.
+    FilteredBanners,
+    GroupFilteredBanners,
+    // Index: effective pads groups (GroupsByHash and GroupMembers).
+    EffectivePadsGroups,
+    // Index: what targeting updates affect (CampaignPositions etc).
+    UpdateMaps,
+    Count
+};
+
+// Bytes and count of live allocations of a category. Bytes are what containers
+// request, the heap adds its own header (8-16 bytes) to every allocation.
+struct MemoryUsage
+{
+    size_t m_Bytes = 0;
+    size_t m_Allocations = 0;
+};
+
+struct MemoryCounter
+{
+    std::atomic<size_t> m_Bytes{0};
+    std::atomic<size_t> m_Allocations{0};
+};
+
+extern MemoryCounter MemoryCounters[(size_t)MemoryCategory::Count];
+
+MemoryUsage memoryUsage(MemoryCategory aCategory);
+const char* memoryCategoryName(MemoryCategory aCategory);
+
+// std::allocator that counts memory of a category. It is stateless and keeps the
+// category when rebound, so nodes and buckets of hash maps are counted too.
+template <class T, MemoryCategory CATEGORY>
+class CCountingAllocator
+{
+public:
+    using value_type = T;
+
+    template <class U>
+    struct rebind
+    {
+        using other = CCountingAllocator<U, CATEGORY>;
+    };
+
+    CCountingAllocator() = default;
+    template <class U>
+    CCountingAllocator(const CCountingAllocator<U, CATEGORY>&) {}
+
+    T* allocate(size_t aCount)
+    {
+        T* sResult = std::allocator<T>().allocate(aCount);
+        MemoryCounter& sCounter = MemoryCounters[(size_t)CATEGORY];
+        sCounter.m_Bytes.fetch_add(aCount * sizeof(T), std::memory_order_relaxed);
+        sCounter.m_Allocations.fetch_add(1, std::memory_order_relaxed);
+        return sResult;
+    }
+
+    void deallocate(T* aPointer, size_t aCount)
+    {
+        MemoryCounter& sCounter = MemoryCounters[(size_t)CATEGORY];
+        sCounter.m_Bytes.fetch_sub(aCount * sizeof(T), std::memory_order_relaxed);
+        sCounter.m_Allocations.fetch_sub(1, std::memory_order_relaxed);
+        std::allocator<T>().deallocate(aPointer, aCount);
+    }
+
+    template <class U>
+    bool operator==(const CCountingAllocator<U, CATEGORY>&) const { return true; }
+    template <class U>
+    bool operator!=(const CCountingAllocator<U, CATEGORY>&) const { return false; }
+};
+
+// Containers whose memory is counted in a category.
+template <class T, MemoryCategory CATEGORY>
+using CountedVector = std::vector<T, CCountingAllocator<T, CATEGORY>>;
+
+template <class Key, class Value, MemoryCategory CATEGORY>
+using CountedHashMap = std::unordered_map<Key, Value, std::hash<Key>, std::equal_to<Key>,
+                                          CCountingAllocator<std::pair<const Key, Value>, CATEGORY>>;
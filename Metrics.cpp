@@ -0,0 +1,161 @@
+#include "Metrics.hpp"
+
+#include <fstream>
+#include <iostream>
+
+#include "Utils.hpp"
+
+std::atomic<bool> MetricsEnabled{false};
+
+// All metrics in order of creation, they are never removed.
+static std::mutex MetricsMutex;
+static std::vector<std::unique_ptr<CMetric>> Metrics;
+
+// Percentiles that are exported, with their names in JSON.
+static const double MetricLevels[] = {0.5, 0.9, 0.99, 0.999};
+static const char* const MetricLevelNames[] = {"p50", "p90", "p99", "p99.9"};
+
+CMetric::CMetric(MetricKind aKind, const std::string& aName)
+    : m_Kind(aKind), m_Name(aName)
+{
+    for (size_t i = 0; i < SHARD_COUNT; i++)
+        m_Shards.emplace_back(new Shard);
+}
+
+void CMetric::Record(uint64_t aNanoSec)
+{
+    static std::atomic<size_t> sNextShard{0};
+    static thread_local size_t sShard = sNextShard++ % SHARD_COUNT;
+    Shard& sOwn = *m_Shards[sShard];
+    std::lock_guard<std::mutex> sLock(sOwn.m_Mutex);
+    sOwn.m_Histogram.Record(aNanoSec);
+}
+
+CLatencyHistogram CMetric::Histogram() const
+{
+    CLatencyHistogram sResult;
+    for (const std::unique_ptr<Shard>& sShard : m_Shards)
+    {
+        std::lock_guard<std::mutex> sLock(sShard->m_Mutex);
+        sResult.Merge(sShard->m_Histogram);
+    }
+    return sResult;
+}
+
+CMetric& metric(MetricKind aKind, const std::string& aName)
+{
+    std::lock_guard<std::mutex> sLock(MetricsMutex);
+    for (const std::unique_ptr<CMetric>& sMetric : Metrics)
+        if (sMetric->Kind() == aKind && sMetric->Name() == aName)
+            return *sMetric;
+    Metrics.emplace_back(new CMetric(aKind, aName));
+    return *Metrics.back();
+}
+
+void enableMetrics()
+{
+    MetricsEnabled = true;
+}
+
+// Name with '"' and '\' escaped, as both JSON strings and Prometheus label values want.
+static std::string escapedName(const std::string& aName)
+{
+    std::string sResult;
+    for (char c : aName)
+    {
+        if ('"' == c || '\\' == c)
+            sResult.push_back('\\');
+        sResult.push_back(c);
+    }
+    return sResult;
+}
+
+// Snapshot of metrics, so their locks are not held while writing.
+static std::vector<std::pair<const CMetric*, CLatencyHistogram>> metricsSnapshot()
+{
+    std::vector<const CMetric*> sMetrics;
+    {
+        std::lock_guard<std::mutex> sLock(MetricsMutex);
+        for (const std::unique_ptr<CMetric>& sMetric : Metrics)
+            sMetrics.push_back(sMetric.get());
+    }
+    std::vector<std::pair<const CMetric*, CLatencyHistogram>> sResult;
+    for (const CMetric* sMetric : sMetrics)
+        sResult.emplace_back(sMetric, sMetric->Histogram());
+    return sResult;
+}
+
+void writeMetricsJson(std::ostream& aOut)
+{
+    auto sSnapshot = metricsSnapshot();
+    const MetricKind sKinds[] = {MetricKind::Phase, MetricKind::Query};
+    const char* const sKindNames[] = {"phases", "queries"};
+    aOut << "{";
+    for (size_t k = 0; k < 2; k++)
+    {
+        aOut << (k == 0 ? "\n" : ",\n") << "  \"" << sKindNames[k] << "\": [";
+        const char* sSeparator = "\n";
+        for (const auto& sPair : sSnapshot)
+        {
+            if (sPair.first->Kind() != sKinds[k])
+                continue;
+            const CLatencyHistogram& sHistogram = sPair.second;
+            aOut << sSeparator << "    {\"name\": \"" << escapedName(sPair.first->Name())
+                 << "\", \"count\": " << sHistogram.Count() << ", \"total_ns\": " << sHistogram.Sum()
+                 << ", \"mean_ns\": " << uint64_t(sHistogram.Mean());
+            for (size_t i = 0; i < sizeof(MetricLevels) / sizeof(MetricLevels[0]); i++)
+                aOut << ", \"" << MetricLevelNames[i] << "_ns\": " << sHistogram.Percentile(MetricLevels[i]);
+            aOut << ", \"max_ns\": " << sHistogram.Max() << "}";
+            sSeparator = ",\n";
+        }
+        aOut << "\n  ]";
+    }
+    aOut << "\n}" << std::endl;
+}
+
+void writeMetricsPrometheus(std::ostream& aOut)
+{
+    auto sSnapshot = metricsSnapshot();
+    const MetricKind sKinds[] = {MetricKind::Phase, MetricKind::Query};
+    const char* const sFamilies[] = {"padindex_phase_duration_seconds", "padindex_query_duration_seconds"};
+    const char* const sLabels[] = {"phase", "query"};
+    const char* const sHelps[] = {"Duration of index build phases and other timed scopes.",
+                                  "Latency of index queries."};
+    for (size_t k = 0; k < 2; k++)
+    {
+        aOut << "# HELP " << sFamilies[k] << " " << sHelps[k] << "\n"
+             << "# TYPE " << sFamilies[k] << " summary\n";
+        for (const auto& sPair : sSnapshot)
+        {
+            if (sPair.first->Kind() != sKinds[k])
+                continue;
+            const CLatencyHistogram& sHistogram = sPair.second;
+            std::string sLabel = std::string(sLabels[k]) + "=\"" + escapedName(sPair.first->Name()) + "\"";
+            for (double sLevel : MetricLevels)
+                aOut << sFamilies[k] << "{" << sLabel << ",quantile=\"" << sLevel << "\"} "
+                     << double(sHistogram.Percentile(sLevel)) / 1e9 << "\n";
+            aOut << sFamilies[k] << "_sum{" << sLabel << "} " << double(sHistogram.Sum()) / 1e9 << "\n"
+                 << sFamilies[k] << "_count{" << sLabel << "} " << sHistogram.Count() << "\n";
+        }
+    }
+    aOut.flush();
+}
+
+void writeMetrics(const std::string& aFilename, bool aPrometheus)
+{
+    std::ofstream sFile;
+    if ("-" != aFilename)
+    {
+        sFile.open(aFilename, std::ios::trunc);
+        check(sFile.is_open(), "Can't create metrics file!");
+    }
+    std::ostream& sOut = "-" == aFilename ? std::cout : sFile;
+    if (aPrometheus)
+        writeMetricsPrometheus(sOut);
+    else
+        writeMetricsJson(sOut);
+    if ("-" == aFilename)
+        return;
+    check(sFile.good(), "Failed to write metrics file!");
+    std::cout << "Metrics are written to " << aFilename << std::endl;
+}
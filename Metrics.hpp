@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "LatencyHistogram.hpp"
+#include "Timer.hpp"
+#include "Win.hpp"
+
+// Metrics of different kinds are exported as different families.
+enum class MetricKind
+{
+    // CTitle scopes: build phases, loading of files and so on.
+    Phase,
+    // Public query functions of the index.
+    Query
+};
+
+// Count, total time and latency histogram of a phase or a query type, in nanoseconds.
+// Recording threads are spread over shards, so concurrent queries rarely share a lock.
+class CMetric
+{
+public:
+    CMetric(MetricKind aKind, const std::string& aName);
+
+    CMetric(const CMetric&) = delete;
+    CMetric& operator=(const CMetric&) = delete;
+
+    MetricKind Kind() const { return m_Kind; }
+    const std::string& Name() const { return m_Name; }
+
+    void Record(uint64_t aNanoSec);
+    // Histogram of all shards.
+    CLatencyHistogram Histogram() const;
+
+private:
+    static const size_t SHARD_COUNT = 16;
+
+    // Shards are padded so they don't share cache lines.
+    struct Shard
+    {
+        std::mutex m_Mutex;
+        CLatencyHistogram m_Histogram;
+        char m_Padding[64];
+    };
+
+    MetricKind m_Kind;
+    std::string m_Name;
+    std::vector<std::unique_ptr<Shard>> m_Shards;
+};
+
+// Metric of the given kind and name; it's created on first use and lives till exit.
+CMetric& metric(MetricKind aKind, const std::string& aName);
+
+// Metrics are not recorded by default, as a query then takes two more reads of the clock.
+extern std::atomic<bool> MetricsEnabled;
+
+inline bool metricsEnabled()
+{
+    return MetricsEnabled.load(std::memory_order_relaxed);
+}
+
+void enableMetrics();
+
+// Records time of a scope to a metric if metrics are enabled.
+class CMetricTimer
+{
+public:
+    explicit CMetricTimer(CMetric& aMetric)
+        : m_Metric(metricsEnabled() ? &aMetric : nullptr), m_Timer(m_Metric != nullptr)
+    {
+    }
+    ~CMetricTimer()
+    {
+        if (m_Metric != nullptr)
+            m_Metric->Record(m_Timer.ElapsedNanoSec());
+    }
+
+private:
+    CMetric* m_Metric;
+    CTimer m_Timer;
+};
+
+// Dump all metrics: count, total, mean, percentiles and max of every one.
+void writeMetricsJson(std::ostream& aOut);
+// Prometheus text format: a summary per family, labelled by name of the phase or query.
+void writeMetricsPrometheus(std::ostream& aOut);
+// Dump to a file, "-" for stdout.
+void writeMetrics(const std::string& aFilename, bool aPrometheus);
@@ -0,0 +1,106 @@
+#include "PadGraph.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Db.hpp"
+#include "Utils.hpp"
+
+CPadGraph PadGraph;
+
+const uint32_t CPadGraph::NO_POSITION;
+
+void CPadGraph::Build()
+{
+    {
+        CTitle title("Indexing: Build pad graph");
+        Clear();
+        // Pads are sorted by IDs, the comparator doesn't dereference them.
+        std::vector<std::pair<uint32_t, const Pad*>> sPads;
+        sPads.reserve(Pads.size());
+        size_t sParents = 0;
+        size_t sChildren = 0;
+        size_t sEffectivePads = 0;
+        for (const auto& sPair : Pads)
+        {
+            sPads.emplace_back(sPair.first, &sPair.second);
+            sParents += sPair.second.m_DirectParents.size();
+            sChildren += sPair.second.m_DirectChildren.size();
+            sEffectivePads += sPair.second.m_EffectivePads.size();
+        }
+        check(sEffectivePads < UINT32_MAX, "Too many effective pads for the pad graph");
+        std::sort(sPads.begin(), sPads.end());
+
+        // Arrays are reserved exactly, as the graph lives till the next build.
+        m_PadIds.reserve(sPads.size());
+        m_GroupIds.reserve(sPads.size());
+        for (const auto& sPad : sPads)
+        {
+            m_PadIds.push_back(sPad.first);
+            m_GroupIds.push_back(sPad.second->m_EffectivePadsGroupId);
+        }
+
+        // Positions are assigned once: pad_id -> position, by a direct table if
+        // pad IDs are compact enough (like DenseIndex::m_PositionById), by a hash map otherwise.
+        uint32_t sMaxId = sPads.empty() ? 0 : sPads.back().first;
+        std::vector<uint32_t> sPositionById;
+        std::unordered_map<uint32_t, uint32_t> sPositionByIdMap;
+        if (sMaxId / 4 <= sPads.size())
+        {
+            sPositionById.assign(size_t(sMaxId) + 1, NO_POSITION);
+            for (size_t i = 0; i < sPads.size(); i++)
+                sPositionById[sPads[i].first] = (uint32_t)i;
+        }
+        else
+        {
+            sPositionByIdMap.reserve(sPads.size());
+            for (size_t i = 0; i < sPads.size(); i++)
+                sPositionByIdMap.emplace(sPads[i].first, (uint32_t)i);
+        }
+        auto sPosition = [&](const Pad* aPad)
+        {
+            return sPositionById.empty() ? sPositionByIdMap.find(aPad->m_Id)->second : sPositionById[aPad->m_Id];
+        };
+
+        m_ParentOffsets.reserve(sPads.size() + 1);
+        m_ChildOffsets.reserve(sPads.size() + 1);
+        m_EffectivePadOffsets.reserve(sPads.size() + 1);
+        m_Parents.reserve(sParents);
+        m_Children.reserve(sChildren);
+        m_EffectivePads.reserve(sEffectivePads);
+        m_ParentOffsets.push_back(0);
+        m_ChildOffsets.push_back(0);
+        m_EffectivePadOffsets.push_back(0);
+        for (const auto& sPair : sPads)
+        {
+            const Pad* sPad = sPair.second;
+            for (const Pad* sParent : sPad->m_DirectParents)
+                m_Parents.push_back(sPosition(sParent));
+            for (const Pad* sChild : sPad->m_DirectChildren)
+                m_Children.push_back(sPosition(sChild));
+            m_EffectivePads.insert(m_EffectivePads.end(), sPad->m_EffectivePads.begin(), sPad->m_EffectivePads.end());
+            m_ParentOffsets.push_back((uint32_t)m_Parents.size());
+            m_ChildOffsets.push_back((uint32_t)m_Children.size());
+            m_EffectivePadOffsets.push_back((uint32_t)m_EffectivePads.size());
+        }
+    }
+
+    std::cout << "Pad graph: pads / relations / effective pads: " << m_PadIds.size()
+              << " / " << m_Parents.size() << " / " << m_EffectivePads.size() << std::endl;
+}
+
+void CPadGraph::Clear()
+{
+    *this = CPadGraph();
+}
+
+uint32_t CPadGraph::Position(uint32_t aPadId) const
+{
+    auto sItr = std::lower_bound(m_PadIds.begin(), m_PadIds.end(), aPadId);
+    if (sItr == m_PadIds.end() || *sItr != aPadId)
+        return NO_POSITION;
+    return (uint32_t)(sItr - m_PadIds.begin());
+}
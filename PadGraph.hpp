@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "MemoryUsage.hpp"
+#include "Win.hpp"
+
+// Pad positions or IDs that are stored one after another in an array of CPadGraph.
+class CPadRange
+{
+public:
+    CPadRange(const uint32_t* aBegin, const uint32_t* aEnd) : m_Begin(aBegin), m_End(aEnd) {}
+
+    const uint32_t* begin() const { return m_Begin; }
+    const uint32_t* end() const { return m_End; }
+    size_t size() const { return m_End - m_Begin; }
+    bool empty() const { return m_Begin == m_End; }
+    uint32_t operator[](size_t aIndex) const { return m_Begin[aIndex]; }
+
+private:
+    const uint32_t* m_Begin;
+    const uint32_t* m_End;
+};
+
+// Compact read-only copy of the pad DAG and effective pads of Pads.
+// Pads are numbered by positions in order of pad IDs (the same positions as in
+// DenseIndex), and lists of all pads are stored one after another in a few arrays:
+// lists of the pad at position p are values[offsets[p] .. offsets[p + 1]).
+// So walks over relations and effective pads read sequential memory instead of
+// three vectors of every Pad scattered over the heap.
+// Pads stay the source of the data: the graph is rebuilt when the index is built
+// and when targeting updates change effective pads.
+class CPadGraph
+{
+public:
+    static const uint32_t NO_POSITION = UINT32_MAX;
+
+    // Build from Pads, their effective pads and groups must be built.
+    void Build();
+    void Clear();
+
+    size_t Size() const { return m_PadIds.size(); }
+    uint32_t PadId(uint32_t aPosition) const { return m_PadIds[aPosition]; }
+    // See Pad::m_EffectivePadsGroupId.
+    uint32_t GroupId(uint32_t aPosition) const { return m_GroupIds[aPosition]; }
+    // Position of a pad, NO_POSITION if there's no such pad.
+    uint32_t Position(uint32_t aPadId) const;
+
+    // Positions of direct parents and children of a pad.
+    CPadRange Parents(uint32_t aPosition) const { return range(m_ParentOffsets, m_Parents, aPosition); }
+    CPadRange Children(uint32_t aPosition) const { return range(m_ChildOffsets, m_Children, aPosition); }
+    // Sorted IDs of effective pads of a pad (see Pad::m_EffectivePads).
+    CPadRange EffectivePads(uint32_t aPosition) const
+    {
+        return range(m_EffectivePadOffsets, m_EffectivePads, aPosition);
+    }
+
+    // All pad IDs, sorted.
+    CPadRange PadIds() const { return CPadRange(m_PadIds.data(), m_PadIds.data() + m_PadIds.size()); }
+
+private:
+    using Array = CountedVector<uint32_t, MemoryCategory::PadGraph>;
+
+    static CPadRange range(const Array& aOffsets, const Array& aValues, uint32_t aPosition)
+    {
+        return CPadRange(aValues.data() + aOffsets[aPosition], aValues.data() + aOffsets[aPosition + 1]);
+    }
+
+    Array m_PadIds;
+    Array m_GroupIds;
+    Array m_ParentOffsets;
+    Array m_Parents;
+    Array m_ChildOffsets;
+    Array m_Children;
+    Array m_EffectivePadOffsets;
+    Array m_EffectivePads;
+};
+
+// The graph of Pads, see CPadGraph::Build().
+extern CPadGraph PadGraph;
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <string>
 #include <unordered_map>
 #include <vector>
 
@@ -6,14 +7,39 @@
 #include "Db.hpp"
 #include "Filters.hpp"
 #include "Index.hpp"
+#include "Metrics.hpp"
+#include "PerfCounters.hpp"
+#include "Snapshot.hpp"
 
-int main()
+int main(int argc, char** argv)
 {
-    std::cout << " *************   loading data   ************* " << std::endl;
-    loadDb();
-    loadPrecalculatedFilters();
-    std::cout << " ************* buildind indexes ************* " << std::endl;
-    buildIndexes();
+    BenchOptions sOptions;
+    if (!parseBenchOptions(argc, argv, sOptions))
+        return 1;
+    // Before threads are started, so they count themselves too.
+    if (sOptions.m_PerfCounters)
+        enablePerfCounters();
+    if (!sOptions.m_MetricsFile.empty())
+        enableMetrics();
+    setBannerOwnerColumns(sOptions.m_BannerOwners);
+    // Before the build, so the cache stats of the build are printed with index sizes.
+    setCampaignsCacheBudget(sOptions.m_CampaignsCacheMB * 1024 * 1024);
+    std::vector<std::string> sSources = dbFiles();
+    sSources.push_back(PrecalculatedFiltersFile);
+    bool sUseSnapshot = !sOptions.m_SnapshotFile.empty();
+    if (!sUseSnapshot || !loadSnapshot(sOptions.m_SnapshotFile, sSources))
+    {
+        std::cout << " *************   loading data   ************* " << std::endl;
+        loadDb();
+        loadPrecalculatedFilters();
+        std::cout << " ************* buildind indexes ************* " << std::endl;
+        buildIndexes();
+        if (sUseSnapshot)
+            saveSnapshot(sOptions.m_SnapshotFile, sSources);
+    }
     std::cout << " **************** bechmarks ***************** " << std::endl;
-    runBench();
+    runBench(sOptions);
+    reportCampaignsCache();
+    if (!sOptions.m_MetricsFile.empty())
+        writeMetrics(sOptions.m_MetricsFile, sOptions.m_MetricsPrometheus);
 }
\ No newline at end of file
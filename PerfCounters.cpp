@@ -0,0 +1,220 @@
+#include "PerfCounters.hpp"
+
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static const char* const PerfEventNames[PerfSample::EVENT_COUNT] = {
+    "cycles", "instructions", "L1d misses", "LLC misses", "branch misses", "dTLB misses"};
+
+static std::mutex PerfMutex;
+// Descriptors of counters of every counted thread, -1 for events that are not counted.
+struct PerfThread
+{
+    std::thread::id m_Thread;
+    std::vector<int> m_Counters;
+};
+static std::vector<PerfThread> PerfThreadCounters;
+// Values of counters of detached threads.
+static PerfSample PerfDetachedValues;
+static bool PerfEnabled = false;
+static bool PerfEventAvailable[PerfSample::EVENT_COUNT] = {};
+
+#ifdef __linux__
+static void perfEventAttr(size_t aEvent, perf_event_attr& aAttr)
+{
+    memset(&aAttr, 0, sizeof(aAttr));
+    aAttr.size = sizeof(aAttr);
+    aAttr.type = PERF_TYPE_HARDWARE;
+    // Only user space is counted, so perf_event_paranoid up to 2 is fine.
+    aAttr.exclude_kernel = 1;
+    aAttr.exclude_hv = 1;
+    // Events are not grouped: if the PMU has fewer counters than events, the kernel
+    // multiplexes them and values are scaled by enabled / running time.
+    aAttr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    const uint64_t sReadMiss = PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+    switch (aEvent)
+    {
+    case 0:
+        aAttr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case 1:
+        aAttr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case 2:
+        aAttr.type = PERF_TYPE_HW_CACHE;
+        aAttr.config = PERF_COUNT_HW_CACHE_L1D | sReadMiss;
+        break;
+    case 3:
+        aAttr.config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+    case 4:
+        aAttr.config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+    default:
+        aAttr.type = PERF_TYPE_HW_CACHE;
+        aAttr.config = PERF_COUNT_HW_CACHE_DTLB | sReadMiss;
+        break;
+    }
+}
+
+// Open available events for the calling thread, aErrors gets errno of events that failed.
+static std::vector<int> openThreadCounters(int* aErrors)
+{
+    std::vector<int> sCounters(PerfSample::EVENT_COUNT, -1);
+    for (size_t i = 0; i < PerfSample::EVENT_COUNT; i++)
+    {
+        if (aErrors == nullptr && !PerfEventAvailable[i])
+            continue;
+        perf_event_attr sAttr;
+        perfEventAttr(i, sAttr);
+        sCounters[i] = (int)syscall(SYS_perf_event_open, &sAttr, 0, -1, -1, 0);
+        if (sCounters[i] < 0 && aErrors != nullptr)
+            aErrors[i] = errno;
+    }
+    return sCounters;
+}
+
+static uint64_t readCounter(int aCounter)
+{
+    uint64_t sValues[3] = {0, 0, 0};
+    if (aCounter < 0 || read(aCounter, sValues, sizeof(sValues)) != (ssize_t)sizeof(sValues) || 0 == sValues[2])
+        return 0;
+    if (sValues[1] == sValues[2])
+        return sValues[0];
+    return uint64_t(double(sValues[0]) * double(sValues[1]) / double(sValues[2]));
+}
+
+bool enablePerfCounters()
+{
+    std::lock_guard<std::mutex> sLock(PerfMutex);
+    if (PerfEnabled)
+        return true;
+    int sErrors[PerfSample::EVENT_COUNT] = {};
+    std::vector<int> sCounters = openThreadCounters(sErrors);
+    for (size_t i = 0; i < PerfSample::EVENT_COUNT; i++)
+    {
+        PerfEventAvailable[i] = sCounters[i] >= 0;
+        PerfEnabled |= PerfEventAvailable[i];
+    }
+    if (!PerfEnabled)
+    {
+        std::cout << "Performance counters are not available: " << strerror(sErrors[0]) << std::endl;
+        return false;
+    }
+    for (size_t i = 0; i < PerfSample::EVENT_COUNT; i++)
+        if (!PerfEventAvailable[i])
+            std::cout << "Performance counter of " << PerfEventNames[i] << " is not available: "
+                      << strerror(sErrors[i]) << std::endl;
+    PerfThreadCounters.push_back(PerfThread{std::this_thread::get_id(), sCounters});
+    return true;
+}
+
+void attachPerfCountersToThread()
+{
+    std::lock_guard<std::mutex> sLock(PerfMutex);
+    if (PerfEnabled)
+        PerfThreadCounters.push_back(PerfThread{std::this_thread::get_id(), openThreadCounters(nullptr)});
+}
+
+void detachPerfCountersFromThread()
+{
+    std::lock_guard<std::mutex> sLock(PerfMutex);
+    std::thread::id sThread = std::this_thread::get_id();
+    for (size_t t = 0; t < PerfThreadCounters.size(); t++)
+    {
+        if (PerfThreadCounters[t].m_Thread != sThread)
+            continue;
+        for (size_t i = 0; i < PerfSample::EVENT_COUNT; i++)
+        {
+            int sCounter = PerfThreadCounters[t].m_Counters[i];
+            PerfDetachedValues.m_Values[i] += readCounter(sCounter);
+            if (sCounter >= 0)
+                close(sCounter);
+        }
+        PerfThreadCounters.erase(PerfThreadCounters.begin() + t);
+        return;
+    }
+}
+
+PerfSample readPerfCounters()
+{
+    std::lock_guard<std::mutex> sLock(PerfMutex);
+    PerfSample sSample = PerfDetachedValues;
+    for (const PerfThread& sThread : PerfThreadCounters)
+        for (size_t i = 0; i < PerfSample::EVENT_COUNT; i++)
+            sSample.m_Values[i] += readCounter(sThread.m_Counters[i]);
+    return sSample;
+}
+#else
+bool enablePerfCounters()
+{
+    std::cout << "Performance counters are not supported on this platform" << std::endl;
+    return false;
+}
+
+void attachPerfCountersToThread()
+{
+}
+
+void detachPerfCountersFromThread()
+{
+}
+
+PerfSample readPerfCounters()
+{
+    return PerfSample();
+}
+#endif
+
+bool perfCountersEnabled()
+{
+    std::lock_guard<std::mutex> sLock(PerfMutex);
+    return PerfEnabled;
+}
+
+void printPerfCounters(const PerfSample& aBegin, const PerfSample& aEnd, size_t aQueries)
+{
+    uint64_t sDelta[PerfSample::EVENT_COUNT];
+    for (size_t i = 0; i < PerfSample::EVENT_COUNT; i++)
+        sDelta[i] = aEnd.m_Values[i] - aBegin.m_Values[i];
+
+    std::ios_base::fmtflags sFlags = std::cout.flags();
+    std::streamsize sPrecision = std::cout.precision();
+    std::cout << std::fixed << std::setprecision(2) << " ";
+    const char* sSeparator = " ";
+    for (size_t i = 0; i < PerfSample::EVENT_COUNT; i++)
+    {
+        if (!PerfEventAvailable[i])
+            continue;
+        std::cout << sSeparator << PerfEventNames[i] << " " << sDelta[i];
+        sSeparator = ", ";
+    }
+    if (PerfEventAvailable[0] && PerfEventAvailable[1] && sDelta[0] != 0)
+        std::cout << " (IPC " << double(sDelta[1]) / double(sDelta[0]) << ")";
+    std::cout << std::endl;
+    if (aQueries != 0)
+    {
+        std::cout << "  per query:";
+        sSeparator = " ";
+        for (size_t i = 0; i < PerfSample::EVENT_COUNT; i++)
+        {
+            if (!PerfEventAvailable[i])
+                continue;
+            std::cout << sSeparator << PerfEventNames[i] << " " << double(sDelta[i]) / double(aQueries);
+            sSeparator = ", ";
+        }
+        std::cout << std::endl;
+    }
+    std::cout.flags(sFlags);
+    std::cout.precision(sPrecision);
+}
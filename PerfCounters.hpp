@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Win.hpp"
+
+// Values of hardware performance counters, summed over counted threads.
+// Counters are opened with perf_event_open() on Linux and are not available elsewhere.
+struct PerfSample
+{
+    // Cycles, instructions, L1d read misses, LLC misses, branch misses, dTLB read misses.
+    static const size_t EVENT_COUNT = 6;
+
+    uint64_t m_Values[EVENT_COUNT] = {};
+};
+
+// Open counters for the calling thread; threads that are started later count themselves
+// by attachPerfCountersToThread(). Events that can't be opened (no PMU in a VM,
+// perf_event_paranoid and so on) are reported and skipped. Returns true if any event is counted.
+bool enablePerfCounters();
+
+bool perfCountersEnabled();
+
+// Count events of the calling thread too, if counters are enabled.
+// Every thread that does work inside a measured scope (CTitle etc) must be attached.
+void attachPerfCountersToThread();
+// Stop counting the calling thread: its counters are closed, and their values are
+// kept in the totals. Does nothing if the thread is not attached.
+void detachPerfCountersFromThread();
+
+// Totals of all attached threads, including detached ones. Counters are not split
+// by scopes: a scope measured on one thread includes work that other attached
+// threads do meanwhile (e.g. queries during a rebuild of the index on another
+// thread), so scopes whose counters matter must not overlap with unrelated work.
+PerfSample readPerfCounters();
+
+// Attaches the calling thread for its lifetime, for threads that are started for
+// a job: the thread is counted while it runs and its counters are closed after it.
+class CPerfCountersThread
+{
+public:
+    CPerfCountersThread() { attachPerfCountersToThread(); }
+    ~CPerfCountersThread() { detachPerfCountersFromThread(); }
+    CPerfCountersThread(const CPerfCountersThread&) = delete;
+    CPerfCountersThread& operator=(const CPerfCountersThread&) = delete;
+};
+
+// Print counters of [aBegin, aEnd): totals, IPC and, if aQueries is not 0, values per query.
+void printPerfCounters(const PerfSample& aBegin, const PerfSample& aEnd, size_t aQueries = 0);
@@ -0,0 +1,386 @@
+#include "Snapshot.hpp"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "Filters.hpp"
+#include "Index.hpp"
+#include "MappedFile.hpp"
+#include "Utils.hpp"
+
+namespace {
+
+const char SNAPSHOT_MAGIC[8] = {'P', 'A', 'D', 'I', 'N', 'D', 'E', 'X'};
+const uint32_t SNAPSHOT_VERSION = 5;
+// Every section starts at aligned offset, so every array can be used in place.
+const uint64_t SECTION_ALIGNMENT = 64;
+
+enum SnapshotSectionId
+{
+    SEC_CAMPAIGNS,
+    SEC_BANNER_IDS,
+    SEC_BANNER_CAMPAIGN_IDS,
+    SEC_BANNER_USER_IDS,
+    SEC_BITSET_BANK,
+    SEC_PAD_IDS,
+    SEC_POSITION_BY_ID,
+    SEC_PAD_GROUPS,
+    SEC_PAD_IS_LEAF,
+    SEC_GROUP_IDS,
+    SEC_GROUP_POSITIVE_OFFSETS,
+    SEC_GROUP_POSITIVE,
+    SEC_GROUP_NEGATIVE_OFFSETS,
+    SEC_GROUP_NEGATIVE,
+    SEC_GROUP_BANNER_OFFSETS,
+    SEC_GROUP_BANNERS,
+    SEC_GROUP_RESULT_NUMBERS,
+    SEC_GROUP_RESULTS,
+    SECTION_COUNT
+};
+
+struct SnapshotSection
+{
+    uint64_t m_Offset;
+    uint64_t m_Count;
+    uint64_t m_ElementSize;
+};
+
+struct SnapshotHeader
+{
+    char m_Magic[8];
+    uint32_t m_Version;
+    uint32_t m_SectionCount;
+    uint64_t m_FileSize;
+    uint64_t m_CampaignCount;
+    uint64_t m_BitsetWords;
+    // Hash of names, sizes and modification times of source data files.
+    uint64_t m_SourcesStamp;
+    SnapshotSection m_Sections[SECTION_COUNT];
+};
+
+// Hash of names, sizes and modification times of data files. Files are looked
+// for in the working directory or its parent, like loaders do; absent ones are
+// hashed as such.
+uint64_t sourcesStamp(const std::vector<std::string>& aSources)
+{
+    uint64_t sHash = 0xCBF29CE484222325ull;
+    auto sMix = [&sHash](uint64_t aValue)
+    {
+        sHash = (sHash ^ aValue) * 0x100000001B3ull;
+        sHash ^= sHash >> 29;
+    };
+    for (const std::string& sName : aSources)
+    {
+        for (char c : sName)
+            sMix((unsigned char)c);
+        struct stat sStat;
+        if (0 == stat(sName.c_str(), &sStat) || 0 == stat(("../" + sName).c_str(), &sStat))
+        {
+            sMix((uint64_t)sStat.st_size);
+            sMix((uint64_t)sStat.st_mtime);
+        }
+        else
+        {
+            sMix(UINT64_MAX);
+        }
+    }
+    return sHash;
+}
+
+uint64_t alignOffset(uint64_t aOffset)
+{
+    return (aOffset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+}
+
+struct SectionSource
+{
+    const void* m_Data;
+    size_t m_Count;
+    size_t m_ElementSize;
+};
+
+template <class T>
+SectionSource sectionSource(const T* aData, size_t aCount)
+{
+    SectionSource sRes = {aData, aCount, sizeof(T)};
+    return sRes;
+}
+
+template <class T>
+SectionSource sectionSource(const CFlatArray<T>& aArray)
+{
+    return sectionSource(aArray.data(), aArray.size());
+}
+
+// Expected element sizes of sections.
+const size_t SectionElementSizes[SECTION_COUNT] = {
+    sizeof(IndexedCampaign), sizeof(uint32_t), sizeof(uint32_t), sizeof(uint32_t), sizeof(DenseIndex::word_t),
+    sizeof(uint32_t), sizeof(uint32_t), sizeof(uint32_t), sizeof(uint8_t),
+    sizeof(uint32_t), sizeof(uint32_t), sizeof(uint32_t), sizeof(uint32_t), sizeof(uint32_t),
+    sizeof(uint32_t), sizeof(uint32_t), sizeof(uint32_t), sizeof(DenseIndex::word_t),
+};
+
+// Array of uint32_t of a section, its size must be validated.
+const uint32_t* sectionData(const char* aData, SnapshotSectionId aId)
+{
+    const SnapshotSection& sSection = reinterpret_cast<const SnapshotHeader*>(aData)->m_Sections[aId];
+    return reinterpret_cast<const uint32_t*>(aData + sSection.m_Offset);
+}
+
+// Whether all values of a uint32_t section are below aLimit.
+bool allBelow(const char* aData, SnapshotSectionId aId, uint64_t aLimit)
+{
+    const uint32_t* sData = sectionData(aData, aId);
+    uint64_t sCount = reinterpret_cast<const SnapshotHeader*>(aData)->m_Sections[aId].m_Count;
+    for (uint64_t i = 0; i < sCount; i++)
+    {
+        if (sData[i] >= aLimit)
+            return false;
+    }
+    return true;
+}
+
+// Check snapshot structure and ranges of values. Returns description of the problem or nullptr.
+const char* validate(const char* aData, size_t aSize)
+{
+    if (aSize < sizeof(SnapshotHeader))
+        return "file is too small";
+    const SnapshotHeader& sHeader = *reinterpret_cast<const SnapshotHeader*>(aData);
+    if (0 != memcmp(sHeader.m_Magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)))
+        return "wrong magic";
+    if (sHeader.m_Version != SNAPSHOT_VERSION)
+        return "unsupported version";
+    if (sHeader.m_SectionCount != SECTION_COUNT || sHeader.m_FileSize != aSize)
+        return "wrong header";
+    for (size_t i = 0; i < SECTION_COUNT; i++)
+    {
+        const SnapshotSection& sSection = sHeader.m_Sections[i];
+        if (sSection.m_ElementSize != SectionElementSizes[i] ||
+            sSection.m_Offset % SECTION_ALIGNMENT != 0 ||
+            sSection.m_Offset > aSize ||
+            sSection.m_Count > (aSize - sSection.m_Offset) / sSection.m_ElementSize)
+            return "wrong section";
+    }
+
+    const SnapshotSection* sSections = sHeader.m_Sections;
+    uint64_t sPads = sSections[SEC_PAD_IDS].m_Count;
+    uint64_t sGroups = sSections[SEC_GROUP_IDS].m_Count;
+    if (sHeader.m_CampaignCount != sSections[SEC_CAMPAIGNS].m_Count ||
+        sHeader.m_BitsetWords != (sHeader.m_CampaignCount + 63) / 64 ||
+        (0 != sHeader.m_BitsetWords && 0 != sSections[SEC_BITSET_BANK].m_Count % sHeader.m_BitsetWords))
+        return "inconsistent campaigns";
+    uint64_t sBanners = sSections[SEC_BANNER_IDS].m_Count;
+    for (SnapshotSectionId sId : {SEC_BANNER_CAMPAIGN_IDS, SEC_BANNER_USER_IDS})
+    {
+        // Owner columns are optional.
+        if (0 != sSections[sId].m_Count && sSections[sId].m_Count != sBanners)
+            return "inconsistent banners";
+    }
+    if (sSections[SEC_PAD_GROUPS].m_Count != sPads || sSections[SEC_PAD_IS_LEAF].m_Count != sPads)
+        return "inconsistent pads";
+    const SnapshotSectionId sOffsetSections[] = {SEC_GROUP_POSITIVE_OFFSETS, SEC_GROUP_NEGATIVE_OFFSETS, SEC_GROUP_BANNER_OFFSETS};
+    for (SnapshotSectionId sId : sOffsetSections)
+    {
+        const SnapshotSection& sOffsets = sSections[sId];
+        if (sOffsets.m_Count != sGroups + 1)
+            return "inconsistent groups";
+        const uint32_t* sData = sectionData(aData, sId);
+        if (sData[0] != 0 || sData[sGroups] != sSections[sId + 1].m_Count)
+            return "inconsistent groups";
+        for (uint64_t g = 0; g < sGroups; g++)
+        {
+            if (sData[g] > sData[g + 1])
+                return "inconsistent groups";
+        }
+    }
+    if ((0 != sSections[SEC_GROUP_RESULT_NUMBERS].m_Count && sSections[SEC_GROUP_RESULT_NUMBERS].m_Count != sGroups) ||
+        (0 != sHeader.m_BitsetWords && 0 != sSections[SEC_GROUP_RESULTS].m_Count % sHeader.m_BitsetWords))
+        return "inconsistent group results";
+
+    // Values that queries use as indexes must be in range, so a corrupted file
+    // can't make them read outside of the arrays.
+    const IndexedCampaign* sCampaigns = reinterpret_cast<const IndexedCampaign*>(aData + sSections[SEC_CAMPAIGNS].m_Offset);
+    for (uint64_t i = 0; i < sHeader.m_CampaignCount; i++)
+    {
+        if (uint64_t(sCampaigns[i].m_FirstBannerPosition) + sCampaigns[i].m_BannerCount > sBanners)
+            return "campaign banners out of range";
+    }
+    const uint32_t* sPadIds = sectionData(aData, SEC_PAD_IDS);
+    for (uint64_t i = 1; i < sPads; i++)
+    {
+        if (sPadIds[i - 1] >= sPadIds[i])
+            return "pad IDs are not sorted";
+    }
+    const uint32_t* sPositionById = sectionData(aData, SEC_POSITION_BY_ID);
+    for (uint64_t i = 0; i < sSections[SEC_POSITION_BY_ID].m_Count; i++)
+    {
+        if (sPositionById[i] != DenseIndex::NO_POSITION && (sPositionById[i] >= sPads || sPadIds[sPositionById[i]] != i))
+            return "pad position out of range";
+    }
+    if (!allBelow(aData, SEC_PAD_GROUPS, sGroups))
+        return "pad group out of range";
+    // Bitsets of zero words may have any number, as nothing is read from them.
+    if (0 != sHeader.m_BitsetWords)
+    {
+        uint64_t sBitsets = sSections[SEC_BITSET_BANK].m_Count / sHeader.m_BitsetWords;
+        if (!allBelow(aData, SEC_GROUP_POSITIVE, sBitsets) || !allBelow(aData, SEC_GROUP_NEGATIVE, sBitsets))
+            return "bitset number out of range";
+        uint64_t sResults = sSections[SEC_GROUP_RESULTS].m_Count / sHeader.m_BitsetWords;
+        const uint32_t* sResultNumbers = sectionData(aData, SEC_GROUP_RESULT_NUMBERS);
+        for (uint64_t i = 0; i < sSections[SEC_GROUP_RESULT_NUMBERS].m_Count; i++)
+        {
+            if (sResultNumbers[i] != DenseIndex::NO_POSITION && sResultNumbers[i] >= sResults)
+                return "group result number out of range";
+        }
+    }
+    if (!allBelow(aData, SEC_GROUP_BANNERS, sBanners))
+        return "filtered banner out of range";
+    return nullptr;
+}
+
+template <class T>
+CFlatArray<T> sectionArray(const char* aData, SnapshotSectionId aId)
+{
+    const SnapshotSection& sSection = reinterpret_cast<const SnapshotHeader*>(aData)->m_Sections[aId];
+    return CFlatArray<T>(reinterpret_cast<const T*>(aData + sSection.m_Offset), (size_t)sSection.m_Count);
+}
+
+} // namespace {
+
+void saveSnapshot(const std::string& aFilename, const std::vector<std::string>& aSources)
+{
+    CEpochReadScope sScope;
+    const IndexVersion* sVersion = currentIndex();
+    check(nullptr != sVersion, "Snapshot requires built index");
+    CTitle title("Saving index snapshot " + aFilename);
+
+    const DenseIndex& sIndex = sVersion->m_Dense;
+    SectionSource sSources[SECTION_COUNT] = {
+        sectionSource(sVersion->m_Campaigns),
+        sectionSource(sVersion->m_BannerIds),
+        sectionSource(sVersion->m_BannerCampaignIds),
+        sectionSource(sVersion->m_BannerUserIds),
+        sectionSource(sIndex.m_BitsetBank),
+        sectionSource(sIndex.m_PadIds),
+        sectionSource(sIndex.m_PositionById),
+        sectionSource(sIndex.m_PadGroups),
+        sectionSource(sIndex.m_PadIsLeaf),
+        sectionSource(sIndex.m_GroupIds),
+        sectionSource(sIndex.m_GroupPositiveOffsets),
+        sectionSource(sIndex.m_GroupPositive),
+        sectionSource(sIndex.m_GroupNegativeOffsets),
+        sectionSource(sIndex.m_GroupNegative),
+        sectionSource(sIndex.m_GroupBannerOffsets),
+        sectionSource(sIndex.m_GroupBanners),
+        sectionSource(sIndex.m_GroupResultNumbers),
+        sectionSource(sIndex.m_GroupResults),
+    };
+
+    SnapshotHeader sHeader;
+    memset(&sHeader, 0, sizeof(sHeader));
+    memcpy(sHeader.m_Magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    sHeader.m_Version = SNAPSHOT_VERSION;
+    sHeader.m_SectionCount = SECTION_COUNT;
+    sHeader.m_CampaignCount = sIndex.m_CampaignCount;
+    sHeader.m_BitsetWords = sIndex.m_BitsetWords;
+    sHeader.m_SourcesStamp = sourcesStamp(aSources);
+    uint64_t sOffset = sizeof(SnapshotHeader);
+    for (size_t i = 0; i < SECTION_COUNT; i++)
+    {
+        sOffset = alignOffset(sOffset);
+        sHeader.m_Sections[i].m_Offset = sOffset;
+        sHeader.m_Sections[i].m_Count = sSources[i].m_Count;
+        sHeader.m_Sections[i].m_ElementSize = sSources[i].m_ElementSize;
+        sOffset += sSources[i].m_Count * sSources[i].m_ElementSize;
+    }
+    sHeader.m_FileSize = sOffset;
+
+    std::ofstream sFile(aFilename, std::ios::binary | std::ios::trunc);
+    if (!sFile.is_open())
+        sFile.open("../" + aFilename, std::ios::binary | std::ios::trunc);
+    check(sFile.is_open(), "Can't create snapshot file!");
+    sFile.write(reinterpret_cast<const char*>(&sHeader), sizeof(sHeader));
+    uint64_t sWritten = sizeof(sHeader);
+    static const char sPadding[SECTION_ALIGNMENT] = {};
+    for (size_t i = 0; i < SECTION_COUNT; i++)
+    {
+        sFile.write(sPadding, sHeader.m_Sections[i].m_Offset - sWritten);
+        size_t sBytes = sSources[i].m_Count * sSources[i].m_ElementSize;
+        sFile.write(static_cast<const char*>(sSources[i].m_Data), sBytes);
+        sWritten = sHeader.m_Sections[i].m_Offset + sBytes;
+    }
+    check(sFile.good(), "Failed to write snapshot file!");
+}
+
+bool loadSnapshot(const std::string& aFilename, const std::vector<std::string>& aSources)
+{
+    std::unique_ptr<CMappedFile> sFile(new CMappedFile);
+    if (!sFile->Open(aFilename) && !sFile->Open("../" + aFilename))
+        return false;
+
+    const char* sError = validate(sFile->Data(), sFile->Size());
+    if (nullptr == sError &&
+        reinterpret_cast<const SnapshotHeader*>(sFile->Data())->m_SourcesStamp != sourcesStamp(aSources))
+        sError = "data files have changed";
+    if (nullptr == sError && bannerOwnerColumns())
+    {
+        // Owner columns are saved only if they were filled by the build.
+        const SnapshotSection* sSections = reinterpret_cast<const SnapshotHeader*>(sFile->Data())->m_Sections;
+        if (sSections[SEC_BANNER_CAMPAIGN_IDS].m_Count != sSections[SEC_BANNER_IDS].m_Count)
+            sError = "banner owner columns are required but absent";
+    }
+    if (nullptr != sError)
+    {
+        std::cout << "Index snapshot " << aFilename << " is ignored: " << sError << std::endl;
+        return false;
+    }
+
+    std::unique_ptr<IndexVersion> sVersion(new IndexVersion);
+    {
+        CTitle title("Loading index snapshot " + aFilename);
+        const char* sData = sFile->Data();
+        const SnapshotHeader& sHeader = *reinterpret_cast<const SnapshotHeader*>(sData);
+
+        sVersion->m_Campaigns = sectionArray<IndexedCampaign>(sData, SEC_CAMPAIGNS);
+        sVersion->m_BannerIds = sectionArray<uint32_t>(sData, SEC_BANNER_IDS);
+        sVersion->m_BannerCampaignIds = sectionArray<uint32_t>(sData, SEC_BANNER_CAMPAIGN_IDS);
+        sVersion->m_BannerUserIds = sectionArray<uint32_t>(sData, SEC_BANNER_USER_IDS);
+        IndexedCampaigns.assign(sVersion->m_Campaigns.begin(), sVersion->m_Campaigns.end());
+        IndexedBanners.m_BannerIds.assign(sVersion->m_BannerIds.begin(), sVersion->m_BannerIds.end());
+        IndexedBanners.m_CampaignIds.assign(sVersion->m_BannerCampaignIds.begin(), sVersion->m_BannerCampaignIds.end());
+        IndexedBanners.m_UserIds.assign(sVersion->m_BannerUserIds.begin(), sVersion->m_BannerUserIds.end());
+
+        DenseIndex& sIndex = sVersion->m_Dense;
+        sIndex.m_CampaignCount = (size_t)sHeader.m_CampaignCount;
+        sIndex.m_BitsetWords = (size_t)sHeader.m_BitsetWords;
+        sIndex.m_BitsetBank = sectionArray<DenseIndex::word_t>(sData, SEC_BITSET_BANK);
+        sIndex.m_PadIds = sectionArray<uint32_t>(sData, SEC_PAD_IDS);
+        sIndex.m_PositionById = sectionArray<uint32_t>(sData, SEC_POSITION_BY_ID);
+        sIndex.m_PadGroups = sectionArray<uint32_t>(sData, SEC_PAD_GROUPS);
+        sIndex.m_PadIsLeaf = sectionArray<uint8_t>(sData, SEC_PAD_IS_LEAF);
+        sIndex.m_GroupIds = sectionArray<uint32_t>(sData, SEC_GROUP_IDS);
+        sIndex.m_GroupPositiveOffsets = sectionArray<uint32_t>(sData, SEC_GROUP_POSITIVE_OFFSETS);
+        sIndex.m_GroupPositive = sectionArray<uint32_t>(sData, SEC_GROUP_POSITIVE);
+        sIndex.m_GroupNegativeOffsets = sectionArray<uint32_t>(sData, SEC_GROUP_NEGATIVE_OFFSETS);
+        sIndex.m_GroupNegative = sectionArray<uint32_t>(sData, SEC_GROUP_NEGATIVE);
+        sIndex.m_GroupBannerOffsets = sectionArray<uint32_t>(sData, SEC_GROUP_BANNER_OFFSETS);
+        sIndex.m_GroupBanners = sectionArray<uint32_t>(sData, SEC_GROUP_BANNERS);
+        sIndex.m_GroupResultNumbers = sectionArray<uint32_t>(sData, SEC_GROUP_RESULT_NUMBERS);
+        sIndex.m_GroupResults = sectionArray<DenseIndex::word_t>(sData, SEC_GROUP_RESULTS);
+
+        // The version refers to the mapped file, so the file lives as long as the version.
+        sVersion->m_Storage = std::shared_ptr<CMappedFile>(std::move(sFile));
+    }
+
+    std::cout << "Snapshot: campaigns / banners / pads / groups: " << sVersion->m_Campaigns.size()
+              << " / " << sVersion->m_BannerIds.size() << " / " << sVersion->m_Dense.m_PadIds.size()
+              << " / " << sVersion->m_Dense.m_GroupIds.size() << std::endl;
+    installIndex(std::move(sVersion));
+    return true;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Binary snapshot of the built index.
+//
+// The snapshot holds IndexedCampaigns, columns of IndexedBanners and the dense index
+// (bitset bank, pad positions and groups, group bitset lists and cumulative
+// filtered banners). All arrays are stored aligned in the file, so the loader
+// maps the file to memory and the dense index refers to it in place, without
+// deserialization.
+// The format is versioned; a snapshot of another version is rejected.
+// The snapshot is bound to the machine it was made on (no endianness conversion).
+// It records sizes and modification times of the data files the index is built
+// from, and it is rejected if any of them has changed since.
+
+// Save the current index version, built from data files aSources.
+// Requires the index to be built or loaded.
+void saveSnapshot(const std::string& aFilename, const std::vector<std::string>& aSources);
+
+// Load the index from a snapshot. Returns false if the file is absent, invalid,
+// made from other data files than aSources are now or has no banner owner columns
+// while they are enabled (see setBannerOwnerColumns()), in which case the current
+// index is not changed. Otherwise the loaded index is published (see installIndex()).
+bool loadSnapshot(const std::string& aFilename, const std::vector<std::string>& aSources);
@@ -0,0 +1,148 @@
+#include "ThreadPool.hpp"
+
+#include <iomanip>
+#include <iostream>
+
+CThreadPool::CThreadPool(size_t aThreads)
+{
+    aThreads = std::max<size_t>(1, aThreads);
+    for (size_t i = 0; i < aThreads; i++)
+        m_Queues.emplace_back(new Queue);
+    // Thread 0 is the one that calls ParallelFor().
+    for (size_t i = 1; i < aThreads; i++)
+        m_Workers.emplace_back(&CThreadPool::workerLoop, this, i);
+}
+
+CThreadPool::~CThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> sLock(m_SleepMutex);
+        m_Stop = true;
+    }
+    m_WakeUp.notify_all();
+    for (std::thread& sWorker : m_Workers)
+        sWorker.join();
+}
+
+void CThreadPool::ParallelFor(size_t aBegin, size_t aEnd, size_t aGrain,
+                              const std::function<void(size_t, size_t)>& aBody)
+{
+    if (aBegin >= aEnd)
+        return;
+    std::lock_guard<std::mutex> sCallLock(m_CallMutex);
+    CTimer sTimer(true);
+
+    aGrain = std::max<size_t>(1, aGrain);
+    size_t sChunks = (aEnd - aBegin + aGrain - 1) / aGrain;
+    Job sJob;
+    sJob.m_Body = &aBody;
+    sJob.m_Pending = sChunks;
+    // Deal contiguous runs of chunks to threads, so a thread works on neighbouring data.
+    for (size_t i = 0; i < sChunks; i++)
+    {
+        Queue& sQueue = *m_Queues[i * m_Queues.size() / sChunks];
+        std::lock_guard<std::mutex> sLock(sQueue.m_Mutex);
+        sQueue.m_Chunks.push_back(Chunk{&sJob, aBegin + i * aGrain, std::min(aEnd, aBegin + (i + 1) * aGrain)});
+    }
+    if (!m_Workers.empty())
+    {
+        {
+            std::lock_guard<std::mutex> sLock(m_SleepMutex);
+            m_Generation++;
+        }
+        m_WakeUp.notify_all();
+    }
+
+    // The calling thread works too, then waits for chunks that others are running.
+    Chunk sChunk;
+    while (takeChunk(0, sChunk))
+        runChunk(sChunk);
+    while (sJob.m_Pending.load() != 0)
+        std::this_thread::yield();
+
+    m_ParallelNanoSec += sTimer.ElapsedNanoSec();
+}
+
+bool CThreadPool::takeChunk(size_t aThreadNo, Chunk& aChunk)
+{
+    {
+        Queue& sOwn = *m_Queues[aThreadNo];
+        std::lock_guard<std::mutex> sLock(sOwn.m_Mutex);
+        if (!sOwn.m_Chunks.empty())
+        {
+            aChunk = sOwn.m_Chunks.back();
+            sOwn.m_Chunks.pop_back();
+            return true;
+        }
+    }
+    for (size_t i = 1; i < m_Queues.size(); i++)
+    {
+        Queue& sVictim = *m_Queues[(aThreadNo + i) % m_Queues.size()];
+        std::lock_guard<std::mutex> sLock(sVictim.m_Mutex);
+        if (!sVictim.m_Chunks.empty())
+        {
+            aChunk = sVictim.m_Chunks.front();
+            sVictim.m_Chunks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void CThreadPool::runChunk(const Chunk& aChunk)
+{
+    CTimer sTimer(true);
+    (*aChunk.m_Job->m_Body)(aChunk.m_Begin, aChunk.m_End);
+    m_BusyNanoSec += sTimer.ElapsedNanoSec();
+    // The job may be finished and destroyed right after the last chunk is counted.
+    aChunk.m_Job->m_Pending--;
+}
+
+void CThreadPool::workerLoop(size_t aThreadNo)
+{
+    CPerfCountersThread sCounters;
+    size_t sGeneration = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> sLock(m_SleepMutex);
+            m_WakeUp.wait(sLock, [&]() { return m_Stop || m_Generation != sGeneration; });
+            if (m_Stop)
+                return;
+            sGeneration = m_Generation;
+        }
+        Chunk sChunk;
+        while (takeChunk(aThreadNo, sChunk))
+            runChunk(sChunk);
+    }
+}
+
+CParallelTitle::CParallelTitle(const CThreadPool& aPool, const std::string& aMessage)
+    : m_Pool(aPool), m_Message(aMessage), m_Timer(true), m_Busy(aPool.BusyMicroSec()), m_Parallel(aPool.ParallelMicroSec())
+{
+    std::cout << aMessage << "...";
+    if (perfCountersEnabled())
+        m_Counters = readPerfCounters();
+}
+
+CParallelTitle::~CParallelTitle()
+{
+    m_Timer.Stop();
+    PerfSample sCounters;
+    if (perfCountersEnabled())
+        sCounters = readPerfCounters();
+    unsigned long long sWall = std::max<unsigned long long>(1, m_Timer.ElapsedMicroSec());
+    unsigned long long sParallel = m_Pool.ParallelMicroSec() - m_Parallel;
+    unsigned long long sSerial = sWall > sParallel ? sWall - sParallel : 0;
+    double sSpeedup = double(sSerial + m_Pool.BusyMicroSec() - m_Busy) / double(sWall);
+    std::ios_base::fmtflags sFlags = std::cout.flags();
+    std::streamsize sPrecision = std::cout.precision();
+    std::cout << " done in " << m_Timer.ElapsedMilliSec() << " milliseconds (" << m_Pool.Threads()
+              << " threads, speedup " << std::fixed << std::setprecision(2) << sSpeedup << "x)." << std::endl;
+    std::cout.flags(sFlags);
+    std::cout.precision(sPrecision);
+    if (perfCountersEnabled())
+        printPerfCounters(m_Counters, sCounters);
+    if (metricsEnabled())
+        metric(MetricKind::Phase, m_Message).Record(m_Timer.ElapsedNanoSec());
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Metrics.hpp"
+#include "PerfCounters.hpp"
+#include "Timer.hpp"
+#include "Win.hpp"
+
+// Pool of threads with work stealing for parallel phases of the index build.
+// ParallelFor() splits a range into chunks and deals them to queues of threads;
+// every thread (the calling one too) takes chunks from the back of its own queue
+// and, when it's empty, steals chunks from the front of other queues, so threads
+// that got cheap chunks help the ones that got expensive chunks.
+class CThreadPool
+{
+public:
+    // aThreads is the total count of threads including the calling one.
+    explicit CThreadPool(size_t aThreads);
+    ~CThreadPool();
+
+    CThreadPool(const CThreadPool&) = delete;
+    CThreadPool& operator=(const CThreadPool&) = delete;
+
+    size_t Threads() const { return m_Queues.size(); }
+
+    // Call aBody(aChunkBegin, aChunkEnd) for chunks of [aBegin, aEnd) of about
+    // aGrain elements on all threads, and return when all chunks are done.
+    // aBody must not call ParallelFor().
+    void ParallelFor(size_t aBegin, size_t aEnd, size_t aGrain, const std::function<void(size_t, size_t)>& aBody);
+
+    // Sum of time that threads spent in chunks and wall time of ParallelFor() calls.
+    unsigned long long BusyMicroSec() const { return m_BusyNanoSec / 1000; }
+    unsigned long long ParallelMicroSec() const { return m_ParallelNanoSec / 1000; }
+
+private:
+    struct Job
+    {
+        const std::function<void(size_t, size_t)>* m_Body;
+        std::atomic<size_t> m_Pending;
+    };
+
+    struct Chunk
+    {
+        Job* m_Job;
+        size_t m_Begin;
+        size_t m_End;
+    };
+
+    // Queue of chunks of a thread, padded so queues don't share cache lines.
+    struct Queue
+    {
+        std::mutex m_Mutex;
+        std::deque<Chunk> m_Chunks;
+        char m_Padding[64];
+    };
+
+    bool takeChunk(size_t aThreadNo, Chunk& aChunk);
+    void runChunk(const Chunk& aChunk);
+    void workerLoop(size_t aThreadNo);
+
+    std::vector<std::unique_ptr<Queue>> m_Queues;
+    std::vector<std::thread> m_Workers;
+    // Serializes ParallelFor() calls.
+    std::mutex m_CallMutex;
+    // Workers sleep while there are no chunks.
+    std::mutex m_SleepMutex;
+    std::condition_variable m_WakeUp;
+    size_t m_Generation = 0;
+    bool m_Stop = false;
+    std::atomic<unsigned long long> m_BusyNanoSec{0};
+    std::atomic<unsigned long long> m_ParallelNanoSec{0};
+};
+
+// Sort a vector on all threads of the pool: parts are sorted in parallel, then
+// neighbouring sorted parts are merged pairwise in parallel.
+template <class T, class LESS>
+void parallelSort(CThreadPool& aPool, std::vector<T>& aData, LESS aLess)
+{
+    const size_t MIN_PART_SIZE = 16384;
+    size_t sParts = std::min(aPool.Threads() * 4, aData.size() / MIN_PART_SIZE);
+    if (sParts < 2)
+    {
+        std::sort(aData.begin(), aData.end(), aLess);
+        return;
+    }
+    std::vector<size_t> sBounds;
+    for (size_t i = 0; i <= sParts; i++)
+        sBounds.push_back(aData.size() * i / sParts);
+    aPool.ParallelFor(0, sParts, 1, [&](size_t aFirst, size_t aLast)
+    {
+        for (size_t i = aFirst; i < aLast; i++)
+            std::sort(aData.begin() + sBounds[i], aData.begin() + sBounds[i + 1], aLess);
+    });
+    for (size_t sWidth = 1; sWidth < sParts; sWidth *= 2)
+    {
+        size_t sPairs = (sParts + 2 * sWidth - 1) / (2 * sWidth);
+        aPool.ParallelFor(0, sPairs, 1, [&](size_t aFirst, size_t aLast)
+        {
+            for (size_t i = aFirst; i < aLast; i++)
+            {
+                size_t sLeft = i * 2 * sWidth;
+                size_t sMiddle = std::min(sLeft + sWidth, sParts);
+                size_t sRight = std::min(sLeft + 2 * sWidth, sParts);
+                if (sMiddle < sRight)
+                    std::inplace_merge(aData.begin() + sBounds[sLeft], aData.begin() + sBounds[sMiddle],
+                                       aData.begin() + sBounds[sRight], aLess);
+            }
+        });
+    }
+}
+
+template <class T>
+void parallelSort(CThreadPool& aPool, std::vector<T>& aData)
+{
+    parallelSort(aPool, aData, std::less<T>());
+}
+
+// CTitle of a parallel phase that also reports its speedup: estimated time of the
+// phase on one thread (wall time outside of ParallelFor() plus time of all chunks)
+// relative to its wall time. Performance counters include all threads of the pool.
+class CParallelTitle
+{
+public:
+    CParallelTitle(const CThreadPool& aPool, const std::string& aMessage);
+    ~CParallelTitle();
+
+private:
+    const CThreadPool& m_Pool;
+    std::string m_Message;
+    CTimer m_Timer;
+    unsigned long long m_Busy;
+    unsigned long long m_Parallel;
+    PerfSample m_Counters;
+};
@@ -3,19 +3,21 @@
 #ifdef _WIN32
 #include <Windows.h>
 #else
-#include <sys/time.h>
+#include <chrono>
 #endif
 #include <assert.h>
 
+// Timer of a monotonic clock with nanosecond resolution (steady_clock, or
+// QueryPerformanceCounter on Windows), so it's fine for timing single queries.
 class CTimer {
 public:
 	CTimer(bool start = false) : started(false), result(0)
 	{
-		if (start)
-			Start();
 #ifdef _WIN32
 		QueryPerformanceFrequency(&pf);
 #endif
+		if (start)
+			Start();
 	}
 	void Start()
 	{
@@ -28,13 +30,17 @@ public:
 		started = false;
 		result = now() - startTime;
 	}
-	unsigned long long ElapsedMicrosec() const
+	unsigned long long ElapsedNanosec() const
 	{
 		if (started)
 			return now() - startTime;
 		else
 			return result;
 	}
+	unsigned long long ElapsedMicrosec() const
+	{
+		return ElapsedNanosec() / 1000;
+	}
 	unsigned long long ElapsedMillisec() const
 	{
 		return ElapsedMicrosec() / 1000;
@@ -59,6 +65,7 @@ public:
 	{
 		return Mrps(count) * 1000000;
 	}
+	unsigned long long ElapsedNanoSec() const { return ElapsedNanosec(); }
 	unsigned long long ElapsedMicroSec() const { return ElapsedMicrosec(); }
 	unsigned long long ElapsedMicroseconds() const { return ElapsedMicrosec(); }
 	unsigned long long ElapsedMicroSeconds() const { return ElapsedMicrosec(); }
@@ -74,16 +81,18 @@ private:
 #ifdef _WIN32
 	LARGE_INTEGER pf;
 #endif
+	// Nanoseconds since an arbitrary point.
 	unsigned long long now() const
 	{
 #ifdef _WIN32
 		LARGE_INTEGER pc;
 		QueryPerformanceCounter(&pc);
-		return (unsigned long long)(1000000 * double(pc.QuadPart) / double(pf.QuadPart));
+		unsigned long long ticks = (unsigned long long)pc.QuadPart;
+		unsigned long long freq = (unsigned long long)pf.QuadPart;
+		return ticks / freq * 1000000000 + ticks % freq * 1000000000 / freq;
 #else
-		struct timeval tv;
-		gettimeofday(&tv, 0);
-		return ((unsigned long long)tv.tv_sec) * 1000000 + tv.tv_usec;
+		return (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
 #endif
 	}
 };
@@ -3,13 +3,15 @@
 #include <stdlib.h>
 #include <iostream>
 
+#include "Metrics.hpp"
+#include "PerfCounters.hpp"
 #include "Timer.hpp"
 #include "Win.hpp"
 
 inline void fatal(const char* msg)
 {
     std::cerr << msg << std::endl;
-    exit(0);
+    exit(EXIT_FAILURE);
 }
 
 inline void check(bool expr, const char* msg)
@@ -18,19 +20,35 @@ inline void check(bool expr, const char* msg)
         fatal(msg);
 }
 
+// Prints time of a scope and, if they are enabled, performance counters of it.
+// The time is recorded to the phase metric of the message too.
 class CTitle
 {
 public:
-    CTitle(const std::string& message)
+    CTitle(const std::string& message) : m_Message(message)
     {
         m_Timer.Start();
         std::cout << message.c_str() << "...";
+        if (perfCountersEnabled())
+            m_Counters = readPerfCounters();
     }
     ~CTitle()
     {
         m_Timer.Stop();
+        PerfSample sCounters;
+        if (perfCountersEnabled())
+            sCounters = readPerfCounters();
         std::cout << " done in " << m_Timer.ElapsedMilliSec() << " milliseconds." << std::endl;
+        if (perfCountersEnabled())
+            printPerfCounters(m_Counters, sCounters, m_Queries);
+        if (metricsEnabled())
+            metric(MetricKind::Phase, m_Message).Record(m_Timer.ElapsedNanoSec());
     }
+    // Count of queries in the scope, to print counters per query.
+    void SetQueries(size_t aQueries) { m_Queries = aQueries; }
 private:
+    std::string m_Message;
     CTimer m_Timer;
+    PerfSample m_Counters;
+    size_t m_Queries = 0;
 };
@@ -1,3 +1,4 @@
+#include <stdint.h>
 #ifdef WIN32
 typedef unsigned __int32 uint32_t;
 #endif
\ No newline at end of file
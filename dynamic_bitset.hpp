@@ -2,7 +2,10 @@
 
 #include <assert.h>
 
+#include <algorithm>
 #include <climits>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <vector>
 #ifdef WIN32
@@ -10,6 +13,7 @@
 #endif
 
 #include "Win.hpp"
+#include "dynamic_bitset_kernels.hpp"
 
 namespace target {
 
@@ -42,6 +46,9 @@ namespace target {
 // Note that in any case a bitset has exactly (bitset_size / sizeof(word)) complete words.
 // Let's call unused bits of incomplete word as 'excess', all other bits - 'payload' bits.
 // Excess bits are usually in undefined state.
+//
+// Bulk operations (inplace operations, count, any, flip, ==) are delegated to
+// kernels that use the widest SIMD instruction set available (see dynamic_bitset_kernels.hpp).
 
 class dynamic_bitset
 {
@@ -100,9 +107,8 @@ public:
 
     bool any() const
     {
-        for (size_t i = 0; i < m_CompleteCount; i++)
-            if (0 != m_Bits[i])
-                return true;
+        if (kernels::active().m_Any(m_Bits.data(), m_CompleteCount))
+            return true;
         if (0 != m_PayloadMask)
             if (0 != (m_PayloadMask & m_Bits[m_CompleteCount]))
                 return true;
@@ -116,9 +122,7 @@ public:
 
     size_t count() const
     {
-        size_t sRes = 0;
-        for (size_t i = 0; i < m_CompleteCount; i++)
-            sRes += bitscount(m_Bits[i]);
+        size_t sRes = kernels::active().m_Count(m_Bits.data(), m_CompleteCount);
         if (0 != m_PayloadMask)
             sRes += bitscount(m_PayloadMask & m_Bits[m_CompleteCount]);
         return sRes;
@@ -127,9 +131,8 @@ public:
     bool operator==(const dynamic_bitset& aBitset) const
     {
         assert(m_Size == aBitset.m_Size);
-        for (size_t i = 0; i < m_CompleteCount; i++)
-            if (m_Bits[i] != aBitset.m_Bits[i])
-                return false;
+        if (!kernels::active().m_Equal(m_Bits.data(), aBitset.m_Bits.data(), m_CompleteCount))
+            return false;
         if (0 != m_PayloadMask)
             if (0 != (m_PayloadMask & (m_Bits[m_CompleteCount] ^ aBitset.m_Bits[m_CompleteCount])))
                 return false;
@@ -153,8 +156,7 @@ public:
 
     void flip()
     {
-        for (word_t& sWord : m_Bits)
-            sWord = ~sWord;
+        kernels::active().m_Not(m_Bits.data(), m_Bits.size());
     }
 
     // Bit getters and setters.
@@ -206,6 +208,26 @@ public:
         word(aPos) &= ~bit(aPos);
     }
 
+    // Set aLen bits starting from aPos to aBit.
+    void set(size_t aPos, size_t aLen, bool aBit)
+    {
+        assert(aPos + aLen <= m_Size);
+        if (0 == aLen)
+            return;
+        size_t sFirstWordNo = aPos / WORD_BITS;
+        size_t sLastWordNo = (aPos + aLen - 1) / WORD_BITS;
+        word_t sFirstMask = word_t(WORD_MAX) << (aPos % WORD_BITS);
+        word_t sLastMask = word_t(WORD_MAX) >> (WORD_BITS - 1 - (aPos + aLen - 1) % WORD_BITS);
+        if (sFirstWordNo == sLastWordNo)
+        {
+            set_masked(sFirstWordNo, sFirstMask & sLastMask, aBit);
+            return;
+        }
+        set_masked(sFirstWordNo, sFirstMask, aBit);
+        std::fill(m_Bits.begin() + sFirstWordNo + 1, m_Bits.begin() + sLastWordNo, aBit ? word_t(WORD_MAX) : 0);
+        set_masked(sLastWordNo, sLastMask, aBit);
+    }
+
     void flip(size_t aPos)
     {
         assert(aPos < m_Size);
@@ -231,24 +253,21 @@ public:
     dynamic_bitset& operator&=(const dynamic_bitset& aBitset)
     {
         assert(m_Size == aBitset.m_Size);
-        for (size_t i = 0; i < m_Bits.size(); i++)
-            m_Bits[i] &= aBitset.m_Bits[i];
+        kernels::active().m_And(m_Bits.data(), aBitset.m_Bits.data(), m_Bits.size());
         return *this;
     }
 
     dynamic_bitset& operator|=(const dynamic_bitset& aBitset)
     {
         assert(m_Size == aBitset.m_Size);
-        for (size_t i = 0; i < m_Bits.size(); i++)
-            m_Bits[i] |= aBitset.m_Bits[i];
+        kernels::active().m_Or(m_Bits.data(), aBitset.m_Bits.data(), m_Bits.size());
         return *this;
     }
 
     dynamic_bitset& operator-=(const dynamic_bitset& aBitset)
     {
         assert(m_Size == aBitset.m_Size);
-        for (size_t i = 0; i < m_Bits.size(); i++)
-            m_Bits[i] &= ~aBitset.m_Bits[i];
+        kernels::active().m_AndNot(m_Bits.data(), aBitset.m_Bits.data(), m_Bits.size());
         return *this;
     }
 
@@ -288,21 +307,66 @@ public:
         return sizeof(word_t) * m_Bits.capacity();
     }
 
+    // Word type and raw access to words.
+    // A bitset of N bits consists of words_count(N) words.
+    using word_t = kernels::word_t;
+
+    static size_t words_count(size_t aSize)
+    {
+        return (aSize + WORD_BITS - 1) / WORD_BITS;
+    }
+
+    const word_t* data() const
+    {
+        return m_Bits.data();
+    }
+
+    // Excess bits of the last word must be kept zero if words are written directly.
+    word_t* data()
+    {
+        return m_Bits.data();
+    }
+
+    // Fused multi-operand evaluation:
+    // *this = (aOr[0] | aOr[1] | ... ) & aAnd[0] & aAnd[1] & ...
+    // All operands must have aSize bits. Empty OR list gives all-zero result.
+    // The result is calculated block by block, so the block of the result
+    // stays in L1 cache while all operands are applied to it, instead of
+    // streaming the entire result through memory once per operand.
+    void assign_or_and(size_t aSize,
+                       const dynamic_bitset* const* aOr, size_t aOrCount,
+                       const dynamic_bitset* const* aAnd, size_t aAndCount)
+    {
+        assign_or_and_impl(aSize, aOr, aOrCount, aAnd, aAndCount);
+    }
+
+    // The same with operands given as raw word arrays (of words_count(aSize) words each).
+    void assign_or_and(size_t aSize,
+                       const word_t* const* aOr, size_t aOrCount,
+                       const word_t* const* aAnd, size_t aAndCount)
+    {
+        assign_or_and_impl(aSize, aOr, aOrCount, aAnd, aAndCount);
+    }
+
     // Hash of the bitset.
+    // Every word is mixed in with multiplication, so the hash depends on word
+    // positions too: plain XOR of words cancels out equal words and doesn't
+    // distinguish bitsets that differ only by word order.
     size_t hash() const
     {
-        size_t sRes = 0;
+        uint64_t sRes = m_Size;
         for (size_t i = 0; i < m_CompleteCount; i++)
-            sRes ^= m_Bits[i];
+            sRes = (sRes ^ m_Bits[i]) * 0x9E3779B97F4A7C15ull;
         if (0 != m_PayloadMask)
-            sRes ^= m_PayloadMask & m_Bits[m_CompleteCount];
-        return sRes;
+            sRes = (sRes ^ (m_PayloadMask & m_Bits[m_CompleteCount])) * 0x9E3779B97F4A7C15ull;
+        return static_cast<size_t>(sRes ^ (sRes >> 32));
     }
 
 private:
-    using word_t = unsigned long long;
     static const size_t WORD_BITS = sizeof(word_t) * CHAR_BIT;
 	static const word_t WORD_MAX = static_cast<word_t>(-1);
+    // Block of words that is processed at once by fused operations (4KB).
+    static const size_t FUSED_BLOCK_WORDS = 512;
 
     // A couple of methods for simplification of bit access.
     word_t& word(size_t aPos)
@@ -320,6 +384,14 @@ private:
         return word_t(1) << (aPos % WORD_BITS);
     }
 
+    void set_masked(size_t aWordNo, word_t aMask, bool aBit)
+    {
+        if (aBit)
+            m_Bits[aWordNo] |= aMask;
+        else
+            m_Bits[aWordNo] &= ~aMask;
+    }
+
     // Finds lowest bit position bit in a word and caclulate its position in bitset.
     // Returns npos if out-of-bound.
     size_t get_pos(size_t aWordNo, word_t aWord) const
@@ -328,6 +400,46 @@ private:
         return sRes < m_Size ? sRes : npos;
     }
 
+    // Words of an operand of fused operations.
+    static const word_t* operand_words(const word_t* aWords, size_t)
+    {
+        return aWords;
+    }
+
+    static const word_t* operand_words(const dynamic_bitset* aBitset, size_t aSize)
+    {
+        assert(aBitset->m_Size == aSize);
+        (void)aSize;
+        return aBitset->m_Bits.data();
+    }
+
+    template <class OPERAND>
+    void assign_or_and_impl(size_t aSize,
+                            const OPERAND* aOr, size_t aOrCount,
+                            const OPERAND* aAnd, size_t aAndCount)
+    {
+        resize(aSize);
+        if (0 == aOrCount)
+        {
+            reset();
+            return;
+        }
+        const kernels::kernel_table& sKernels = kernels::active();
+        const size_t sWords = m_Bits.size();
+        word_t* sDst = m_Bits.data();
+        for (size_t sBlock = 0; sBlock < sWords; sBlock += FUSED_BLOCK_WORDS)
+        {
+            size_t sCount = sWords - sBlock < FUSED_BLOCK_WORDS ? sWords - sBlock : FUSED_BLOCK_WORDS;
+            // The first operand is copied, there's no need to zero-fill and then OR.
+            const word_t* sFirst = operand_words(aOr[0], aSize) + sBlock;
+            std::copy(sFirst, sFirst + sCount, sDst + sBlock);
+            for (size_t i = 1; i < aOrCount; i++)
+                sKernels.m_Or(sDst + sBlock, operand_words(aOr[i], aSize) + sBlock, sCount);
+            for (size_t i = 0; i < aAndCount; i++)
+                sKernels.m_And(sDst + sBlock, operand_words(aAnd[i], aSize) + sBlock, sCount);
+        }
+    }
+
     // Finds first bit position, starting with word position.
     size_t find_first(size_t aStartWordNo) const
     {
@@ -0,0 +1,479 @@
+#include "dynamic_bitset_kernels.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define BITSET_KERNELS_X86
+#include <immintrin.h>
+#ifdef WIN32
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and clang allow to compile a function for an instruction set that is not enabled
+// for the whole translation unit. MSVC allows intrinsics of any instruction set anyway.
+#ifdef __GNUC__
+#define KERNEL_TARGET(x) __attribute__((target(x)))
+#else
+#define KERNEL_TARGET(x)
+#endif
+
+namespace target {
+namespace kernels {
+
+namespace {
+
+// Scalar implementation. Is the same as the original loops of dynamic_bitset.
+size_t popcount(word_t aWord)
+{
+#ifdef WIN32
+    return _mm_popcnt_u64(aWord);
+#else
+    return __builtin_popcountll(aWord);
+#endif
+}
+
+void scalarAnd(word_t* aDst, const word_t* aSrc, size_t aCount)
+{
+    for (size_t i = 0; i < aCount; i++)
+        aDst[i] &= aSrc[i];
+}
+
+void scalarOr(word_t* aDst, const word_t* aSrc, size_t aCount)
+{
+    for (size_t i = 0; i < aCount; i++)
+        aDst[i] |= aSrc[i];
+}
+
+void scalarAndNot(word_t* aDst, const word_t* aSrc, size_t aCount)
+{
+    for (size_t i = 0; i < aCount; i++)
+        aDst[i] &= ~aSrc[i];
+}
+
+void scalarNot(word_t* aDst, size_t aCount)
+{
+    for (size_t i = 0; i < aCount; i++)
+        aDst[i] = ~aDst[i];
+}
+
+size_t scalarCount(const word_t* aSrc, size_t aCount)
+{
+    size_t sRes = 0;
+    for (size_t i = 0; i < aCount; i++)
+        sRes += popcount(aSrc[i]);
+    return sRes;
+}
+
+bool scalarAny(const word_t* aSrc, size_t aCount)
+{
+    for (size_t i = 0; i < aCount; i++)
+        if (0 != aSrc[i])
+            return true;
+    return false;
+}
+
+bool scalarEqual(const word_t* aSrc1, const word_t* aSrc2, size_t aCount)
+{
+    for (size_t i = 0; i < aCount; i++)
+        if (aSrc1[i] != aSrc2[i])
+            return false;
+    return true;
+}
+
+const kernel_table ScalarTable = {
+    &scalarAnd, &scalarOr, &scalarAndNot, &scalarNot, &scalarCount, &scalarAny, &scalarEqual
+};
+
+#ifdef BITSET_KERNELS_X86
+
+// SSE2 implementation. 2 words per vector.
+const size_t SSE2_WORDS = sizeof(__m128i) / sizeof(word_t);
+
+#define SSE2_BINARY_KERNEL(name, tail, expr)                                        \
+KERNEL_TARGET("sse2")                                                               \
+void name(word_t* aDst, const word_t* aSrc, size_t aCount)                          \
+{                                                                                   \
+    size_t i = 0;                                                                   \
+    for (; i + SSE2_WORDS <= aCount; i += SSE2_WORDS)                               \
+    {                                                                               \
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(aDst + i));    \
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(aSrc + i));    \
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(aDst + i), expr);               \
+    }                                                                               \
+    tail(aDst + i, aSrc + i, aCount - i);                                           \
+}
+
+SSE2_BINARY_KERNEL(sse2And, scalarAnd, _mm_and_si128(d, s))
+SSE2_BINARY_KERNEL(sse2Or, scalarOr, _mm_or_si128(d, s))
+SSE2_BINARY_KERNEL(sse2AndNot, scalarAndNot, _mm_andnot_si128(s, d))
+
+KERNEL_TARGET("sse2")
+void sse2Not(word_t* aDst, size_t aCount)
+{
+    const __m128i sOnes = _mm_set1_epi32(-1);
+    size_t i = 0;
+    for (; i + SSE2_WORDS <= aCount; i += SSE2_WORDS)
+    {
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(aDst + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(aDst + i), _mm_xor_si128(d, sOnes));
+    }
+    scalarNot(aDst + i, aCount - i);
+}
+
+// SSE2 has no popcount nor byte shuffle, so the classic SWAR bit counting is used.
+KERNEL_TARGET("sse2")
+size_t sse2Count(const word_t* aSrc, size_t aCount)
+{
+    const __m128i m1 = _mm_set1_epi8(0x55);
+    const __m128i m2 = _mm_set1_epi8(0x33);
+    const __m128i m4 = _mm_set1_epi8(0x0f);
+    __m128i sAcc = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + SSE2_WORDS <= aCount; i += SSE2_WORDS)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(aSrc + i));
+        x = _mm_sub_epi8(x, _mm_and_si128(_mm_srli_epi64(x, 1), m1));
+        x = _mm_add_epi8(_mm_and_si128(x, m2), _mm_and_si128(_mm_srli_epi64(x, 2), m2));
+        x = _mm_and_si128(_mm_add_epi8(x, _mm_srli_epi64(x, 4)), m4);
+        sAcc = _mm_add_epi64(sAcc, _mm_sad_epu8(x, _mm_setzero_si128()));
+    }
+    size_t sRes = (size_t)_mm_cvtsi128_si64(sAcc) + (size_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(sAcc, sAcc));
+    return sRes + scalarCount(aSrc + i, aCount - i);
+}
+
+KERNEL_TARGET("sse2")
+bool sse2Any(const word_t* aSrc, size_t aCount)
+{
+    const __m128i sZero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + SSE2_WORDS <= aCount; i += SSE2_WORDS)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(aSrc + i));
+        if (0xFFFF != _mm_movemask_epi8(_mm_cmpeq_epi8(x, sZero)))
+            return true;
+    }
+    return scalarAny(aSrc + i, aCount - i);
+}
+
+KERNEL_TARGET("sse2")
+bool sse2Equal(const word_t* aSrc1, const word_t* aSrc2, size_t aCount)
+{
+    size_t i = 0;
+    for (; i + SSE2_WORDS <= aCount; i += SSE2_WORDS)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(aSrc1 + i));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(aSrc2 + i));
+        if (0xFFFF != _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)))
+            return false;
+    }
+    return scalarEqual(aSrc1 + i, aSrc2 + i, aCount - i);
+}
+
+const kernel_table Sse2Table = {
+    &sse2And, &sse2Or, &sse2AndNot, &sse2Not, &sse2Count, &sse2Any, &sse2Equal
+};
+
+// AVX2 implementation. 4 words per vector.
+const size_t AVX2_WORDS = sizeof(__m256i) / sizeof(word_t);
+
+#define AVX2_BINARY_KERNEL(name, tail, expr)                                        \
+KERNEL_TARGET("avx2")                                                               \
+void name(word_t* aDst, const word_t* aSrc, size_t aCount)                          \
+{                                                                                   \
+    size_t i = 0;                                                                   \
+    for (; i + AVX2_WORDS <= aCount; i += AVX2_WORDS)                               \
+    {                                                                               \
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(aDst + i)); \
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(aSrc + i)); \
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(aDst + i), expr);            \
+    }                                                                               \
+    tail(aDst + i, aSrc + i, aCount - i);                                           \
+}
+
+AVX2_BINARY_KERNEL(avx2And, scalarAnd, _mm256_and_si256(d, s))
+AVX2_BINARY_KERNEL(avx2Or, scalarOr, _mm256_or_si256(d, s))
+AVX2_BINARY_KERNEL(avx2AndNot, scalarAndNot, _mm256_andnot_si256(s, d))
+
+KERNEL_TARGET("avx2")
+void avx2Not(word_t* aDst, size_t aCount)
+{
+    const __m256i sOnes = _mm256_set1_epi32(-1);
+    size_t i = 0;
+    for (; i + AVX2_WORDS <= aCount; i += AVX2_WORDS)
+    {
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(aDst + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(aDst + i), _mm256_xor_si256(d, sOnes));
+    }
+    scalarNot(aDst + i, aCount - i);
+}
+
+// Nibble lookup popcount (W. Mula).
+KERNEL_TARGET("avx2")
+size_t avx2Count(const word_t* aSrc, size_t aCount)
+{
+    const __m256i sLookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                             0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i sLowMask = _mm256_set1_epi8(0x0f);
+    __m256i sAcc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + AVX2_WORDS <= aCount; i += AVX2_WORDS)
+    {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(aSrc + i));
+        __m256i lo = _mm256_and_si256(x, sLowMask);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), sLowMask);
+        __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(sLookup, lo), _mm256_shuffle_epi8(sLookup, hi));
+        sAcc = _mm256_add_epi64(sAcc, _mm256_sad_epu8(cnt, _mm256_setzero_si256()));
+    }
+    size_t sRes = (size_t)_mm256_extract_epi64(sAcc, 0) + (size_t)_mm256_extract_epi64(sAcc, 1) +
+                  (size_t)_mm256_extract_epi64(sAcc, 2) + (size_t)_mm256_extract_epi64(sAcc, 3);
+    return sRes + scalarCount(aSrc + i, aCount - i);
+}
+
+KERNEL_TARGET("avx2")
+bool avx2Any(const word_t* aSrc, size_t aCount)
+{
+    size_t i = 0;
+    for (; i + AVX2_WORDS <= aCount; i += AVX2_WORDS)
+    {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(aSrc + i));
+        if (!_mm256_testz_si256(x, x))
+            return true;
+    }
+    return scalarAny(aSrc + i, aCount - i);
+}
+
+KERNEL_TARGET("avx2")
+bool avx2Equal(const word_t* aSrc1, const word_t* aSrc2, size_t aCount)
+{
+    size_t i = 0;
+    for (; i + AVX2_WORDS <= aCount; i += AVX2_WORDS)
+    {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(aSrc1 + i));
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(aSrc2 + i));
+        __m256i d = _mm256_xor_si256(x, y);
+        if (!_mm256_testz_si256(d, d))
+            return false;
+    }
+    return scalarEqual(aSrc1 + i, aSrc2 + i, aCount - i);
+}
+
+const kernel_table Avx2Table = {
+    &avx2And, &avx2Or, &avx2AndNot, &avx2Not, &avx2Count, &avx2Any, &avx2Equal
+};
+
+// AVX-512 implementation (F + BW). 8 words per vector.
+// Some GCC versions produce false uninitialized warnings on _mm512_undefined_*()
+// that are used inside of AVX-512 intrinsics.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+const size_t AVX512_WORDS = sizeof(__m512i) / sizeof(word_t);
+
+#define AVX512_BINARY_KERNEL(name, tail, expr)                                      \
+KERNEL_TARGET("avx512f,avx512bw")                                                   \
+void name(word_t* aDst, const word_t* aSrc, size_t aCount)                          \
+{                                                                                   \
+    size_t i = 0;                                                                   \
+    for (; i + AVX512_WORDS <= aCount; i += AVX512_WORDS)                           \
+    {                                                                               \
+        __m512i d = _mm512_loadu_si512(aDst + i);                                   \
+        __m512i s = _mm512_loadu_si512(aSrc + i);                                   \
+        _mm512_storeu_si512(aDst + i, expr);                                        \
+    }                                                                               \
+    tail(aDst + i, aSrc + i, aCount - i);                                           \
+}
+
+AVX512_BINARY_KERNEL(avx512And, scalarAnd, _mm512_and_si512(d, s))
+AVX512_BINARY_KERNEL(avx512Or, scalarOr, _mm512_or_si512(d, s))
+AVX512_BINARY_KERNEL(avx512AndNot, scalarAndNot, _mm512_andnot_si512(s, d))
+
+KERNEL_TARGET("avx512f,avx512bw")
+void avx512Not(word_t* aDst, size_t aCount)
+{
+    const __m512i sOnes = _mm512_set1_epi32(-1);
+    size_t i = 0;
+    for (; i + AVX512_WORDS <= aCount; i += AVX512_WORDS)
+    {
+        __m512i d = _mm512_loadu_si512(aDst + i);
+        _mm512_storeu_si512(aDst + i, _mm512_xor_si512(d, sOnes));
+    }
+    scalarNot(aDst + i, aCount - i);
+}
+
+// Same nibble lookup as AVX2 one, VPOPCNTQ is not required.
+KERNEL_TARGET("avx512f,avx512bw")
+size_t avx512Count(const word_t* aSrc, size_t aCount)
+{
+    const __m512i sLookup = _mm512_set4_epi32(0x04030302, 0x03020201, 0x03020201, 0x02010100);
+    const __m512i sLowMask = _mm512_set1_epi8(0x0f);
+    __m512i sAcc = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + AVX512_WORDS <= aCount; i += AVX512_WORDS)
+    {
+        __m512i x = _mm512_loadu_si512(aSrc + i);
+        __m512i lo = _mm512_and_si512(x, sLowMask);
+        __m512i hi = _mm512_and_si512(_mm512_srli_epi16(x, 4), sLowMask);
+        __m512i cnt = _mm512_add_epi8(_mm512_shuffle_epi8(sLookup, lo), _mm512_shuffle_epi8(sLookup, hi));
+        sAcc = _mm512_add_epi64(sAcc, _mm512_sad_epu8(cnt, _mm512_setzero_si512()));
+    }
+    size_t sRes = (size_t)_mm512_reduce_add_epi64(sAcc);
+    return sRes + scalarCount(aSrc + i, aCount - i);
+}
+
+KERNEL_TARGET("avx512f,avx512bw")
+bool avx512Any(const word_t* aSrc, size_t aCount)
+{
+    size_t i = 0;
+    for (; i + AVX512_WORDS <= aCount; i += AVX512_WORDS)
+    {
+        __m512i x = _mm512_loadu_si512(aSrc + i);
+        if (0 != _mm512_test_epi64_mask(x, x))
+            return true;
+    }
+    return scalarAny(aSrc + i, aCount - i);
+}
+
+KERNEL_TARGET("avx512f,avx512bw")
+bool avx512Equal(const word_t* aSrc1, const word_t* aSrc2, size_t aCount)
+{
+    size_t i = 0;
+    for (; i + AVX512_WORDS <= aCount; i += AVX512_WORDS)
+    {
+        __m512i x = _mm512_loadu_si512(aSrc1 + i);
+        __m512i y = _mm512_loadu_si512(aSrc2 + i);
+        if (0 != _mm512_cmpneq_epi64_mask(x, y))
+            return false;
+    }
+    return scalarEqual(aSrc1 + i, aSrc2 + i, aCount - i);
+}
+
+const kernel_table Avx512Table = {
+    &avx512And, &avx512Or, &avx512AndNot, &avx512Not, &avx512Count, &avx512Any, &avx512Equal
+};
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif // #ifdef BITSET_KERNELS_X86
+
+const kernel_table* const Tables[SIMD_LEVEL_COUNT] = {
+    &ScalarTable,
+#ifdef BITSET_KERNELS_X86
+    &Sse2Table,
+    &Avx2Table,
+    &Avx512Table,
+#else
+    nullptr,
+    nullptr,
+    nullptr,
+#endif
+};
+
+bool cpuSupports(simd_level aLevel)
+{
+#ifdef BITSET_KERNELS_X86
+#ifdef WIN32
+    int sInfo[4];
+    __cpuid(sInfo, 0);
+    int sMaxLeaf = sInfo[0];
+    __cpuid(sInfo, 1);
+    bool sSse2 = 0 != (sInfo[3] & (1 << 26));
+    // The OS must save YMM/ZMM state to allow AVX.
+    bool sOsXsave = 0 != (sInfo[2] & (1 << 27));
+    unsigned long long sXcr0 = sOsXsave ? _xgetbv(0) : 0;
+    bool sOsAvx = (sXcr0 & 0x6) == 0x6;
+    bool sOsAvx512 = (sXcr0 & 0xe6) == 0xe6;
+    bool sAvx2 = false, sAvx512 = false;
+    if (sMaxLeaf >= 7)
+    {
+        __cpuidex(sInfo, 7, 0);
+        sAvx2 = sOsAvx && 0 != (sInfo[1] & (1 << 5));
+        sAvx512 = sOsAvx512 && 0 != (sInfo[1] & (1 << 16)) && 0 != (sInfo[1] & (1 << 30));
+    }
+#else
+    __builtin_cpu_init();
+    bool sSse2 = __builtin_cpu_supports("sse2");
+    bool sAvx2 = __builtin_cpu_supports("avx2");
+    bool sAvx512 = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+    switch (aLevel)
+    {
+    case simd_level::scalar: return true;
+    case simd_level::sse2: return sSse2;
+    case simd_level::avx2: return sAvx2;
+    case simd_level::avx512: return sAvx512;
+    }
+    return false;
+#else
+    return aLevel == simd_level::scalar;
+#endif
+}
+
+simd_level detectLevel()
+{
+    simd_level sRes = simd_level::scalar;
+    for (size_t i = 0; i < SIMD_LEVEL_COUNT; i++)
+        if (cpuSupports(simd_level(i)))
+            sRes = simd_level(i);
+    return sRes;
+}
+
+const simd_level DetectedLevel = detectLevel();
+simd_level ActiveLevel = simd_level::scalar;
+
+} // namespace {
+
+// Scalar table is constant-initialized, so it's safe to use bitsets during static
+// initialization of other translation units.
+const kernel_table* active_table = &ScalarTable;
+
+namespace {
+// Switch to the widest implementation at startup.
+const bool Initialized = select_level(DetectedLevel);
+} // namespace {
+
+simd_level detected_level()
+{
+    return DetectedLevel;
+}
+
+bool is_supported(simd_level aLevel)
+{
+    return size_t(aLevel) <= size_t(DetectedLevel);
+}
+
+const kernel_table& table(simd_level aLevel)
+{
+    return *Tables[size_t(aLevel)];
+}
+
+simd_level active_level()
+{
+    return ActiveLevel;
+}
+
+bool select_level(simd_level aLevel)
+{
+    if (!is_supported(aLevel))
+        return false;
+    active_table = Tables[size_t(aLevel)];
+    ActiveLevel = aLevel;
+    return true;
+}
+
+const char* level_name(simd_level aLevel)
+{
+    switch (aLevel)
+    {
+    case simd_level::scalar: return "scalar";
+    case simd_level::sse2: return "sse2";
+    case simd_level::avx2: return "avx2";
+    case simd_level::avx512: return "avx512";
+    }
+    return "unknown";
+}
+
+} // namespace kernels {
+} // namespace target {
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+
+namespace target {
+namespace kernels {
+
+// Bulk word kernels of dynamic_bitset.
+//
+// All heavy loops of dynamic_bitset (inplace operations, count, flip, any, ==)
+// are delegated to a table of functions that work on raw arrays of words.
+// There are several implementations of the table: plain scalar one and a couple
+// of SIMD ones. The widest implementation the CPU supports is selected at startup,
+// the scalar one is always available as a fallback.
+// The kernels use unaligned loads and stores so no special alignment of word
+// arrays is required.
+
+using word_t = unsigned long long;
+
+// Levels of SIMD support, ordered from narrowest to widest.
+enum class simd_level
+{
+    scalar,
+    sse2,
+    avx2,
+    avx512,
+};
+
+static const size_t SIMD_LEVEL_COUNT = 4;
+
+struct kernel_table
+{
+    // aDst[i] &= aSrc[i]
+    void (*m_And)(word_t* aDst, const word_t* aSrc, size_t aCount);
+    // aDst[i] |= aSrc[i]
+    void (*m_Or)(word_t* aDst, const word_t* aSrc, size_t aCount);
+    // aDst[i] &= ~aSrc[i]
+    void (*m_AndNot)(word_t* aDst, const word_t* aSrc, size_t aCount);
+    // aDst[i] = ~aDst[i]
+    void (*m_Not)(word_t* aDst, size_t aCount);
+    // Sum of popcount(aSrc[i])
+    size_t (*m_Count)(const word_t* aSrc, size_t aCount);
+    // Is there any aSrc[i] != 0?
+    bool (*m_Any)(const word_t* aSrc, size_t aCount);
+    // Is aSrc1[i] == aSrc2[i] for all i?
+    bool (*m_Equal)(const word_t* aSrc1, const word_t* aSrc2, size_t aCount);
+};
+
+// Table that is used by dynamic_bitset now.
+// Initially it is the scalar table, it's switched to the widest supported
+// table during static initialization.
+extern const kernel_table* active_table;
+
+inline const kernel_table& active()
+{
+    return *active_table;
+}
+
+// Widest level supported by both the build and the CPU.
+simd_level detected_level();
+
+// Whether the level can be used on this CPU.
+bool is_supported(simd_level aLevel);
+
+// Table of given level. The level must be supported.
+const kernel_table& table(simd_level aLevel);
+
+// Level of active table.
+simd_level active_level();
+
+// Switch active table. Returns false (and does nothing) if the level is not supported.
+// Not thread safe, intended for benchmarks and tests.
+bool select_level(simd_level aLevel);
+
+// Human readable name of a level.
+const char* level_name(simd_level aLevel);
+
+} // namespace kernels {
+} // namespace target {